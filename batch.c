@@ -0,0 +1,163 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "vm.h"
+#include "btrace.h"
+
+/**
+ * Batch of traces shared by the worker threads. Each worker takes the next
+ * trace from @paths until all traces are taken.
+ */
+struct batch {
+	const struct vm_config *config;
+	char * const *paths;
+	unsigned int nr_paths;
+
+	unsigned int next;	/* Index of the trace to run next */
+	unsigned int nr_failed;
+};
+
+/**
+ * __run_trace()
+ *
+ * DESCRIPTION
+ *   Run the trace at @path in a new simulation, writing its output to
+ *   @path.out. The simulations share nothing but the read-only @config, so
+ *   the swap files are always anonymous ones, and the working sets go to
+ *   @path.wss if they are written.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 on error
+ */
+static int __run_trace(const struct vm_config *config, const char *path)
+{
+	struct vm_config c = *config;
+	struct vm_sim sim;
+	struct btrace_reader btrace;
+	FILE *input = NULL;
+	FILE *output;
+	char *out_path;
+	char *wss_path = NULL;
+	char *evtrace_path = NULL;
+	int ret = -1;
+
+	c.verbose = false;
+	c.swap_path = NULL;
+
+	out_path = malloc(strlen(path) + sizeof(".out"));
+	if (!out_path) return -1;
+	sprintf(out_path, "%s.out", path);
+
+	output = fopen(out_path, "w");
+	free(out_path);
+	if (!output) return -1;
+
+	switch (btrace_open(&btrace, path)) {
+	case 0:
+		break;
+	case 1:
+		input = fopen(path, "r");
+		if (input) break;
+		/* fall through */
+	default:
+		goto out_close;
+	}
+
+	if (c.wss_path) {
+		wss_path = malloc(strlen(path) + sizeof(".wss"));
+		if (!wss_path) goto out_input;
+		sprintf(wss_path, "%s.wss", path);
+		c.wss_path = wss_path;
+	}
+
+	if (c.evtrace_path) {
+		evtrace_path = malloc(strlen(path) + sizeof(".events"));
+		if (!evtrace_path) goto out_input;
+		sprintf(evtrace_path, "%s.events", path);
+		c.evtrace_path = evtrace_path;
+	}
+
+	if (vm_sim_init(&sim, &c, output)) goto out_input;
+
+	ret = input ? vm_sim_run(&sim, input) : vm_sim_replay(&sim, &btrace);
+
+	vm_sim_fini(&sim);
+
+out_input:
+	free(evtrace_path);
+	free(wss_path);
+	if (input) {
+		fclose(input);
+	} else {
+		btrace_close(&btrace);
+	}
+out_close:
+	fclose(output);
+	return ret;
+}
+
+static void *__batch_worker(void *arg)
+{
+	struct batch *batch = arg;
+	unsigned int i;
+
+	while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) <
+			batch->nr_paths) {
+		if (__run_trace(batch->config, batch->paths[i])) {
+			fprintf(stderr, "Unable to run %s\n", batch->paths[i]);
+			__atomic_fetch_add(&batch->nr_failed, 1, __ATOMIC_RELAXED);
+		}
+	}
+	return NULL;
+}
+
+int vm_batch_run(const struct vm_config *config, char * const paths[],
+		unsigned int nr_paths, unsigned int nr_threads)
+{
+	struct batch batch = {
+		.config = config,
+		.paths = paths,
+		.nr_paths = nr_paths,
+	};
+	pthread_t *threads;
+	unsigned int nr_started;
+
+	if (nr_threads > nr_paths) nr_threads = nr_paths;
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads) return -1;
+
+	for (nr_started = 0; nr_started < nr_threads; nr_started++) {
+		if (pthread_create(threads + nr_started, NULL, __batch_worker, &batch)) {
+			break;
+		}
+	}
+
+	for (unsigned int i = 0; i < nr_started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+
+	/* The started threads have drained the batch unless none started */
+	if (!nr_started) return -1;
+
+	return batch.nr_failed;
+}
@@ -0,0 +1,173 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "bitmap.h"
+
+static inline unsigned int __nr_words(unsigned int nr_bits)
+{
+	return (nr_bits + BITS_PER_WORD - 1) >> BITS_PER_WORD_SHIFT;
+}
+
+int hbitmap_init(struct hbitmap *bm, unsigned int nr_bits, bool set)
+{
+	unsigned int nr = nr_bits;
+
+	memset(bm, 0x00, sizeof(*bm));
+	bm->nr_bits = nr_bits;
+
+	/* Build levels until a single word covers the entire level below */
+	do {
+		unsigned int nr_words = __nr_words(nr);
+
+		if (bm->nr_levels == HBITMAP_MAX_LEVELS) goto out_free;
+
+		bm->levels[bm->nr_levels] = calloc(nr_words, sizeof(uint64_t));
+		if (!bm->levels[bm->nr_levels]) goto out_free;
+
+		bm->nr_levels++;
+		nr = nr_words;
+	} while (nr > 1);
+
+	if (set) {
+		for (unsigned int i = 0; i < nr_bits; i++) {
+			hbitmap_set(bm, i);
+		}
+	}
+	return 0;
+
+out_free:
+	hbitmap_fini(bm);
+	return -1;
+}
+
+void hbitmap_fini(struct hbitmap *bm)
+{
+	for (unsigned int i = 0; i < bm->nr_levels; i++) {
+		free(bm->levels[i]);
+		bm->levels[i] = NULL;
+	}
+	bm->nr_levels = 0;
+}
+
+void hbitmap_set(struct hbitmap *bm, unsigned int bit)
+{
+	for (unsigned int i = 0; i < bm->nr_levels; i++) {
+		uint64_t *word = &bm->levels[i][bit >> BITS_PER_WORD_SHIFT];
+		bool was_empty = (*word == 0);
+
+		*word |= 1ULL << (bit & (BITS_PER_WORD - 1));
+
+		/* The upper level already knows this word is not empty */
+		if (!was_empty) break;
+		bit >>= BITS_PER_WORD_SHIFT;
+	}
+}
+
+void hbitmap_clear(struct hbitmap *bm, unsigned int bit)
+{
+	for (unsigned int i = 0; i < bm->nr_levels; i++) {
+		uint64_t *word = &bm->levels[i][bit >> BITS_PER_WORD_SHIFT];
+
+		*word &= ~(1ULL << (bit & (BITS_PER_WORD - 1)));
+
+		/* Propagate only when the word becomes empty */
+		if (*word) break;
+		bit >>= BITS_PER_WORD_SHIFT;
+	}
+}
+
+long hbitmap_find_first(struct hbitmap *bm)
+{
+	unsigned long index = 0;
+
+	if (!bm->levels[bm->nr_levels - 1][0]) return -1;
+
+	for (int i = bm->nr_levels - 1; i >= 0; i--) {
+		uint64_t word = bm->levels[i][index];
+
+		index = (index << BITS_PER_WORD_SHIFT) + __builtin_ctzll(word);
+	}
+	return index;
+}
+
+long hbitmap_find_next(struct hbitmap *bm, unsigned int from)
+{
+	unsigned long index = from;
+	unsigned int nr = bm->nr_bits;	/* Bits in the level */
+	int i;
+
+	for (i = 0; i < bm->nr_levels; i++) {
+		uint64_t word;
+
+		if (index >= nr) return -1;
+
+		word = bm->levels[i][index >> BITS_PER_WORD_SHIFT] &
+				(~0ULL << (index & (BITS_PER_WORD - 1)));
+		if (word) {
+			index = (index & ~(BITS_PER_WORD - 1UL)) + __builtin_ctzll(word);
+			break;
+		}
+
+		/* Continue from the next word in the upper level */
+		index = (index >> BITS_PER_WORD_SHIFT) + 1;
+		nr = __nr_words(nr);
+	}
+	if (i == bm->nr_levels) return -1;
+
+	for (i--; i >= 0; i--) {
+		uint64_t word = bm->levels[i][index];
+
+		index = (index << BITS_PER_WORD_SHIFT) + __builtin_ctzll(word);
+	}
+	return index;
+}
+
+long hbitmap_find_aligned(struct hbitmap *bm, unsigned int shift)
+{
+	unsigned int size = 1U << shift;
+	unsigned int nr_words = __nr_words(bm->nr_bits);
+	uint64_t *words = bm->levels[0];
+
+	if (size < BITS_PER_WORD) {
+		uint64_t mask = (1ULL << size) - 1;
+
+		for (unsigned int i = 0; i < nr_words; i++) {
+			if (!words[i]) continue;
+
+			for (unsigned int offset = 0; offset < BITS_PER_WORD; offset += size) {
+				if (((words[i] >> offset) & mask) == mask) {
+					return ((long)i << BITS_PER_WORD_SHIFT) + offset;
+				}
+			}
+		}
+		return -1;
+	}
+
+	/* A block spans whole words, which should be all set */
+	for (unsigned int i = 0; i + (size >> BITS_PER_WORD_SHIFT) <= nr_words;
+			i += size >> BITS_PER_WORD_SHIFT) {
+		unsigned int j;
+
+		for (j = 0; j < size >> BITS_PER_WORD_SHIFT; j++) {
+			if (words[i + j] != ~0ULL) break;
+		}
+		if (j == size >> BITS_PER_WORD_SHIFT) return (long)i << BITS_PER_WORD_SHIFT;
+	}
+	return -1;
+}
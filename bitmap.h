@@ -0,0 +1,100 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __BITMAP_H__
+#define __BITMAP_H__
+
+#include <stdint.h>
+
+#include "types.h"
+
+#define BITS_PER_WORD_SHIFT	6
+#define BITS_PER_WORD		(1 << BITS_PER_WORD_SHIFT)
+
+/* 64^6 = 2^36 bits are more than enough for page frames */
+#define HBITMAP_MAX_LEVELS	6
+
+/**
+ * Hierarchical bitmap
+ *
+ * levels[0] holds the bits themselves. Bit i of levels[k] is set when word i
+ * of levels[k - 1] is not zero, so the first set bit can be found by
+ * following count-trailing-zeros from the top-most word down to the bottom,
+ * which takes O(log64 n).
+ */
+struct hbitmap {
+	unsigned int nr_bits;
+	unsigned int nr_levels;
+	uint64_t *levels[HBITMAP_MAX_LEVELS];
+};
+
+/***********************************************************************
+ * hbitmap_init()
+ *
+ * DESCRIPTION
+ *   Initialize @bm to hold @nr_bits bits. All bits are set if @set is @true,
+ *   and cleared otherwise.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 on memory shortage
+ */
+int hbitmap_init(struct hbitmap *bm, unsigned int nr_bits, bool set);
+void hbitmap_fini(struct hbitmap *bm);
+
+void hbitmap_set(struct hbitmap *bm, unsigned int bit);
+void hbitmap_clear(struct hbitmap *bm, unsigned int bit);
+
+static inline bool hbitmap_test(struct hbitmap *bm, unsigned int bit)
+{
+	return !!(bm->levels[0][bit >> BITS_PER_WORD_SHIFT] &
+			(1ULL << (bit & (BITS_PER_WORD - 1))));
+}
+
+/***********************************************************************
+ * hbitmap_find_first()
+ *
+ * RETURN VALUE
+ *   The smallest index of the set bits
+ *   -1 if no bit is set
+ */
+long hbitmap_find_first(struct hbitmap *bm);
+
+/***********************************************************************
+ * hbitmap_find_next()
+ *
+ * DESCRIPTION
+ *   Find the first set bit from @from. The levels are climbed until a word
+ *   has a set bit past @from, and followed down from there.
+ *
+ * RETURN VALUE
+ *   The smallest index of the set bits not smaller than @from
+ *   -1 if no such bit is set
+ */
+long hbitmap_find_next(struct hbitmap *bm, unsigned int from);
+
+/***********************************************************************
+ * hbitmap_find_aligned()
+ *
+ * DESCRIPTION
+ *   Find the first block of 2^@shift bits that are all set. Blocks are
+ *   aligned to their size.
+ *
+ * RETURN VALUE
+ *   The index of the first bit of the block
+ *   -1 if no such block exists
+ */
+long hbitmap_find_aligned(struct hbitmap *bm, unsigned int shift);
+
+#endif
@@ -0,0 +1,172 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "btrace.h"
+
+int btrace_open_writer(struct btrace_writer *w, const char *path)
+{
+	struct btrace_header header = {
+		.magic = BTRACE_MAGIC,
+		.version = BTRACE_VERSION,
+	};
+
+	memset(w, 0x00, sizeof(*w));
+
+	w->fp = fopen(path, "wb");
+	if (!w->fp) return -1;
+
+	if (fwrite(&header, sizeof(header), 1, w->fp) != 1) {
+		fclose(w->fp);
+		return -1;
+	}
+	return 0;
+}
+
+static inline int __put_varint(uint8_t *buf, uint32_t value)
+{
+	int len = 0;
+
+	while (value >= 0x80) {
+		buf[len++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	buf[len++] = value;
+
+	return len;
+}
+
+int btrace_write(struct btrace_writer *w, const struct trace_record *rec)
+{
+	uint8_t buf[1 + 5 + 5 + 5 + 5 + 5];
+	int len = 0;
+	int32_t delta;
+
+	if (rec->op < BTRACE_OP_EXT) {
+		buf[len++] = rec->op | (rec->rw << BTRACE_RW_SHIFT);
+	} else {
+		buf[len++] = BTRACE_OP_EXT | (rec->rw << BTRACE_RW_SHIFT);
+		len += __put_varint(buf + len, rec->op - BTRACE_OP_EXT);
+	}
+
+	if (rec->cpu != w->last_cpu) {
+		buf[0] |= BTRACE_CPU;
+		len += __put_varint(buf + len, rec->cpu);
+	}
+
+	switch (rec->op) {
+	case TRACE_OP_READ:
+	case TRACE_OP_WRITE:
+	case TRACE_OP_ACCESS:
+	case TRACE_OP_ALLOC:
+	case TRACE_OP_FREE:
+		delta = rec->arg - w->last_vpn;
+		len += __put_varint(buf + len, ((uint32_t)delta << 1) ^ (delta >> 31));
+		w->last_vpn = rec->arg;
+
+		if (rec->nr == 1 && rec->stride == 1) break;
+		buf[0] |= BTRACE_RANGE;
+		len += __put_varint(buf + len, rec->nr - 1);
+		len += __put_varint(buf + len, rec->stride - 1);
+		break;
+	case TRACE_OP_SWITCH:
+	case TRACE_OP_WHO:
+	case TRACE_OP_KILL:
+	case TRACE_OP_WAIT:
+	case TRACE_OP_GROUP:
+	case TRACE_OP_LIMIT:
+		len += __put_varint(buf + len, rec->arg);
+		break;
+	case TRACE_OP_HELP:
+		return 0;
+	default:
+		break;
+	}
+
+	if (fwrite(buf, len, 1, w->fp) != 1) return -1;
+	w->last_cpu = rec->cpu;
+	w->nr_records++;
+
+	return 0;
+}
+
+int btrace_close_writer(struct btrace_writer *w)
+{
+	return fclose(w->fp) ? -1 : 0;
+}
+
+int btrace_open(struct btrace_reader *r, const char *path)
+{
+	int fd;
+	struct stat st;
+	const struct btrace_header *header;
+
+	memset(r, 0x00, sizeof(*r));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return -1;
+
+	if (fstat(fd, &st) < 0) goto out_close;
+
+	if (st.st_size < sizeof(*header)) {
+		close(fd);
+		return 1;
+	}
+
+	r->size = st.st_size;
+	r->map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (r->map == MAP_FAILED) {
+		r->map = NULL;
+		goto out_close;
+	}
+	close(fd);
+
+	header = r->map;
+	if (memcmp(header->magic, BTRACE_MAGIC, sizeof(header->magic))) {
+		btrace_close(r);
+		return 1;
+	}
+	if (header->version == 0 || header->version > BTRACE_VERSION) {
+		fprintf(stderr, "Unsupported trace version %u\n", header->version);
+		btrace_close(r);
+		return -1;
+	}
+
+	/* Records are consumed sequentially */
+	madvise(r->map, r->size, MADV_SEQUENTIAL);
+
+	r->pos = (const uint8_t *)r->map + sizeof(*header);
+	r->end = (const uint8_t *)r->map + r->size;
+
+	return 0;
+
+out_close:
+	close(fd);
+	return -1;
+}
+
+void btrace_close(struct btrace_reader *r)
+{
+	if (r->map) munmap(r->map, r->size);
+	r->map = NULL;
+}
@@ -0,0 +1,236 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __BTRACE_H__
+#define __BTRACE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "types.h"
+
+/**
+ * Operations in a workload trace
+ */
+enum trace_op {
+	TRACE_OP_READ = 0,
+	TRACE_OP_WRITE,
+	TRACE_OP_ACCESS,	/* @arg is vpn, @rw is RW_READ | RW_WRITE */
+	TRACE_OP_ALLOC,		/* @arg is vpn, @rw is RW_READ | RW_WRITE */
+	TRACE_OP_FREE,
+	TRACE_OP_SWITCH,	/* @arg is pid */
+	TRACE_OP_SHOW,
+	TRACE_OP_PAGES,
+	TRACE_OP_TLB,
+	TRACE_OP_EXIT,
+	TRACE_OP_HELP,		/* Not recorded in binary traces */
+	TRACE_OP_SWAP,
+	TRACE_OP_SLABS,
+	TRACE_OP_STATS,
+	TRACE_OP_WHO,		/* @arg is pfn */
+	TRACE_OP_KILL,		/* @arg is pid */
+	TRACE_OP_WAIT,		/* @arg is pid */
+	TRACE_OP_MERGE,
+	TRACE_OP_SAVE,
+	TRACE_OP_LOAD,
+	TRACE_OP_GROUP,		/* @arg is group id */
+	TRACE_OP_LIMIT,		/* @arg is pages */
+	NR_TRACE_OPS,
+};
+
+struct trace_record {
+	enum trace_op op;
+	unsigned int rw;
+	unsigned int arg;
+	unsigned int cpu;	/* CPU to run the record on */
+
+	/* Memory operations run on @nr VPNs from @arg every @stride VPNs */
+	unsigned int nr;
+	unsigned int stride;
+};
+
+/**
+ * Binary trace format
+ *
+ * A binary trace starts with struct btrace_header, followed by records.
+ * Each record begins with a byte that encodes the operation in the low 4 bits
+ * and the rw flag of alloc and access in the next 2 bits. Operations taking
+ * a VPN are followed by the difference from the previous VPN in zigzag-encoded
+ * LEB128 varint, and switch and who are followed by the pid and the pfn in
+ * varint, respectively. So, most of accesses with locality take 2 bytes.
+ *
+ * Since version 2, bit 6 of the first byte tells that the record runs on
+ * a CPU other than the previous record's, and the CPU id follows the byte in
+ * varint. Version 1 traces run on CPU 0 only.
+ *
+ * Since version 3, operations from BTRACE_OP_EXT on are encoded as
+ * BTRACE_OP_EXT in the first byte, followed by the rest of the operation
+ * number in varint before anything else.
+ *
+ * Since version 4, bit 7 of the first byte tells that the memory operation
+ * runs on a range of VPNs. The number of VPNs and the stride follow the VPN,
+ * both minus 1 in varint.
+ */
+#define BTRACE_MAGIC	"VMTRACE"
+#define BTRACE_VERSION	4
+
+struct btrace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+};
+
+#define BTRACE_OP_MASK	0x0f
+#define BTRACE_OP_EXT	0x0f
+#define BTRACE_RW_SHIFT	4
+#define BTRACE_RW_MASK	0x30
+#define BTRACE_CPU	0x40
+#define BTRACE_RANGE	0x80
+
+struct btrace_writer {
+	FILE *fp;
+	unsigned int last_vpn;
+	unsigned int last_cpu;
+	unsigned long nr_records;
+};
+
+struct btrace_reader {
+	void *map;
+	size_t size;
+	const uint8_t *pos;
+	const uint8_t *end;
+	unsigned int last_vpn;
+	unsigned int last_cpu;
+};
+
+/***********************************************************************
+ * btrace_open_writer()
+ *
+ * DESCRIPTION
+ *   Create a binary trace at @path and write the header.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 on error
+ */
+int btrace_open_writer(struct btrace_writer *w, const char *path);
+int btrace_write(struct btrace_writer *w, const struct trace_record *rec);
+int btrace_close_writer(struct btrace_writer *w);
+
+/***********************************************************************
+ * btrace_open()
+ *
+ * DESCRIPTION
+ *   mmap() the file at @path for replay.
+ *
+ * RETURN VALUE
+ *   0 on success
+ *   1 if the file is not a binary trace
+ *   -1 on error
+ */
+int btrace_open(struct btrace_reader *r, const char *path);
+void btrace_close(struct btrace_reader *r);
+
+static inline bool __btrace_varint(struct btrace_reader *r, uint32_t *value)
+{
+	uint32_t v = 0;
+
+	for (unsigned int shift = 0; r->pos < r->end && shift < 35; shift += 7) {
+		uint8_t byte = *r->pos++;
+
+		v |= (uint32_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			*value = v;
+			return true;
+		}
+	}
+	return false;
+}
+
+/***********************************************************************
+ * btrace_next()
+ *
+ * DESCRIPTION
+ *   Decode the next record from @r into @rec.
+ *
+ * RETURN VALUE
+ *   @true if a record is decoded
+ *   @false at the end of trace or on a truncated record. @r->pos is left at
+ *   the beginning of the record in the latter case.
+ */
+static inline bool btrace_next(struct btrace_reader *r, struct trace_record *rec)
+{
+	const uint8_t *start = r->pos;
+	uint8_t byte;
+	uint32_t value;
+
+	if (r->pos >= r->end) return false;
+
+	byte = *r->pos++;
+	rec->op = byte & BTRACE_OP_MASK;
+	rec->rw = (byte & BTRACE_RW_MASK) >> BTRACE_RW_SHIFT;
+	rec->nr = 1;
+	rec->stride = 1;
+
+	if (rec->op == BTRACE_OP_EXT) {
+		if (!__btrace_varint(r, &value)) goto out_truncated;
+		rec->op += value;
+	}
+
+	if (byte & BTRACE_CPU) {
+		if (!__btrace_varint(r, &value)) goto out_truncated;
+		r->last_cpu = value;
+	}
+	rec->cpu = r->last_cpu;
+
+	switch (rec->op) {
+	case TRACE_OP_READ:
+	case TRACE_OP_WRITE:
+	case TRACE_OP_ACCESS:
+	case TRACE_OP_ALLOC:
+	case TRACE_OP_FREE:
+		if (!__btrace_varint(r, &value)) goto out_truncated;
+		/* Undo zigzag */
+		r->last_vpn += (value >> 1) ^ -(value & 1);
+		rec->arg = r->last_vpn;
+
+		if (!(byte & BTRACE_RANGE)) break;
+		if (!__btrace_varint(r, &value)) goto out_truncated;
+		rec->nr = value + 1;
+		if (!__btrace_varint(r, &value)) goto out_truncated;
+		rec->stride = value + 1;
+		break;
+	case TRACE_OP_SWITCH:
+	case TRACE_OP_WHO:
+	case TRACE_OP_KILL:
+	case TRACE_OP_WAIT:
+	case TRACE_OP_GROUP:
+	case TRACE_OP_LIMIT:
+		if (!__btrace_varint(r, &value)) goto out_truncated;
+		rec->arg = value;
+		break;
+	default:
+		if (rec->op >= NR_TRACE_OPS) goto out_truncated;
+		rec->arg = 0;
+		break;
+	}
+	return true;
+
+out_truncated:
+	r->pos = start;
+	return false;
+}
+
+#endif
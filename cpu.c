@@ -0,0 +1,226 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "types.h"
+#include "cpu.h"
+
+__thread struct cpu *this_cpu = NULL;
+
+int cpus_init(struct vm_sim *sim, unsigned int nr, unsigned int tlb_entries,
+		unsigned int tlb_ways, enum tlb_policy tlb_policy)
+{
+	struct cpu *cpus;
+
+	if (nr == 0 || nr > MAX_NR_CPUS) return -1;
+
+	if (posix_memalign((void **)&cpus, CACHE_LINE_SIZE, sizeof(*cpus) * nr)) {
+		return -1;
+	}
+	memset(cpus, 0x00, sizeof(*cpus) * nr);
+	sim->cpus = cpus;
+	sim->nr_cpus = nr;
+	pthread_mutex_init(&sim->mm_lock, NULL);
+
+	for (unsigned int i = 0; i < nr; i++) {
+		struct cpu *cpu = cpus + i;
+
+		cpu->id = i;
+		cpu->sim = sim;
+		if (tlb_init(&cpu->tlb, tlb_entries, tlb_ways, tlb_policy,
+				sim->thp ? PTES_PER_PAGE_SHIFT : 0)) {
+			goto out_fini;
+		}
+		if (nr > 1) tlb_enable_locking(&cpu->tlb);
+	}
+	this_cpu = cpus;
+
+	return 0;
+
+out_fini:
+	cpus_fini(sim);
+	return -1;
+}
+
+void cpus_fini(struct vm_sim *sim)
+{
+	struct cpu *cpu;
+
+	if (!sim->cpus) return;
+
+	for_each_cpu(sim, cpu) {
+		tlb_fini(&cpu->tlb);
+		free(cpu->queue);
+	}
+	free(sim->cpus);
+	pthread_mutex_destroy(&sim->mm_lock);
+
+	sim->cpus = NULL;
+	sim->nr_cpus = 0;
+	this_cpu = NULL;
+}
+
+void mm_lock(struct vm_sim *sim)
+{
+	if (sim->nr_cpus > 1) pthread_mutex_lock(&sim->mm_lock);
+}
+
+void mm_unlock(struct vm_sim *sim)
+{
+	tlb_shootdown_flush(sim);
+	if (sim->nr_cpus > 1) pthread_mutex_unlock(&sim->mm_lock);
+}
+
+void tlb_shootdown_flush(struct vm_sim *sim)
+{
+	struct cpu *cpu;
+
+	if (!this_cpu->nr_shootdowns) return;
+
+	for_each_cpu(sim, cpu) {
+		tlb_flush_batch(&cpu->tlb, this_cpu->shootdowns,
+				this_cpu->nr_shootdowns);
+	}
+	this_cpu->nr_shootdowns = 0;
+}
+
+void tlb_shootdown(struct vm_sim *sim, unsigned int asid, unsigned int vpn)
+{
+	/* Nobody else to tell on a uniprocessor */
+	if (sim->nr_cpus == 1) {
+		if (vpn == TLB_FLUSH_ALL) tlb_flush_asid(&this_cpu->tlb, asid);
+		else tlb_invalidate(&this_cpu->tlb, asid, vpn);
+		return;
+	}
+
+	if (this_cpu->nr_shootdowns == CPU_SHOOTDOWN_BATCH) {
+		tlb_shootdown_flush(sim);
+	}
+	this_cpu->shootdowns[this_cpu->nr_shootdowns++] = (struct tlb_flush) {
+		.asid = asid,
+		.vpn = vpn,
+	};
+}
+
+
+/**
+ * SMP mode
+ *
+ * The dispatcher (the thread running the simulation) distributes the records
+ * to the queues of the CPUs, and each CPU thread runs the records in its queue
+ * in order. The records for different CPUs run in parallel, and commands that
+ * look at the whole system are run by the dispatcher after cpus_sync().
+ */
+static void *__cpu_thread(void *arg)
+{
+	struct cpu *cpu = arg;
+	struct vm_sim *sim = cpu->sim;
+
+	this_cpu = cpu;
+
+	while (true) {
+		unsigned long head = __atomic_load_n(&cpu->head, __ATOMIC_ACQUIRE);
+
+		if (cpu->tail == head) {
+			/* Recheck the queue since records may come before stopping */
+			if (__atomic_load_n(&sim->stopping, __ATOMIC_ACQUIRE) &&
+					cpu->tail == __atomic_load_n(&cpu->head, __ATOMIC_ACQUIRE)) {
+				break;
+			}
+			sched_yield();
+			continue;
+		}
+
+		while (cpu->tail != head) {
+			const struct trace_record *rec = cpu->queue + cpu->tail % CPU_QUEUE_SIZE;
+
+			if (!__atomic_load_n(&sim->stopped, __ATOMIC_RELAXED) &&
+					!sim->run_record(sim, rec)) {
+				__atomic_store_n(&sim->stopped, true, __ATOMIC_RELAXED);
+			}
+			__atomic_store_n(&cpu->tail, cpu->tail + 1, __ATOMIC_RELEASE);
+		}
+	}
+	return NULL;
+}
+
+int cpus_start(struct vm_sim *sim,
+		bool (*run)(struct vm_sim *sim, const struct trace_record *rec))
+{
+	struct cpu *cpu;
+
+	sim->run_record = run;
+	sim->stopped = sim->stopping = false;
+
+	for_each_cpu(sim, cpu) {
+		cpu->queue = malloc(sizeof(*cpu->queue) * CPU_QUEUE_SIZE);
+		if (!cpu->queue) goto out_stop;
+
+		cpu->head = cpu->tail = 0;
+		if (pthread_create(&cpu->thread, NULL, __cpu_thread, cpu)) goto out_stop;
+	}
+	return 0;
+
+out_stop:
+	/* Nothing is queued yet, so the CPUs started so far exit right away */
+	__atomic_store_n(&sim->stopping, true, __ATOMIC_RELEASE);
+	while (cpu-- > sim->cpus) {
+		pthread_join(cpu->thread, NULL);
+	}
+	return -1;
+}
+
+bool cpu_queue(struct vm_sim *sim, const struct trace_record *rec)
+{
+	struct cpu *cpu = sim->cpus + rec->cpu;
+
+	/* Wait for a room in the queue */
+	while (cpu->head - __atomic_load_n(&cpu->tail, __ATOMIC_ACQUIRE)
+			== CPU_QUEUE_SIZE) {
+		if (__atomic_load_n(&sim->stopped, __ATOMIC_RELAXED)) return false;
+		sched_yield();
+	}
+
+	cpu->queue[cpu->head % CPU_QUEUE_SIZE] = *rec;
+	__atomic_store_n(&cpu->head, cpu->head + 1, __ATOMIC_RELEASE);
+
+	return !__atomic_load_n(&sim->stopped, __ATOMIC_RELAXED);
+}
+
+bool cpus_sync(struct vm_sim *sim)
+{
+	struct cpu *cpu;
+
+	for_each_cpu(sim, cpu) {
+		while (__atomic_load_n(&cpu->tail, __ATOMIC_ACQUIRE) != cpu->head) {
+			sched_yield();
+		}
+	}
+	return !__atomic_load_n(&sim->stopped, __ATOMIC_RELAXED);
+}
+
+void cpus_stop(struct vm_sim *sim)
+{
+	struct cpu *cpu;
+
+	__atomic_store_n(&sim->stopping, true, __ATOMIC_RELEASE);
+	for_each_cpu(sim, cpu) {
+		pthread_join(cpu->thread, NULL);
+	}
+}
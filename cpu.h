@@ -0,0 +1,128 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __CPU_H__
+#define __CPU_H__
+
+#include <pthread.h>
+
+#include "types.h"
+#include "vm.h"
+
+#define MAX_NR_CPUS		64
+
+/* Invalidations gathered before they are shot down to all CPUs */
+#define CPU_SHOOTDOWN_BATCH	32
+
+/* Records queued to each CPU in the SMP mode */
+#define CPU_QUEUE_SIZE		1024
+
+/**
+ * Simulated CPU
+ *
+ * Each CPU runs its own process (@curr) with its own MMU, i.e., the page
+ * table base register (@pt_base) and @tlb. They are accessed through @current
+ * and @ptbr on the thread simulating the CPU. The rest of the simulation @sim
+ * (page frames, page tables, the ready queue, and the swap) is shared by all
+ * CPUs and protected by mm_lock().
+ *
+ * When the OS changes a PTE, the stale translations may be cached in the
+ * TLBs of any CPU since TLB entries are tagged with the pid. So the OS calls
+ * tlb_shootdown() instead of invalidating its own TLB. The requests are
+ * gathered in @shootdowns, and flushed to the TLBs of all CPUs at once when
+ * the OS operation completes, or when the batch is full.
+ */
+struct cpu {
+	unsigned int id;
+	struct vm_sim *sim;
+
+	struct process *curr;		/* NULL if the CPU is idle */
+	struct pagetable *pt_base;	/* Page table base register */
+	struct tlb tlb;
+
+	struct tlb_flush shootdowns[CPU_SHOOTDOWN_BATCH];
+	unsigned int nr_shootdowns;
+
+	/* Per-CPU counters to avoid bouncing cache lines between CPUs */
+	struct output_summary summary;
+	struct histogram hists[NR_HISTS];
+
+	/* Records to run in the SMP mode. Single producer, single consumer */
+	pthread_t thread;
+	struct trace_record *queue;
+	unsigned long head;		/* Written by the dispatcher */
+	unsigned long tail;		/* Written by the CPU */
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* CPU the calling thread is simulating */
+extern __thread struct cpu *this_cpu;
+
+#define current	(this_cpu->curr)
+#define ptbr	(this_cpu->pt_base)
+
+#define for_each_cpu(sim, cpu)	\
+	for ((cpu) = (sim)->cpus; (cpu) < (sim)->cpus + (sim)->nr_cpus; (cpu)++)
+
+/***********************************************************************
+ * cpus_init()
+ *
+ * DESCRIPTION
+ *   Bring up @nr CPUs of @sim with TLBs of the given geometry. The calling
+ *   thread runs CPU 0 afterward.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 on invalid TLB configuration or memory shortage
+ */
+int cpus_init(struct vm_sim *sim, unsigned int nr, unsigned int tlb_entries,
+		unsigned int tlb_ways, enum tlb_policy tlb_policy);
+void cpus_fini(struct vm_sim *sim);
+
+/**
+ * Serialize the OS operations and page table walks among CPUs.
+ * mm_unlock() flushes the pending shootdowns of this CPU before releasing.
+ */
+void mm_lock(struct vm_sim *sim);
+void mm_unlock(struct vm_sim *sim);
+
+/**
+ * Invalidate the translation for @vpn (or all translations if @vpn is
+ * TLB_FLUSH_ALL) of @asid in the TLBs of all CPUs.
+ */
+void tlb_shootdown(struct vm_sim *sim, unsigned int asid, unsigned int vpn);
+void tlb_shootdown_flush(struct vm_sim *sim);
+
+/***********************************************************************
+ * cpus_start()
+ *
+ * DESCRIPTION
+ *   Start a host thread for each CPU of @sim. The threads run the records
+ *   queued with cpu_queue() using @run until @run returns @false.
+ */
+int cpus_start(struct vm_sim *sim,
+		bool (*run)(struct vm_sim *sim, const struct trace_record *rec));
+
+/* Queue @rec to the CPU @rec->cpu. Return @false if the simulation stopped */
+bool cpu_queue(struct vm_sim *sim, const struct trace_record *rec);
+
+/**
+ * Wait until all CPUs run out of the queued records. Return @false if one of
+ * them stopped the simulation, so that nothing runs after it.
+ */
+bool cpus_sync(struct vm_sim *sim);
+
+/* Stop the threads after they run all queued records */
+void cpus_stop(struct vm_sim *sim);
+
+#endif
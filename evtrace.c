@@ -0,0 +1,388 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "vm.h"
+#include "evtrace.h"
+
+/* How long the writer sleeps when no CPU has recorded anything */
+#define EVTRACE_IDLE_NS		1000000
+
+/* Write the events recorded in @ring since the last drain */
+static unsigned long __drain_ring(struct evtrace *ev, struct evtrace_ring *ring)
+{
+	unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	unsigned long nr = head - ring->tail;
+	unsigned long tail = ring->tail;
+
+	while (tail != head) {
+		unsigned long index = tail % EVTRACE_RING_SIZE;
+		unsigned long len = head - tail;
+
+		/* Up to the end of the ring at a time */
+		if (len > EVTRACE_RING_SIZE - index) len = EVTRACE_RING_SIZE - index;
+
+		if (!ev->failed &&
+				fwrite(ring->events + index, sizeof(*ring->events), len, ev->fp) != len) {
+			ev->failed = true;
+		}
+		tail += len;
+	}
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+	return nr;
+}
+
+static void *__evtrace_writer(void *arg)
+{
+	struct evtrace *ev = arg;
+	const struct timespec idle = { .tv_nsec = EVTRACE_IDLE_NS };
+
+	while (true) {
+		bool stopping = __atomic_load_n(&ev->stopping, __ATOMIC_ACQUIRE);
+		unsigned long nr = 0;
+
+		for (unsigned int i = 0; i < ev->nr_cpus; i++) {
+			nr += __drain_ring(ev, ev->rings + i);
+		}
+
+		/* Nothing is recorded after stopping, so all are drained now */
+		if (stopping) break;
+
+		if (!nr) nanosleep(&idle, NULL);
+	}
+	return NULL;
+}
+
+int evtrace_init(struct evtrace *ev, unsigned int nr_cpus, const char *path)
+{
+	struct evtrace_header header = {
+		.magic = EVTRACE_MAGIC,
+		.version = EVTRACE_VERSION,
+		.nr_cpus = nr_cpus,
+	};
+	struct evtrace_ring *rings = NULL;
+
+	memset(ev, 0x00, sizeof(*ev));
+
+	if (!path) return 0;
+
+	ev->fp = fopen(path, "wb");
+	if (!ev->fp) return -1;
+
+	if (fwrite(&header, sizeof(header), 1, ev->fp) != 1) goto out_close;
+
+	if (posix_memalign((void **)&rings, CACHE_LINE_SIZE, sizeof(*rings) * nr_cpus)) {
+		goto out_close;
+	}
+	memset(rings, 0x00, sizeof(*rings) * nr_cpus);
+
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		rings[i].events = malloc(sizeof(*rings[i].events) * EVTRACE_RING_SIZE);
+		if (!rings[i].events) goto out_free;
+	}
+
+	/* Enable the recording. The CPUs start after the writer */
+	ev->rings = rings;
+	ev->nr_cpus = nr_cpus;
+	clock_gettime(CLOCK_MONOTONIC, &ev->start);
+	if (pthread_create(&ev->writer, NULL, __evtrace_writer, ev)) {
+		ev->rings = NULL;
+		goto out_free;
+	}
+	return 0;
+
+out_free:
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		free(rings[i].events);
+	}
+	free(rings);
+out_close:
+	fclose(ev->fp);
+	ev->fp = NULL;
+	return -1;
+}
+
+void evtrace_fini(struct evtrace *ev)
+{
+	struct evtrace_ring *rings = ev->rings;
+
+	if (!rings) return;
+
+	__atomic_store_n(&ev->stopping, true, __ATOMIC_RELEASE);
+	pthread_join(ev->writer, NULL);
+
+	if (ev->failed || fclose(ev->fp)) {
+		fprintf(stderr, "Unable to write the events\n");
+	}
+	ev->fp = NULL;
+
+	ev->rings = NULL;
+	for (unsigned int i = 0; i < ev->nr_cpus; i++) {
+		free(rings[i].events);
+	}
+	free(rings);
+}
+
+void evtrace_show(struct evtrace *ev, FILE *fp)
+{
+	unsigned long nr_recorded = 0, nr_dropped = 0;
+
+	for (unsigned int i = 0; i < ev->nr_cpus; i++) {
+		nr_recorded += ev->rings[i].head;
+		nr_dropped += ev->rings[i].nr_dropped;
+	}
+
+	fprintf(fp, "Event trace\n");
+	fprintf(fp, "  recorded : %lu\n", nr_recorded);
+	fprintf(fp, "  dropped  : %lu\n", nr_dropped);
+	fprintf(fp, "\n");
+}
+
+/**
+ * JSON trace
+ */
+static const char *event_names[] = {
+	[EVTRACE_HIT] = "hit",
+	[EVTRACE_MISS] = "miss",
+	[EVTRACE_FAULT] = "fault",
+	[EVTRACE_COW] = "copy",
+	[EVTRACE_ALLOC] = "alloc",
+	[EVTRACE_FREE] = "free",
+	[EVTRACE_FORK] = "fork",
+	[EVTRACE_SWITCH] = "switch",
+	[EVTRACE_EXIT] = "exit",
+};
+
+static const char *event_categories[] = {
+	[EVTRACE_HIT] = "access",
+	[EVTRACE_MISS] = "access",
+	[EVTRACE_FAULT] = "fault",
+	[EVTRACE_COW] = "fault",
+	[EVTRACE_ALLOC] = "memory",
+	[EVTRACE_FREE] = "memory",
+	[EVTRACE_FORK] = "process",
+	[EVTRACE_SWITCH] = "process",
+	[EVTRACE_EXIT] = "process",
+};
+
+/* Process running on a CPU from @since, in the timeline */
+struct json_slice {
+	bool running;
+	unsigned int pid;
+	uint64_t since;
+};
+
+struct json_writer {
+	FILE *fp;
+	bool first;
+};
+
+static void __json_begin(struct json_writer *w)
+{
+	fprintf(w->fp, w->first ? "\n" : ",\n");
+	w->first = false;
+}
+
+static void __json_end_slice(struct json_writer *w, struct json_slice *s,
+		unsigned int cpu, uint64_t ts)
+{
+	if (!s->running) return;
+
+	__json_begin(w);
+	fprintf(w->fp, "{\"name\":\"pid %u\",\"cat\":\"process\",\"ph\":\"X\","
+			"\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%u,"
+			"\"args\":{\"pid\":%u}}",
+			s->pid, s->since / 1000.0, (ts - s->since) / 1000.0, cpu, s->pid);
+	s->running = false;
+}
+
+static void __json_event(struct json_writer *w, const struct evtrace_event *e)
+{
+	const char *name = event_names[e->type];
+
+	if (e->type == EVTRACE_FAULT) name = stats_fault_name(e->arg);
+
+	__json_begin(w);
+	fprintf(w->fp, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\","
+			"\"ts\":%.3f,\"pid\":0,\"tid\":%u,\"args\":{\"pid\":%u",
+			name, event_categories[e->type], e->ts / 1000.0, e->cpu, e->pid);
+
+	switch (e->type) {
+	case EVTRACE_HIT:
+	case EVTRACE_MISS:
+	case EVTRACE_ALLOC:
+		fprintf(w->fp, ",\"vpn\":%u", e->vpn);
+		if (e->pfn != EVTRACE_NO_PFN) fprintf(w->fp, ",\"pfn\":%u", e->pfn);
+		fprintf(w->fp, ",\"rw\":\"%s%s\"",
+				e->arg & RW_READ ? "r" : "", e->arg & RW_WRITE ? "w" : "");
+		break;
+	case EVTRACE_FAULT:
+		fprintf(w->fp, ",\"vpn\":%u", e->vpn);
+		break;
+	case EVTRACE_COW:
+	case EVTRACE_FREE:
+		fprintf(w->fp, ",\"vpn\":%u,\"pfn\":%u", e->vpn, e->pfn);
+		break;
+	case EVTRACE_FORK:
+		fprintf(w->fp, ",\"child\":%u", e->pfn);
+		break;
+	default:
+		break;
+	}
+	fprintf(w->fp, "}}");
+}
+
+static int __compare_events(const void *a, const void *b)
+{
+	const struct evtrace_event *x = a, *y = b;
+
+	if (x->ts != y->ts) return x->ts < y->ts ? -1 : 1;
+	return (int)x->cpu - (int)y->cpu;
+}
+
+/* Read all events in @fp, which is at the end of the header */
+static struct evtrace_event *__read_events(FILE *fp, unsigned long *nr)
+{
+	struct evtrace_event *events = NULL;
+	unsigned long size = 0;
+
+	*nr = 0;
+	while (true) {
+		if (*nr == size) {
+			struct evtrace_event *e;
+
+			size = size ? size * 2 : EVTRACE_RING_SIZE;
+			e = realloc(events, sizeof(*events) * size);
+			if (!e) {
+				free(events);
+				return NULL;
+			}
+			events = e;
+		}
+		size_t read = fread(events + *nr, sizeof(*events), size - *nr, fp);
+
+		*nr += read;
+		if (*nr < size) break;
+	}
+	return events;
+}
+
+long evtrace_export_json(const char *path, const char *json_path)
+{
+	struct evtrace_header header;
+	struct evtrace_event *events;
+	struct json_slice *slices;
+	struct json_writer w = { .first = true };
+	unsigned long nr = 0;
+	uint64_t last = 0;
+	FILE *fp;
+	long ret = -1;
+
+	fp = fopen(path, "rb");
+	if (!fp) {
+		fprintf(stderr, "No event file %s\n", path);
+		return -1;
+	}
+
+	if (fread(&header, sizeof(header), 1, fp) != 1 ||
+			memcmp(header.magic, EVTRACE_MAGIC, sizeof(header.magic)) ||
+			header.version == 0 || header.version > EVTRACE_VERSION) {
+		fprintf(stderr, "%s is not an event file\n", path);
+		fclose(fp);
+		return -1;
+	}
+
+	events = __read_events(fp, &nr);
+	fclose(fp);
+	if (!events) {
+		fprintf(stderr, "Unable to read the events\n");
+		return -1;
+	}
+
+	slices = calloc(header.nr_cpus, sizeof(*slices));
+	if (!slices) goto out_free;
+
+	w.fp = fopen(json_path, "w");
+	if (!w.fp) {
+		fprintf(stderr, "Unable to create %s\n", json_path);
+		goto out_free;
+	}
+
+	/* The CPUs write their events in batches, so put them back in time */
+	qsort(events, nr, sizeof(*events), __compare_events);
+
+	fprintf(w.fp, "{\"traceEvents\":[");
+
+	__json_begin(&w);
+	fprintf(w.fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+			"\"args\":{\"name\":\"vm\"}}");
+	for (unsigned int cpu = 0; cpu < header.nr_cpus; cpu++) {
+		__json_begin(&w);
+		fprintf(w.fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+				"\"tid\":%u,\"args\":{\"name\":\"cpu %u\"}}", cpu, cpu);
+	}
+
+	for (unsigned long i = 0; i < nr; i++) {
+		const struct evtrace_event *e = events + i;
+
+		if (e->cpu >= header.nr_cpus || e->type >= NR_EVTRACE_TYPES) continue;
+
+		switch (e->type) {
+		case EVTRACE_SWITCH:
+			__json_end_slice(&w, slices + e->cpu, e->cpu, e->ts);
+			slices[e->cpu] = (struct json_slice) {
+				.running = true,
+				.pid = e->pid,
+				.since = e->ts,
+			};
+			break;
+		case EVTRACE_EXIT:
+			/* Killed processes leave the CPUs they are running on */
+			for (unsigned int cpu = 0; cpu < header.nr_cpus; cpu++) {
+				if (slices[cpu].pid != e->pid) continue;
+				__json_end_slice(&w, slices + cpu, cpu, e->ts);
+			}
+			break;
+		default:
+			break;
+		}
+		__json_event(&w, e);
+		last = e->ts;
+	}
+
+	for (unsigned int cpu = 0; cpu < header.nr_cpus; cpu++) {
+		__json_end_slice(&w, slices + cpu, cpu, last);
+	}
+	fprintf(w.fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+	if (fclose(w.fp)) {
+		fprintf(stderr, "Unable to write %s\n", json_path);
+	} else {
+		ret = nr;
+	}
+
+out_free:
+	free(slices);
+	free(events);
+	return ret;
+}
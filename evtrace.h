@@ -0,0 +1,177 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#ifndef __EVTRACE_H__
+#define __EVTRACE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "slab.h"
+
+/**
+ * Event tracing
+ *
+ * The simulation records what happens on each CPU over time as fixed-size
+ * events. Each CPU writes its events to its own ring without any lock, and
+ * a writer thread drains the rings to the event file in the background. So
+ * the rings are single producer, single consumer like the record queues of
+ * the CPUs. Records that the dispatcher runs after cpus_sync() write to the
+ * ring of their CPU while the CPU thread waits, so a ring still has a single
+ * producer at a time. Events are dropped and counted in @nr_dropped if the
+ * writer cannot keep up with a CPU.
+ *
+ * The event file starts with struct evtrace_header, followed by the events
+ * in the order they are drained. The events of a CPU are in order, but those
+ * of different CPUs are interleaved by the batch. evtrace_export_json()
+ * converts the file into the JSON trace of Chrome, which Perfetto opens too.
+ */
+enum evtrace_type {
+	EVTRACE_HIT = 0,	/* Translated by the TLB, @arg is rw */
+	EVTRACE_MISS,		/* Walked the page table, @arg is rw */
+	EVTRACE_FAULT,		/* @arg is enum fault_class */
+	EVTRACE_COW,		/* @pfn is the page copied from */
+	EVTRACE_ALLOC,		/* @arg is rw */
+	EVTRACE_FREE,
+	EVTRACE_FORK,		/* @pid forks @pfn */
+	EVTRACE_SWITCH,		/* @pid starts running */
+	EVTRACE_EXIT,
+	NR_EVTRACE_TYPES,
+};
+
+/* @pfn of the accesses that fail */
+#define EVTRACE_NO_PFN	(~0U)
+
+struct evtrace_event {
+	uint64_t ts;		/* ns since the tracing started */
+	uint32_t pid;
+	uint32_t vpn;
+	uint32_t pfn;
+	uint8_t type;
+	uint8_t cpu;
+	uint16_t arg;
+};
+
+#define EVTRACE_MAGIC	"VMEVENT"
+#define EVTRACE_VERSION	1
+
+struct evtrace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t nr_cpus;
+};
+
+/* Events buffered for each CPU, power of 2 */
+#define EVTRACE_RING_SIZE	(1 << 16)
+
+struct evtrace_ring {
+	struct evtrace_event *events;
+	unsigned long head;		/* Written by the CPU */
+	unsigned long tail;		/* Written by the writer */
+	unsigned long nr_dropped;	/* Written by the CPU */
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct evtrace {
+	struct evtrace_ring *rings;	/* One for each CPU, NULL if disabled */
+	unsigned int nr_cpus;
+	struct timespec start;
+
+	FILE *fp;
+	pthread_t writer;
+	bool stopping;
+	bool failed;			/* Unable to write the file */
+};
+
+/***********************************************************************
+ * evtrace_init()
+ *
+ * DESCRIPTION
+ *   Record the events of @nr_cpus CPUs to the event file at @path, and start
+ *   the writer thread. Nothing is recorded if @path is NULL.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 if @path cannot be written or on memory shortage
+ */
+int evtrace_init(struct evtrace *ev, unsigned int nr_cpus, const char *path);
+
+/* Stop the writer after it drains all the events recorded so far */
+void evtrace_fini(struct evtrace *ev);
+
+static inline bool evtrace_enabled(struct evtrace *ev)
+{
+	return ev->rings != NULL;
+}
+
+static inline void __evtrace_emit(struct evtrace *ev, unsigned int cpu,
+		enum evtrace_type type, unsigned int pid, unsigned int vpn,
+		unsigned int pfn, unsigned int arg)
+{
+	struct evtrace_ring *ring = ev->rings + cpu;
+	struct evtrace_event *e;
+	struct timespec ts;
+
+	if (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)
+			== EVTRACE_RING_SIZE) {
+		ring->nr_dropped++;
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	e = ring->events + ring->head % EVTRACE_RING_SIZE;
+	e->ts = (uint64_t)(ts.tv_sec - ev->start.tv_sec) * 1000000000 +
+			ts.tv_nsec - ev->start.tv_nsec;
+	e->pid = pid;
+	e->vpn = vpn;
+	e->pfn = pfn;
+	e->type = type;
+	e->cpu = cpu;
+	e->arg = arg;
+
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Record an event on @cpu. This is a macro so that nothing but the test of
+ * @ev is evaluated while the tracing is disabled.
+ */
+#define evtrace_emit(ev, cpu, type, pid, vpn, pfn, arg)			\
+	do {								\
+		if (__builtin_expect(evtrace_enabled(ev), 0)) {		\
+			__evtrace_emit(ev, cpu, type, pid, vpn, pfn, arg);	\
+		}							\
+	} while (0)
+
+/* Print the number of the events recorded and dropped. Call with the CPUs synced */
+void evtrace_show(struct evtrace *ev, FILE *fp);
+
+/***********************************************************************
+ * evtrace_export_json()
+ *
+ * DESCRIPTION
+ *   Convert the event file at @path into the JSON trace at @json_path.
+ *   Each CPU is a thread in the trace, with a slice for each process it
+ *   runs and an instant event for everything else.
+ *
+ * RETURN VALUE
+ *   The number of the events converted, or -1 on error
+ */
+long evtrace_export_json(const char *path, const char *json_path);
+
+#endif
@@ -0,0 +1,98 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "ksm.h"
+
+int ksm_init(struct ksm *ksm, unsigned int interval, unsigned int nr_frames)
+{
+	memset(ksm, 0x00, sizeof(*ksm));
+
+	if (!interval) return 0;
+
+	ksm->interval = interval;
+	ksm->nr_frames = nr_frames;
+
+	/* Keep the table at most half full */
+	ksm->table_bits = 1;
+	while ((1U << ksm->table_bits) < nr_frames * 2) ksm->table_bits++;
+
+	ksm->contents = calloc(nr_frames, sizeof(*ksm->contents));
+	ksm->stable = calloc(nr_frames, sizeof(*ksm->stable));
+	ksm->table = calloc(1U << ksm->table_bits, sizeof(*ksm->table));
+
+	if (!ksm->contents || !ksm->stable || !ksm->table) {
+		ksm_fini(ksm);
+		return -1;
+	}
+	return 0;
+}
+
+void ksm_fini(struct ksm *ksm)
+{
+	free(ksm->contents);
+	free(ksm->stable);
+	free(ksm->table);
+
+	ksm->contents = NULL;
+	ksm->stable = NULL;
+	ksm->table = NULL;
+}
+
+void ksm_scan_begin(struct ksm *ksm)
+{
+	memset(ksm->table, 0x00, sizeof(*ksm->table) << ksm->table_bits);
+	ksm->nr_scans++;
+}
+
+long ksm_find_identical(struct ksm *ksm, unsigned int pfn)
+{
+	unsigned int content = ksm->contents[pfn];
+	unsigned int mask = (1U << ksm->table_bits) - 1;
+	unsigned int i = (content * 0x61C88647U) >> (32 - ksm->table_bits);
+
+	for (; ksm->table[i]; i = (i + 1) & mask) {
+		unsigned int other = ksm->table[i] - 1;
+
+		if (ksm->contents[other] == content) return other;
+	}
+	ksm->table[i] = pfn + 1;
+
+	return -1;
+}
+
+void ksm_show(struct ksm *ksm, const unsigned int *mapcounts, FILE *fp)
+{
+	unsigned long nr_shared = 0;
+	unsigned long nr_sharing = 0;
+
+	for (unsigned int i = 0; i < ksm->nr_frames; i++) {
+		if (!ksm->stable[i] || !mapcounts[i]) continue;
+
+		nr_shared++;
+		nr_sharing += mapcounts[i] - 1;
+	}
+
+	fprintf(fp, "Same-page merging\n");
+	fprintf(fp, "  scans     : %lu\n", ksm->nr_scans);
+	fprintf(fp, "  merged    : %lu frames\n", ksm->nr_merged);
+	fprintf(fp, "  saved     : %lu frames now, by %lu stable frames\n",
+			nr_sharing, nr_shared);
+	fprintf(fp, "  cow faults: %lu\n\n", ksm->nr_cow_faults);
+}
@@ -0,0 +1,138 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __KSM_H__
+#define __KSM_H__
+
+#include <stdio.h>
+
+#include "types.h"
+
+/**
+ * Same-page merging
+ *
+ * To evaluate deduplication, each page frame is given a content value. New
+ * pages are zero-filled (content 0), and a write to a VPN stores the value
+ * derived from the VPN. So the pages that processes write at the same VPN,
+ * and the pages not written yet, are identical. Contents go along with the
+ * pages on copy-on-write, migration, and swap.
+ *
+ * The scanner runs every @interval records as if it were a background thread.
+ * It folds the page frames with the same content into a single stable frame
+ * mapped copy-on-write. A write to a merged page breaks it through the usual
+ * copy-on-write fault.
+ */
+struct ksm {
+	unsigned int interval;		/* Records between scans, 0 if disabled */
+	unsigned long nr_records;
+
+	unsigned int nr_frames;
+	unsigned int *contents;		/* Content of each page frame */
+	bool *stable;			/* Frames that pages are merged into */
+
+	/* Content -> pfn + 1 of the frames scanned so far in a scan */
+	unsigned int *table;
+	unsigned int table_bits;
+
+	unsigned long nr_scans;
+	unsigned long nr_merged;	/* Page frames freed by merging */
+	unsigned long nr_cow_faults;	/* Faults on merged pages */
+};
+
+/***********************************************************************
+ * ksm_init()
+ *
+ * DESCRIPTION
+ *   Track the contents of @nr_frames page frames and merge them every
+ *   @interval records. Nothing is tracked if @interval is 0.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 on memory shortage
+ */
+int ksm_init(struct ksm *ksm, unsigned int interval, unsigned int nr_frames);
+void ksm_fini(struct ksm *ksm);
+
+static inline bool ksm_enabled(struct ksm *ksm)
+{
+	return ksm->interval > 0;
+}
+
+/* Content of a page after writing @vpn */
+static inline unsigned int ksm_write_content(unsigned int vpn)
+{
+	/* Never 0, which is the zero-filled page */
+	return vpn * 0x9E3779B1U | 1;
+}
+
+/**
+ * The contents are changed with mm_lock() held, and read also by the writes
+ * hitting the TLB without the lock to see if they change the content.
+ */
+static inline void ksm_set_content(struct ksm *ksm, unsigned int pfn,
+		unsigned int content)
+{
+	if (ksm->contents) __atomic_store_n(ksm->contents + pfn, content, __ATOMIC_RELAXED);
+}
+
+static inline unsigned int ksm_content(struct ksm *ksm, unsigned int pfn)
+{
+	return ksm->contents ? __atomic_load_n(ksm->contents + pfn, __ATOMIC_RELAXED) : 0;
+}
+
+/* Whether @pfn is a stable frame that pages are merged into */
+static inline bool ksm_stable(struct ksm *ksm, unsigned int pfn)
+{
+	return ksm->stable && ksm->stable[pfn];
+}
+
+/* Forget that @pfn is stable. Should be called when @pfn is freed */
+static inline void ksm_drop_frame(struct ksm *ksm, unsigned int pfn)
+{
+	if (ksm->stable) ksm->stable[pfn] = false;
+}
+
+/* Let @to keep the stable status of @from when the page moves to @to */
+static inline void ksm_move_frame(struct ksm *ksm, unsigned int from,
+		unsigned int to)
+{
+	if (ksm->stable) ksm->stable[to] = ksm->stable[from];
+}
+
+/* Count a record, and tell whether the scanner should run now */
+static inline bool ksm_tick(struct ksm *ksm)
+{
+	return ksm_enabled(ksm) && ++ksm->nr_records % ksm->interval == 0;
+}
+
+/***********************************************************************
+ * ksm_find_identical()
+ *
+ * DESCRIPTION
+ *   Look for the frame scanned before @pfn in this scan with the same
+ *   content as @pfn. If there is none, @pfn is remembered for the frames
+ *   scanned later. ksm_scan_begin() starts a new scan.
+ *
+ * RETURN VALUE
+ *   The identical frame, or -1 if none
+ */
+void ksm_scan_begin(struct ksm *ksm);
+long ksm_find_identical(struct ksm *ksm, unsigned int pfn);
+
+/**
+ * Print the counters. @mapcounts tells how many PTEs map each frame.
+ */
+void ksm_show(struct ksm *ksm, const unsigned int *mapcounts, FILE *fp);
+
+#endif
@@ -0,0 +1,396 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <inttypes.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "cpu.h"
+#include "btrace.h"
+#include "reclaim.h"
+#include "output.h"
+#include "evtrace.h"
+
+/**
+ * __convert_trace()
+ *
+ * DESCRIPTION
+ *   Convert the text trace @input into the binary trace at @path.
+ */
+static int __convert_trace(FILE *input, const char *path, bool verbose)
+{
+	struct btrace_writer w;
+	struct trace_record rec;
+
+	if (btrace_open_writer(&w, path)) {
+		fprintf(stderr, "Unable to create %s\n", path);
+		return -1;
+	}
+
+	while (vm_read_record(input, &rec, verbose)) {
+		if (btrace_write(&w, &rec)) {
+			fprintf(stderr, "Unable to write %s\n", path);
+			btrace_close_writer(&w);
+			return -1;
+		}
+		if (rec.op == TRACE_OP_EXIT) break;
+	}
+
+	if (btrace_close_writer(&w)) return -1;
+
+	printf("Converted %lu records into %s\n", w.nr_records, path);
+	return 0;
+}
+
+static void __print_usage(const char * name)
+{
+	printf("Usage: %s {-q} {-p} {-H} {-k [interval]} {-o [level]} {-n [cpus]} {-m [frames]} {-e [ptes]} {-l [levels]}\n", name);
+	printf("          {-t [entries]:[ways]:[policy]} {-s [slots]:[policy]:[file]}\n");
+	printf("          {-a [pages]:[max]} {-W [interval]:[file]} {-N [nodes]:[policy]:[threshold]}\n");
+	printf("          {-c [binary trace]} {-j [threads]} {-S [snapshot]} {-R [snapshot]}\n");
+	printf("          {-T [events]} {-J [json]}\n");
+	printf("          {[workload file] ...}\n");
+	printf("\n");
+	printf("  -q: Run quietly\n");
+	printf("  -n: Number of CPUs to simulate in parallel (default: 1, max: %d)\n",
+			MAX_NR_CPUS);
+	printf("  -p: Measure the latencies, and show the statistics at the end\n");
+	printf("  -o: Output level (default: full)\n");
+	printf("      full   : Print each event\n");
+	printf("      summary: Print the aggregate counters at the end\n");
+	printf("      machine: Print the events and counters as records\n");
+	printf("  -s: Enable swap with [slots] slots in [file] (default: a temporary file)\n");
+	printf("      Usage: -s [slots]:[policy]:[file]. Replacement policy is one of\n");
+	reclaim_print_policies();
+	printf("  -c: Convert the text workload into the binary trace and exit.\n");
+	printf("      Binary traces are detected and replayed from the workload file\n");
+	printf("  -j: Run each workload file as an independent simulation on [threads]\n");
+	printf("      threads. The output goes to [workload file].out, and swap files\n");
+	printf("      are always temporary\n");
+	printf("  -m: Number of physical page frames (default: %d)\n",
+			DEFAULT_NR_PAGEFRAMES);
+	printf("  -e: Number of PTEs per page table, power of 2 (default: %d)\n",
+			1 << DEFAULT_PTES_PER_PAGE_SHIFT);
+	printf("  -l: Number of page table levels (default: %d)\n",
+			DEFAULT_NR_PT_LEVELS);
+	printf("  -H: Map a huge page of [ptes] pages on faults on the VPNs without page\n");
+	printf("      directory, and for alloc ranges covering a whole page directory,\n");
+	printf("      if free frames are available\n");
+	printf("  -k: Give pages contents, and merge the identical pages every [interval]\n");
+	printf("      records\n");
+	printf("  -a: Map [pages] pages around each demand fault, power of 2 up to [ptes],\n");
+	printf("      and read ahead up to [max] pages on sequential faults (default: [ptes])\n");
+	printf("  -W: Scan the working sets every [interval] accesses, and write them to\n");
+	printf("      [file] as CSV. With -j, they go to [workload file].wss instead\n");
+	printf("  -N: Split the page frames into [nodes] NUMA nodes, and place new pages by\n");
+	printf("      [policy], one of first-touch (default), interleave, and bind. Move a\n");
+	printf("      page to the node accessing it after [threshold] remote accesses\n");
+	printf("  -S: Snapshot file that the save and load commands write and read\n");
+	printf("  -R: Restore the state from the snapshot before running the workload.\n");
+	printf("      The snapshot should be taken with the same geometry, CPUs, swap\n");
+	printf("      slots, and -H and -k options\n");
+	printf("  -T: Record the accesses, faults, and process events of each CPU to\n");
+	printf("      [events]. With -j, they go to [workload file].events instead\n");
+	printf("  -J: Convert the events recorded with -T in the input file into the\n");
+	printf("      JSON trace for Chrome and Perfetto, and exit\n");
+	printf("  -t: Configure the TLB (default: %d:%d:lru, 0 to disable).\n",
+			TLB_DEFAULT_ENTRIES, TLB_DEFAULT_WAYS);
+	printf("      policy is one of lru, fifo, and random\n\n");
+}
+
+static int __parse_tlb_option(char *arg, unsigned int *nr_entries,
+		unsigned int *nr_ways, enum tlb_policy *policy)
+{
+	char *ways, *name;
+
+	ways = strchr(arg, ':');
+	if (ways) *ways++ = '\0';
+	*nr_entries = strtoimax(arg, NULL, 0);
+
+	if (!ways) return 0;
+
+	name = strchr(ways, ':');
+	if (name) *name++ = '\0';
+	*nr_ways = strtoimax(ways, NULL, 0);
+
+	if (!name) return 0;
+
+	return tlb_parse_policy(name, policy);
+}
+
+static void __parse_fault_around_option(char *arg, unsigned int *window,
+		unsigned int *max_pages)
+{
+	char *max = strchr(arg, ':');
+
+	if (max) *max++ = '\0';
+	*window = strtoimax(arg, NULL, 0);
+
+	if (max) *max_pages = strtoimax(max, NULL, 0);
+}
+
+static void __parse_wss_option(char *arg, unsigned int *interval,
+		const char **path)
+{
+	char *file = strchr(arg, ':');
+
+	if (file) *file++ = '\0';
+	*interval = strtoimax(arg, NULL, 0);
+
+	if (file && *file) *path = file;
+}
+
+static int __parse_numa_option(char *arg, unsigned int *nr_nodes,
+		enum numa_policy *policy, unsigned int *threshold)
+{
+	char *name, *count;
+
+	name = strchr(arg, ':');
+	if (name) *name++ = '\0';
+	*nr_nodes = strtoimax(arg, NULL, 0);
+
+	if (!name) return 0;
+
+	count = strchr(name, ':');
+	if (count) *count++ = '\0';
+	if (count) *threshold = strtoimax(count, NULL, 0);
+
+	if (!*name) return 0;
+
+	return numa_parse_policy(name, policy);
+}
+
+static int __parse_swap_option(char *arg, unsigned int *nr_slots,
+		const char **policy, const char **path)
+{
+	char *name, *file;
+
+	name = strchr(arg, ':');
+	if (name) *name++ = '\0';
+	*nr_slots = strtoimax(arg, NULL, 0);
+
+	if (!name) return 0;
+
+	file = strchr(name, ':');
+	if (file) *file++ = '\0';
+	if (*name) *policy = name;
+	if (file && *file) *path = file;
+
+	return reclaim_policy_exists(*policy) ? 0 : -1;
+}
+
+int main(int argc, char * argv[])
+{
+	int opt;
+	FILE *input = stdin;
+	struct vm_config config;
+	struct vm_sim sim;
+	const char *convert_to = NULL;
+	const char *json_path = NULL;
+	unsigned int nr_threads = 0;
+	struct btrace_reader btrace;
+	bool binary = false;
+	int ret;
+
+	vm_config_init(&config);
+
+	while ((opt = getopt(argc, argv, "qhpHk:a:n:o:t:m:e:l:c:s:j:S:R:W:N:T:J:")) != -1) {
+		switch (opt) {
+		case 'q':
+			config.verbose = false;
+			break;
+		case 'p':
+			config.profiling = true;
+			break;
+		case 'H':
+			config.thp = true;
+			break;
+		case 'k':
+			config.ksm_interval = strtoimax(optarg, NULL, 0);
+			break;
+		case 'a':
+			__parse_fault_around_option(optarg, &config.fault_around,
+					&config.readahead_max);
+			break;
+		case 'W':
+			__parse_wss_option(optarg, &config.wss_interval,
+					&config.wss_path);
+			break;
+		case 'N':
+			if (__parse_numa_option(optarg, &config.numa_nodes,
+					&config.numa_policy, &config.numa_threshold)) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			config.nr_cpus = strtoimax(optarg, NULL, 0);
+			break;
+		case 'o':
+			if (output_parse_level(optarg, &config.output)) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'm':
+			config.nr_pageframes = strtoimax(optarg, NULL, 0);
+			break;
+		case 'e':
+			config.nr_ptes = strtoimax(optarg, NULL, 0);
+			break;
+		case 'l':
+			config.nr_pt_levels = strtoimax(optarg, NULL, 0);
+			break;
+		case 'c':
+			convert_to = optarg;
+			break;
+		case 'j':
+			nr_threads = strtoimax(optarg, NULL, 0);
+			break;
+		case 'S':
+			config.snapshot_path = optarg;
+			break;
+		case 'R':
+			config.restore_path = optarg;
+			break;
+		case 'T':
+			config.evtrace_path = optarg;
+			break;
+		case 'J':
+			json_path = optarg;
+			break;
+		case 's':
+			if (__parse_swap_option(optarg, &config.swap_slots,
+					&config.swap_policy, &config.swap_path)) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 't':
+			if (__parse_tlb_option(optarg, &config.tlb_entries,
+					&config.tlb_ways, &config.tlb_policy)) {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'h':
+		default:
+			__print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (vm_config_check(&config)) {
+		return EXIT_FAILURE;
+	}
+
+	if (json_path) {
+		long nr;
+
+		if (!argv[optind]) {
+			__print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		nr = evtrace_export_json(argv[optind], json_path);
+		if (nr < 0) return EXIT_FAILURE;
+
+		printf("Converted %ld events into %s\n", nr, json_path);
+		return EXIT_SUCCESS;
+	}
+
+	if (nr_threads) {
+		if (!argv[optind] || convert_to) {
+			__print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		config.verbose = false;
+
+		ret = vm_batch_run(&config, argv + optind, argc - optind, nr_threads);
+		if (ret < 0) {
+			fprintf(stderr, "Unable to start %u threads\n", nr_threads);
+			return EXIT_FAILURE;
+		}
+		printf("Ran %d traces on %u threads, %d failed\n",
+				argc - optind, nr_threads, ret);
+		return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	if (config.verbose && !argv[optind]) {
+		printf("***************************************************************************\n");
+		printf(" __      ____  __     _____ _                 _       _\n");
+		printf(" \\ \\    / /  \\/  |   / ____(_)               | |     | |\n");
+		printf("  \\ \\  / /| \\  / |  | (___  _ _ __ ___  _   _| | __ _| |_ ___  _ __ \n");
+		printf("   \\ \\/ / | |\\/| |   \\___ \\| | '_ ` _ \\| | | | |/ _` | __/ _ \\| '__|\n");
+		printf("    \\  /  | |  | |   ____) | | | | | | | |_| | | (_| | || (_) | |   \n");
+		printf("     \\/   |_|  |_|  |_____/|_|_| |_| |_|\\__,_|_|\\__,_|\\__\\___/|_|\n");
+		printf("\n");
+		printf("                                            >> SCE213 2021 Spring <<\n");
+		printf("\n");
+		printf("***************************************************************************\n");
+	}
+
+	if (argv[optind]) {
+		if (config.verbose) printf("Use file \"%s\" for input.\n", argv[optind]);
+
+		ret = convert_to ? 1 : btrace_open(&btrace, argv[optind]);
+		if (ret == 0) {
+			binary = true;
+			input = NULL;
+		} else if (ret == 1) {
+			input = fopen(argv[optind], "r");
+		} else {
+			input = NULL;
+		}
+		if (!binary && !input) {
+			fprintf(stderr, "No input file %s\n", argv[optind]);
+			return EXIT_FAILURE;
+		}
+		config.verbose = false;
+	} else {
+		if (config.verbose) printf("Use stdin for input.\n");
+	}
+
+	if (convert_to) {
+		ret = __convert_trace(input, convert_to, config.verbose);
+		if (input != stdin) fclose(input);
+		return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	if (vm_sim_init(&sim, &config, stderr)) {
+		return EXIT_FAILURE;
+	}
+
+	if (config.verbose) {
+		printf("Enter 'help' or '?' for help.\n\n");
+		printf(">> ");
+	}
+
+	if (binary) {
+		ret = vm_sim_replay(&sim, &btrace);
+		btrace_close(&btrace);
+	} else {
+		ret = vm_sim_run(&sim, input);
+		if (input != stdin) fclose(input);
+	}
+
+	vm_sim_fini(&sim);
+
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,133 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "memcg.h"
+
+int memcg_init(struct memcg *mc, unsigned int nr_frames)
+{
+	memset(mc, 0x00, sizeof(*mc));
+
+	INIT_LIST_HEAD(&mc->groups);
+	list_add_tail(&mc->root.list, &mc->groups);
+
+	mc->nr_frames = nr_frames;
+	mc->owners = calloc(nr_frames, sizeof(*mc->owners));
+	if (!mc->owners) return -1;
+
+	return 0;
+}
+
+void memcg_fini(struct memcg *mc)
+{
+	struct mem_group *g, *n;
+
+	if (!mc->owners) return;
+
+	list_for_each_entry_safe(g, n, &mc->groups, list) {
+		list_del(&g->list);
+		if (g != &mc->root) free(g);
+	}
+	free(mc->owners);
+	mc->owners = NULL;
+}
+
+struct mem_group *memcg_get_group(struct memcg *mc, unsigned int id,
+		struct mem_group *parent)
+{
+	struct mem_group *g;
+
+	list_for_each_entry(g, &mc->groups, list) {
+		if (g->id == id) return g;
+	}
+
+	g = calloc(1, sizeof(*g));
+	if (!g) return NULL;
+
+	g->id = id;
+	g->parent = parent;
+	list_add_tail(&g->list, &mc->groups);
+
+	return g;
+}
+
+void memcg_charge(struct memcg *mc, unsigned int pfn, struct mem_group *g)
+{
+	mc->owners[pfn] = g;
+
+	for (; g; g = g->parent) {
+		if (++g->usage > g->max_usage) g->max_usage = g->usage;
+	}
+}
+
+void memcg_uncharge(struct memcg *mc, unsigned int pfn)
+{
+	struct mem_group *g = mc->owners[pfn];
+
+	mc->owners[pfn] = NULL;
+
+	for (; g; g = g->parent) {
+		g->usage--;
+	}
+}
+
+void memcg_reset(struct memcg *mc)
+{
+	struct mem_group *g;
+
+	list_for_each_entry(g, &mc->groups, list) {
+		g->usage = 0;
+	}
+	memset(mc->owners, 0x00, sizeof(*mc->owners) * mc->nr_frames);
+}
+
+void memcg_clear(struct memcg *mc)
+{
+	struct mem_group *g, *n;
+
+	list_for_each_entry_safe(g, n, &mc->groups, list) {
+		if (g == &mc->root) continue;
+		list_del(&g->list);
+		free(g);
+	}
+	memcg_reset(mc);
+}
+
+void memcg_show(struct memcg *mc, FILE *fp)
+{
+	struct mem_group *g;
+
+	fprintf(fp, "Memory groups\n");
+	fprintf(fp, "  %5s %6s %10s %10s %10s %10s %10s\n", "group", "parent",
+			"limit", "usage", "max", "reclaimed", "failed");
+
+	list_for_each_entry(g, &mc->groups, list) {
+		char parent[16] = "-";
+		char limit[24] = "-";
+
+		if (g->parent) snprintf(parent, sizeof(parent), "%u", g->parent->id);
+		if (g->limit) snprintf(limit, sizeof(limit), "%lu", g->limit);
+
+		fprintf(fp, "  %5u %6s %10s %10lu %10lu %10lu %10lu\n", g->id,
+				parent, limit, g->usage, g->max_usage,
+				g->nr_reclaimed, g->nr_failed);
+	}
+	fprintf(fp, "\n");
+}
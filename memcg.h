@@ -0,0 +1,134 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __MEMCG_H__
+#define __MEMCG_H__
+
+#include <stdio.h>
+
+#include "types.h"
+#include "list_head.h"
+
+/**
+ * Memory groups
+ *
+ * Processes are put into a hierarchy of groups like the memory cgroups. The
+ * init process starts in the root group, a child is forked into the group of
+ * its parent, and the group command moves a process into another group.
+ *
+ * Each page frame in use is charged to the group of the process that brought
+ * the page in, until the frame is freed. Moving to another group does not
+ * move the charges. The charge counts in the group and all its ancestors,
+ * and a new page is allowed only if no group on the way to the root goes over
+ * its @limit. Otherwise, the pages charged under the group at the limit are
+ * evicted to the swap area first, and the allocation fails when they cannot
+ * be, as a container running out of memory does.
+ */
+struct mem_group {
+	unsigned int id;
+	struct mem_group *parent;	/* NULL for the root group */
+	struct list_head list;		/* Chained in @groups of struct memcg */
+
+	unsigned long limit;		/* In pages, 0 for no limit */
+	unsigned long usage;		/* Pages charged here and to descendants */
+	unsigned long max_usage;
+
+	unsigned long nr_reclaimed;	/* Pages evicted to stay in the limit */
+	unsigned long nr_failed;	/* Allocations failed at the limit */
+};
+
+struct memcg {
+	struct mem_group root;		/* Group 0 */
+	struct list_head groups;	/* All groups, in the creation order */
+
+	unsigned int nr_frames;
+	struct mem_group **owners;	/* Group charged for each frame, or NULL */
+};
+
+/***********************************************************************
+ * memcg_init()
+ *
+ * DESCRIPTION
+ *   Set up the root group without limit and the charges of @nr_frames page
+ *   frames.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 on memory shortage
+ */
+int memcg_init(struct memcg *mc, unsigned int nr_frames);
+void memcg_fini(struct memcg *mc);
+
+/***********************************************************************
+ * memcg_get_group()
+ *
+ * DESCRIPTION
+ *   Find the group @id, or create it as a child of @parent.
+ *
+ * RETURN VALUE
+ *   The group, or NULL on memory shortage
+ */
+struct mem_group *memcg_get_group(struct memcg *mc, unsigned int id,
+		struct mem_group *parent);
+
+/* Whether any group is made or limited */
+static inline bool memcg_enabled(struct memcg *mc)
+{
+	return !list_is_singular(&mc->groups) || mc->root.limit;
+}
+
+/* Whether @g is @ancestor or one of its descendants */
+static inline bool memcg_under(struct mem_group *g, struct mem_group *ancestor)
+{
+	for (; g; g = g->parent) {
+		if (g == ancestor) return true;
+	}
+	return false;
+}
+
+/* The lowest group from @g up to the root that @nr more pages put over the limit */
+static inline struct mem_group *memcg_over_limit(struct mem_group *g,
+		unsigned int nr)
+{
+	for (; g; g = g->parent) {
+		if (g->limit && g->usage + nr > g->limit) return g;
+	}
+	return NULL;
+}
+
+static inline struct mem_group *memcg_owner(struct memcg *mc, unsigned int pfn)
+{
+	return mc->owners[pfn];
+}
+
+/**
+ * Charge @pfn to @g and its ancestors regardless of the limits / Drop the
+ * charge of @pfn if any. The limits are checked with memcg_over_limit()
+ * before the frame is taken.
+ */
+void memcg_charge(struct memcg *mc, unsigned int pfn, struct mem_group *g);
+void memcg_uncharge(struct memcg *mc, unsigned int pfn);
+
+/* Drop all charges, keeping the groups and their limits */
+void memcg_reset(struct memcg *mc);
+
+/* Drop all charges and all groups but the root */
+void memcg_clear(struct memcg *mc);
+
+/**
+ * Print the groups and their usages.
+ */
+void memcg_show(struct memcg *mc, FILE *fp);
+
+#endif
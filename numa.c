@@ -0,0 +1,180 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "numa.h"
+
+static const char * const policy_names[] = {
+	"first-touch",
+	"interleave",
+	"bind",
+};
+
+int numa_parse_policy(const char *name, enum numa_policy *policy)
+{
+	for (int i = 0; i < sizeof(policy_names) / sizeof(*policy_names); i++) {
+		if (strcmp(name, policy_names[i]) == 0) {
+			*policy = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const char *numa_policy_name(enum numa_policy policy)
+{
+	return policy_names[policy];
+}
+
+int numa_init(struct numa *numa, unsigned int nr_nodes,
+		enum numa_policy policy, unsigned int threshold,
+		unsigned int nr_frames)
+{
+	memset(numa, 0x00, sizeof(*numa));
+
+	if (!nr_nodes) return 0;
+
+	numa->nr_nodes = nr_nodes;
+	numa->policy = policy;
+	numa->threshold = threshold;
+	numa->nr_frames = nr_frames;
+	numa->frames_per_node = nr_frames / nr_nodes;
+	numa->next_home = 1 % nr_nodes;	/* The init process is on node 0 */
+
+	if (!threshold) return 0;
+
+	numa->nr_remote = calloc(nr_frames, sizeof(*numa->nr_remote));
+	numa->last_node = calloc(nr_frames, sizeof(*numa->last_node));
+
+	if (!numa->nr_remote || !numa->last_node) {
+		numa_fini(numa);
+		return -1;
+	}
+	return 0;
+}
+
+void numa_fini(struct numa *numa)
+{
+	free(numa->nr_remote);
+	free(numa->last_node);
+
+	numa->nr_remote = NULL;
+	numa->last_node = NULL;
+}
+
+void numa_assign_home(struct numa *numa, struct numa_state *state)
+{
+	memset(state, 0x00, sizeof(*state));
+
+	if (!numa_enabled(numa)) return;
+
+	state->node = numa->next_home;
+	state->interleave = state->node;
+	numa->next_home = (numa->next_home + 1) % numa->nr_nodes;
+}
+
+long numa_find_free_frame_on(struct numa *numa, struct hbitmap *free_frames,
+		unsigned int node)
+{
+	unsigned int end = node == numa->nr_nodes - 1 ?
+			numa->nr_frames : (node + 1) * numa->frames_per_node;
+	long pfn = hbitmap_find_next(free_frames, node * numa->frames_per_node);
+
+	return pfn < end ? pfn : -1;
+}
+
+long numa_find_free_frame(struct numa *numa, struct numa_state *state,
+		struct hbitmap *free_frames)
+{
+	unsigned int first = state->node;
+	long pfn;
+
+	if (numa->policy == NUMA_POLICY_INTERLEAVE) {
+		first = state->interleave;
+		state->interleave = (first + 1) % numa->nr_nodes;
+	}
+
+	pfn = numa_find_free_frame_on(numa, free_frames, first);
+	if (pfn >= 0 || numa->policy == NUMA_POLICY_BIND) return pfn;
+
+	/* The nearest nodes first, the lower one first at the same distance */
+	for (unsigned int hops = 1; hops < numa->nr_nodes; hops++) {
+		if (first >= hops) {
+			pfn = numa_find_free_frame_on(numa, free_frames, first - hops);
+			if (pfn >= 0) return pfn;
+		}
+		if (first + hops < numa->nr_nodes) {
+			pfn = numa_find_free_frame_on(numa, free_frames, first + hops);
+			if (pfn >= 0) return pfn;
+		}
+	}
+	return -1;
+}
+
+bool numa_count_remote(struct numa *numa, unsigned int pfn, unsigned int node)
+{
+	/* Start over when the accesses come from another node */
+	if (__atomic_load_n(&numa->last_node[pfn], __ATOMIC_RELAXED) != node) {
+		__atomic_store_n(&numa->last_node[pfn], node, __ATOMIC_RELAXED);
+		__atomic_store_n(&numa->nr_remote[pfn], 1, __ATOMIC_RELAXED);
+		return numa->threshold == 1;
+	}
+
+	/* Only the access reaching the threshold asks for the move */
+	return __atomic_add_fetch(&numa->nr_remote[pfn], 1, __ATOMIC_RELAXED) ==
+			numa->threshold;
+}
+
+void numa_show(struct numa *numa, struct hbitmap *free_frames, FILE *fp)
+{
+	fprintf(fp, "NUMA\n");
+	fprintf(fp, "  nodes     : %u, %s placement\n", numa->nr_nodes,
+			numa_policy_name(numa->policy));
+	if (numa->threshold) {
+		fprintf(fp, "  migrated  : %lu pages after %u remote accesses, %lu failed\n",
+				numa->nr_migrations, numa->threshold, numa->nr_failed);
+	}
+
+	for (unsigned int node = 0; node < numa->nr_nodes; node++) {
+		unsigned int start = node * numa->frames_per_node;
+		unsigned int end = node == numa->nr_nodes - 1 ?
+				numa->nr_frames : start + numa->frames_per_node;
+		unsigned int nr_used = 0;
+
+		for (unsigned int pfn = start; pfn < end; pfn++) {
+			if (!hbitmap_test(free_frames, pfn)) nr_used++;
+		}
+		fprintf(fp, "  node %-5u: %u/%u frames in use\n", node, nr_used,
+				end - start);
+	}
+
+	fprintf(fp, "  %5s %5s %12s %12s %7s %9s\n",
+			"pid", "node", "local", "remote", "local%", "avg cost");
+}
+
+void numa_show_process(unsigned int pid, const struct numa_state *state,
+		FILE *fp)
+{
+	unsigned long nr_accesses = state->nr_local + state->nr_remote;
+
+	fprintf(fp, "  %5u %5u %12lu %12lu %6.1f%% %9.1f\n", pid, state->node,
+			state->nr_local, state->nr_remote,
+			nr_accesses ? 100.0 * state->nr_local / nr_accesses : 0.0,
+			nr_accesses ? (double)state->cost / nr_accesses : 0.0);
+}
@@ -0,0 +1,208 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include <stdio.h>
+
+#include "types.h"
+#include "bitmap.h"
+
+/**
+ * NUMA memory nodes
+ *
+ * The page frames are split into @nr_nodes nodes of contiguous frames, and
+ * each process runs on its home node assigned round-robin when it is
+ * created. An access costs the distance from the home node of the process
+ * to the node of the frame, NUMA_LOCAL_DISTANCE on the same node and
+ * NUMA_HOP_DISTANCE more for each node in between.
+ *
+ * New pages are placed by @policy. First-touch places a page on the home
+ * node of the process that maps it first, interleave spreads the pages of
+ * each process over the nodes round-robin, and bind keeps them on the home
+ * node. The first two fall back to the nearest node with a free frame.
+ *
+ * When @threshold is set, the remote accesses to each frame are counted
+ * while they come from the same node. The page moves to that node when the
+ * count reaches @threshold, if the node has a free frame.
+ */
+#define NUMA_MAX_NODES		64
+#define NUMA_LOCAL_DISTANCE	10
+#define NUMA_HOP_DISTANCE	10
+
+enum numa_policy {
+	NUMA_POLICY_FIRST_TOUCH = 0,
+	NUMA_POLICY_INTERLEAVE,
+	NUMA_POLICY_BIND,
+};
+
+struct numa {
+	unsigned int nr_nodes;		/* 0 if disabled */
+	enum numa_policy policy;
+	unsigned int threshold;		/* Remote accesses to move, 0 not to */
+
+	unsigned int nr_frames;
+	unsigned int frames_per_node;	/* The last node takes the rest */
+	unsigned int next_home;		/* For the process created next */
+
+	/* Remote accesses to each frame in a row from @last_node */
+	unsigned int *nr_remote;
+	unsigned char *last_node;
+
+	unsigned long nr_migrations;	/* Pages moved to the accessing node */
+	unsigned long nr_failed;	/* No frame was free on the node */
+};
+
+/* NUMA state of a process */
+struct numa_state {
+	unsigned int node;		/* Home node */
+	unsigned int interleave;	/* Node for the next interleaved page */
+
+	unsigned long nr_local;
+	unsigned long nr_remote;
+	unsigned long cost;		/* Sum of the distances of the accesses */
+};
+
+/***********************************************************************
+ * numa_init()
+ *
+ * DESCRIPTION
+ *   Split @nr_frames page frames into @nr_nodes nodes placing pages by
+ *   @policy, and move pages after @threshold remote accesses unless it is 0.
+ *   NUMA is not simulated if @nr_nodes is 0.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 on memory shortage
+ */
+int numa_init(struct numa *numa, unsigned int nr_nodes,
+		enum numa_policy policy, unsigned int threshold,
+		unsigned int nr_frames);
+void numa_fini(struct numa *numa);
+
+/***********************************************************************
+ * numa_parse_policy()
+ *
+ * DESCRIPTION
+ *   Convert policy name (first-touch, interleave, bind) into enum numa_policy.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 if @name is unknown
+ */
+int numa_parse_policy(const char *name, enum numa_policy *policy);
+const char *numa_policy_name(enum numa_policy policy);
+
+static inline bool numa_enabled(struct numa *numa)
+{
+	return numa->nr_nodes > 0;
+}
+
+static inline unsigned int numa_node(struct numa *numa, unsigned int pfn)
+{
+	unsigned int node = pfn / numa->frames_per_node;
+
+	return node < numa->nr_nodes ? node : numa->nr_nodes - 1;
+}
+
+static inline unsigned int numa_distance(unsigned int from, unsigned int to)
+{
+	unsigned int hops = from > to ? from - to : to - from;
+
+	return NUMA_LOCAL_DISTANCE + hops * NUMA_HOP_DISTANCE;
+}
+
+/* Give the process created now its home node */
+void numa_assign_home(struct numa *numa, struct numa_state *state);
+
+/* Move the process with @state to @node, wrapped around the nodes */
+static inline void numa_set_home(struct numa *numa, struct numa_state *state,
+		unsigned int node)
+{
+	state->node = numa_enabled(numa) ? node % numa->nr_nodes : 0;
+	state->interleave = state->node;
+}
+
+/***********************************************************************
+ * numa_find_free_frame()
+ *
+ * DESCRIPTION
+ *   Pick the free frame in @free_frames for a new page of the process with
+ *   @state by the policy. The smallest free frame of the chosen node is
+ *   taken.
+ *
+ * RETURN VALUE
+ *   The free frame, or -1 if none is allowed to the process
+ */
+long numa_find_free_frame(struct numa *numa, struct numa_state *state,
+		struct hbitmap *free_frames);
+
+/* Whether the policy lets the process with @state take @pfn */
+static inline bool numa_allowed(struct numa *numa, struct numa_state *state,
+		unsigned int pfn)
+{
+	return !numa_enabled(numa) || numa->policy != NUMA_POLICY_BIND ||
+			numa_node(numa, pfn) == state->node;
+}
+
+/* The smallest free frame on @node, or -1 if the node is full */
+long numa_find_free_frame_on(struct numa *numa, struct hbitmap *free_frames,
+		unsigned int node);
+
+/* Count a remote access to @pfn from @node, and tell whether to move it */
+bool numa_count_remote(struct numa *numa, unsigned int pfn, unsigned int node);
+
+/**
+ * The process with @state accessed @pfn. Called on each access without
+ * mm_lock() when the translation hits the TLB.
+ *
+ * RETURN VALUE
+ *   @true if the page in @pfn should move to the home node of the process
+ */
+static inline bool numa_account(struct numa *numa, struct numa_state *state,
+		unsigned int pfn)
+{
+	unsigned int node;
+
+	if (!numa_enabled(numa)) return false;
+
+	node = numa_node(numa, pfn);
+	state->cost += numa_distance(state->node, node);
+	if (node == state->node) {
+		state->nr_local++;
+		return false;
+	}
+	state->nr_remote++;
+
+	return numa->threshold && numa_count_remote(numa, pfn, state->node);
+}
+
+/**
+ * Forget the remote accesses to @pfn. Should be called when @pfn is freed.
+ * The counts are atomic since numa_count_remote() runs without mm_lock().
+ */
+static inline void numa_drop_frame(struct numa *numa, unsigned int pfn)
+{
+	if (numa->nr_remote) __atomic_store_n(&numa->nr_remote[pfn], 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * Print the counters and the frames in use on each node, to be followed by
+ * numa_show_process() for each process.
+ */
+void numa_show(struct numa *numa, struct hbitmap *free_frames, FILE *fp);
+void numa_show_process(unsigned int pid, const struct numa_state *state,
+		FILE *fp);
+
+#endif
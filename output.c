@@ -0,0 +1,299 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "output.h"
+#include "cpu.h"
+
+static const char *level_names[] = {
+	[OUTPUT_FULL] = "full",
+	[OUTPUT_SUMMARY] = "summary",
+	[OUTPUT_MACHINE] = "machine",
+};
+
+static const char *fault_type_names[] = {
+	[FAULT_NOT_PRESENT] = "notpresent",
+	[FAULT_SWAPPED] = "swapped",
+	[FAULT_PROTECTION] = "protection",
+};
+
+static const char *alloc_result_names[] = {
+	[ALLOC_OK] = "ok",
+	[ALLOC_EXIST] = "exist",
+	[ALLOC_FULL] = "full",
+};
+
+static const char *free_result_names[] = {
+	[FREE_OK] = "ok",
+	[FREE_SWAPPED] = "swapped",
+	[FREE_NONE] = "none",
+};
+
+static inline char __rw_char(unsigned int rw)
+{
+	return rw == RW_WRITE ? 'w' : 'r';
+}
+
+int output_parse_level(const char *name, enum output_level *level)
+{
+	for (int i = 0; i < sizeof(level_names) / sizeof(*level_names); i++) {
+		if (strcmp(level_names[i], name) == 0) {
+			*level = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const char *fault_type_name(enum fault_type type)
+{
+	return fault_type_names[type];
+}
+
+void output_init(struct vm_sim *sim, enum output_level level, FILE *fp)
+{
+	struct output *out = &sim->output;
+
+	memset(out, 0x00, sizeof(*out));
+	out->level = level;
+	out->fp = fp;
+
+	if (isatty(fileno(fp))) return;
+
+	/* Leave @fp as it is if we cannot afford the buffer */
+	out->buffer = malloc(OUTPUT_BUFFER_SIZE);
+	if (!out->buffer) return;
+
+	setvbuf(fp, out->buffer, _IOFBF, OUTPUT_BUFFER_SIZE);
+}
+
+static void __print_summary(struct output *out)
+{
+	struct output_summary *summary = &out->summary;
+	unsigned long nr_faults = 0;
+
+	for (int i = 0; i < NR_FAULT_TYPES; i++) {
+		nr_faults += summary->nr_faults[i];
+	}
+
+	fprintf(out->fp, "Summary\n");
+	fprintf(out->fp, "  accesses    : %lu (%lu reads, %lu writes, %lu failed)\n",
+			summary->nr_reads + summary->nr_writes,
+			summary->nr_reads, summary->nr_writes,
+			summary->nr_failed_accesses);
+	fprintf(out->fp, "  faults      : %lu\n", nr_faults);
+	for (int i = 0; i < NR_FAULT_TYPES; i++) {
+		fprintf(out->fp, "    %-10s: %lu\n",
+				fault_type_names[i], summary->nr_faults[i]);
+	}
+	fprintf(out->fp, "  allocs      : %lu (%lu failed)\n",
+			summary->nr_allocs, summary->nr_failed_allocs);
+	fprintf(out->fp, "  frees       : %lu (%lu failed)\n",
+			summary->nr_frees, summary->nr_failed_frees);
+	fprintf(out->fp, "  switches    : %lu\n", summary->nr_switches);
+	fprintf(out->fp, "  forks       : %lu\n", summary->nr_forks);
+	fprintf(out->fp, "  exits       : %lu (%lu reaped)\n",
+			summary->nr_exits, summary->nr_reaps);
+	fprintf(out->fp, "\n");
+}
+
+static void __print_stats(struct output *out)
+{
+	struct output_summary *summary = &out->summary;
+
+	fprintf(out->fp, "stat reads %lu\n", summary->nr_reads);
+	fprintf(out->fp, "stat writes %lu\n", summary->nr_writes);
+	fprintf(out->fp, "stat failed_accesses %lu\n", summary->nr_failed_accesses);
+	for (int i = 0; i < NR_FAULT_TYPES; i++) {
+		fprintf(out->fp, "stat faults_%s %lu\n",
+				fault_type_names[i], summary->nr_faults[i]);
+	}
+	fprintf(out->fp, "stat allocs %lu\n", summary->nr_allocs);
+	fprintf(out->fp, "stat failed_allocs %lu\n", summary->nr_failed_allocs);
+	fprintf(out->fp, "stat frees %lu\n", summary->nr_frees);
+	fprintf(out->fp, "stat failed_frees %lu\n", summary->nr_failed_frees);
+	fprintf(out->fp, "stat switches %lu\n", summary->nr_switches);
+	fprintf(out->fp, "stat forks %lu\n", summary->nr_forks);
+	fprintf(out->fp, "stat exits %lu\n", summary->nr_exits);
+	fprintf(out->fp, "stat reaps %lu\n", summary->nr_reaps);
+}
+
+static void __sum_summary(struct vm_sim *sim)
+{
+	const unsigned int nr = sizeof(struct output_summary) / sizeof(unsigned long);
+	unsigned long *total = (unsigned long *)&sim->output.summary;
+	struct cpu *cpu;
+
+	memset(total, 0x00, sizeof(struct output_summary));
+
+	for_each_cpu(sim, cpu) {
+		unsigned long *counts = (unsigned long *)&cpu->summary;
+
+		for (unsigned int i = 0; i < nr; i++) {
+			total[i] += counts[i];
+		}
+	}
+}
+
+void output_fini(struct vm_sim *sim)
+{
+	struct output *out = &sim->output;
+
+	__sum_summary(sim);
+
+	if (out->level == OUTPUT_SUMMARY) __print_summary(out);
+	else if (out->level == OUTPUT_MACHINE) __print_stats(out);
+
+	fflush(out->fp);
+	if (out->buffer) {
+		setvbuf(out->fp, NULL, _IONBF, 0);
+		free(out->buffer);
+		out->buffer = NULL;
+	}
+}
+
+void output_access(struct vm_sim *sim, unsigned int pid, unsigned int vpn,
+		unsigned int rw, bool success, unsigned int pfn)
+{
+	FILE *fp = sim->output.fp;
+
+	if (rw == RW_WRITE) this_cpu->summary.nr_writes++;
+	else this_cpu->summary.nr_reads++;
+	if (!success) this_cpu->summary.nr_failed_accesses++;
+
+	switch (sim->output.level) {
+	case OUTPUT_FULL:
+		if (success) fprintf(fp, "%3u --> %-3u\n", vpn, pfn);
+		else fprintf(fp, "Unable to access %u\n", vpn);
+		break;
+	case OUTPUT_MACHINE:
+		fprintf(fp, "access %u %u %c %ld\n", pid, vpn, __rw_char(rw),
+				success ? (long)pfn : -1L);
+		break;
+	default:
+		break;
+	}
+}
+
+void output_fault(struct vm_sim *sim, unsigned int pid, unsigned int vpn,
+		unsigned int rw, enum fault_type type)
+{
+	this_cpu->summary.nr_faults[type]++;
+
+	if (sim->output.level == OUTPUT_MACHINE) {
+		fprintf(sim->output.fp, "fault %u %u %c %s\n", pid, vpn, __rw_char(rw),
+				fault_type_names[type]);
+	}
+}
+
+void output_alloc(struct vm_sim *sim, unsigned int pid, unsigned int vpn,
+		unsigned int rw, enum alloc_result result, unsigned int pfn)
+{
+	FILE *fp = sim->output.fp;
+
+	if (result == ALLOC_OK) this_cpu->summary.nr_allocs++;
+	else this_cpu->summary.nr_failed_allocs++;
+
+	switch (sim->output.level) {
+	case OUTPUT_FULL:
+		if (result == ALLOC_OK) {
+			fprintf(fp, "alloc %3u --> %-3u\n", vpn, pfn);
+		} else if (result == ALLOC_EXIST) {
+			fprintf(fp, "%u is already allocated to %u\n", vpn, pfn);
+		} else {
+			fprintf(fp, "memory is full\n");
+		}
+		break;
+	case OUTPUT_MACHINE:
+		fprintf(fp, "alloc %u %u %c %ld %s\n", pid, vpn,
+				(rw & RW_WRITE) ? 'w' : 'r',
+				result == ALLOC_FULL ? -1L : (long)pfn,
+				alloc_result_names[result]);
+		break;
+	default:
+		break;
+	}
+}
+
+void output_free(struct vm_sim *sim, unsigned int pid, unsigned int vpn,
+		enum free_result result, unsigned int pfn)
+{
+	FILE *fp = sim->output.fp;
+
+	if (result == FREE_NONE) this_cpu->summary.nr_failed_frees++;
+	else this_cpu->summary.nr_frees++;
+
+	switch (sim->output.level) {
+	case OUTPUT_FULL:
+		if (result == FREE_OK) {
+			fprintf(fp, "free %u (pfn %u)\n", vpn, pfn);
+		} else if (result == FREE_SWAPPED) {
+			fprintf(fp, "free %u (swapped out)\n", vpn);
+		} else {
+			fprintf(fp, "%u is not allocated\n", vpn);
+		}
+		break;
+	case OUTPUT_MACHINE:
+		fprintf(fp, "free %u %u %ld %s\n", pid, vpn,
+				result == FREE_OK ? (long)pfn : -1L,
+				free_result_names[result]);
+		break;
+	default:
+		break;
+	}
+}
+
+void output_switch(struct vm_sim *sim, int from, unsigned int to)
+{
+	this_cpu->summary.nr_switches++;
+
+	if (sim->output.level == OUTPUT_MACHINE) {
+		fprintf(sim->output.fp, "switch %d %u\n", from, to);
+	}
+}
+
+void output_fork(struct vm_sim *sim, unsigned int parent, unsigned int child)
+{
+	this_cpu->summary.nr_forks++;
+
+	if (sim->output.level == OUTPUT_MACHINE) {
+		fprintf(sim->output.fp, "fork %u %u\n", parent, child);
+	}
+}
+
+void output_exit(struct vm_sim *sim, unsigned int pid)
+{
+	this_cpu->summary.nr_exits++;
+
+	if (sim->output.level == OUTPUT_MACHINE) {
+		fprintf(sim->output.fp, "exit %u\n", pid);
+	}
+}
+
+void output_reap(struct vm_sim *sim, unsigned int parent, unsigned int child)
+{
+	this_cpu->summary.nr_reaps++;
+
+	if (sim->output.level == OUTPUT_MACHINE) {
+		fprintf(sim->output.fp, "reap %u %u\n", parent, child);
+	}
+}
@@ -0,0 +1,155 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <stdio.h>
+
+#include "types.h"
+
+/**
+ * Output levels
+ *
+ * OUTPUT_FULL prints a line for each event as the simulator always did.
+ * OUTPUT_SUMMARY suppresses the per-event lines and prints the aggregate
+ * counters at the end of the simulation. OUTPUT_MACHINE prints the events and
+ * the counters as records with space-separated fields:
+ *
+ *   access <pid> <vpn> <r|w> <pfn>		<pfn> is -1 if the access failed
+ *   fault  <pid> <vpn> <r|w> <type>		<type> is one of fault_type_name()
+ *   alloc  <pid> <vpn> <r|w> <pfn> <result>	<result> is ok, exist, or full
+ *   free   <pid> <vpn> <pfn> <result>		<result> is ok, swapped, or none
+ *   switch <from> <to>				<from> is -1 if the CPU was idle
+ *   fork   <parent> <child>
+ *   exit   <pid>
+ *   reap   <parent> <child>
+ *   stat   <name> <value>
+ *
+ * Reports requested by commands such as show and tlb are printed regardless of
+ * the level. Everything goes to the output stream of the simulation (stderr
+ * for the vm binary), which is fully buffered with a large buffer unless it
+ * is a terminal.
+ */
+enum output_level {
+	OUTPUT_FULL = 0,
+	OUTPUT_SUMMARY,
+	OUTPUT_MACHINE,
+};
+
+#define OUTPUT_BUFFER_SIZE	(1 << 20)
+
+/**
+ * Page faults classified by the PTE at the time of the fault, as the MMU
+ * reports in the error code.
+ */
+enum fault_type {
+	FAULT_NOT_PRESENT = 0,	/* No PTE or the PTE is invalid */
+	FAULT_SWAPPED,		/* The PTE is a swap entry */
+	FAULT_PROTECTION,	/* Write to a read-only PTE */
+	NR_FAULT_TYPES,
+};
+
+enum alloc_result {
+	ALLOC_OK = 0,
+	ALLOC_EXIST,		/* Already allocated */
+	ALLOC_FULL,		/* Memory is full */
+};
+
+enum free_result {
+	FREE_OK = 0,
+	FREE_SWAPPED,		/* The page was swapped out */
+	FREE_NONE,		/* Nothing is allocated */
+};
+
+/**
+ * Aggregate counters of the simulation. Counted per CPU, and summed up at the
+ * end. All fields should be unsigned long.
+ */
+struct output_summary {
+	unsigned long nr_reads;
+	unsigned long nr_writes;
+	unsigned long nr_failed_accesses;
+	unsigned long nr_faults[NR_FAULT_TYPES];
+	unsigned long nr_allocs;
+	unsigned long nr_failed_allocs;
+	unsigned long nr_frees;
+	unsigned long nr_failed_frees;
+	unsigned long nr_switches;
+	unsigned long nr_forks;
+	unsigned long nr_exits;
+	unsigned long nr_reaps;
+};
+
+/**
+ * Output stream of a simulation
+ */
+struct output {
+	enum output_level level;
+	FILE *fp;
+	char *buffer;			/* Buffer for @fp, NULL if not buffered */
+	struct output_summary summary;	/* Sum of the per-CPU counters */
+};
+
+struct vm_sim;
+
+/***********************************************************************
+ * output_parse_level()
+ *
+ * DESCRIPTION
+ *   Convert @name (full, summary, or machine) into @level.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 if @name is unknown
+ */
+int output_parse_level(const char *name, enum output_level *level);
+
+/***********************************************************************
+ * output_init()
+ *
+ * DESCRIPTION
+ *   Make @fp the output stream of @sim at @level, and buffer @fp if it is not
+ *   a terminal. Should be called before anything is written to @fp.
+ */
+void output_init(struct vm_sim *sim, enum output_level level, FILE *fp);
+
+/***********************************************************************
+ * output_fini()
+ *
+ * DESCRIPTION
+ *   Print the summary according to the output level and flush the buffer.
+ *   @fp is left open.
+ */
+void output_fini(struct vm_sim *sim);
+
+const char *fault_type_name(enum fault_type type);
+
+/**
+ * Events. @pfn is ignored when the operation fails.
+ */
+void output_access(struct vm_sim *sim, unsigned int pid, unsigned int vpn,
+		unsigned int rw, bool success, unsigned int pfn);
+void output_fault(struct vm_sim *sim, unsigned int pid, unsigned int vpn,
+		unsigned int rw, enum fault_type type);
+void output_alloc(struct vm_sim *sim, unsigned int pid, unsigned int vpn,
+		unsigned int rw, enum alloc_result result, unsigned int pfn);
+void output_free(struct vm_sim *sim, unsigned int pid, unsigned int vpn,
+		enum free_result result, unsigned int pfn);
+void output_switch(struct vm_sim *sim, int from, unsigned int to);
+void output_fork(struct vm_sim *sim, unsigned int parent, unsigned int child);
+void output_exit(struct vm_sim *sim, unsigned int pid);
+void output_reap(struct vm_sim *sim, unsigned int parent, unsigned int child);
+
+#endif
@@ -15,121 +15,1294 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <assert.h>
+#include <string.h>
 #include <strings.h>
 
 #include "types.h"
 #include "list_head.h"
 #include "vm.h"
+#include "tlb.h"
+#include "cpu.h"
+#include "bitmap.h"
+#include "swap.h"
+#include "reclaim.h"
+#include "slab.h"
+#include "output.h"
+#include "rmap.h"
+#include "ksm.h"
+#include "readahead.h"
+#include "wss.h"
+#include "numa.h"
+#include "memcg.h"
 
 /**
- * Ready queue of the system
+ * Everything of the system is in the simulation @sim given to each function;
+ * the ready queue (@sim->processes), the map count of each page frame
+ * (@sim->mapcounts), the index of free page frames (@sim->free_frames), and
+ * so on. See struct vm_sim in vm.h.
+ *
+ * Currently running process (@current) and Page Table Base Register that MMU
+ * will walk through for address translation (@ptbr) are per-CPU. They are
+ * defined in cpu.h.
+ *
+ * Each CPU has its own TLB. Use tlb_shootdown() to invalidate the entries for
+ * a VPN in the TLBs of all CPUs whenever its PTE is changed.
+ *
+ * Every PTE mapping a page frame is chained in the reverse mapping of the
+ * frame (@sim->rmaps) by get_page(), and the processes sharing each directory
+ * are listed in its @sharers. They tell which processes map a frame at which
+ * VPNs without walking the page tables. See rmap.h.
+ *
+ * The footprint of each process (@rss) is updated whenever the mappings of a
+ * frame change, by bracketing the change with rmap_account_rss(). Each frame
+ * in use is charged to the memory group of the process that brought it in
+ * (@sim->memcg), and a process is not given a new frame beyond the limits of
+ * its group. See memcg.h.
+ */
+
+/**
+ * Hash table indexing all processes including @current by pid. The table is
+ * doubled when the average chain length exceeds 1, so looking up a process
+ * takes constant time regardless of the number of processes.
+ */
+#define PID_HASH_INIT_BITS	6
+
+static inline unsigned int __hash_pid(unsigned int pid, unsigned int bits)
+{
+	/* Multiplicative hashing with the golden ratio */
+	return (pid * 0x61C88647U) >> (32 - bits);
+}
+
+static void __grow_pid_hash(struct vm_sim *sim)
+{
+	unsigned int bits = sim->pid_hash_bits + 1;
+	struct hlist_head *hash = calloc(1U << bits, sizeof(*hash));
+
+	/* The old table still works, with longer chains */
+	if (!hash) return;
+
+	for (unsigned int i = 0; i < (1U << sim->pid_hash_bits); i++) {
+		struct process *p;
+		struct hlist_node *n;
+
+		hlist_for_each_entry_safe(p, n, &sim->pid_hash[i], hash) {
+			hlist_del(&p->hash);
+			hlist_add_head(&p->hash, &hash[__hash_pid(p->pid, bits)]);
+		}
+	}
+	free(sim->pid_hash);
+	sim->pid_hash = hash;
+	sim->pid_hash_bits = bits;
+}
+
+static void __hash_process(struct vm_sim *sim, struct process *p)
+{
+	if (++sim->nr_processes > (1U << sim->pid_hash_bits)) __grow_pid_hash(sim);
+
+	hlist_add_head(&p->hash,
+			&sim->pid_hash[__hash_pid(p->pid, sim->pid_hash_bits)]);
+}
+
+static struct process *__find_process(struct vm_sim *sim, unsigned int pid)
+{
+	struct process *p;
+
+	hlist_for_each_entry(p,
+			&sim->pid_hash[__hash_pid(pid, sim->pid_hash_bits)], hash) {
+		if (p->pid == pid) return p;
+	}
+	return NULL;
+}
+
+/**
+ * init_processes()
+ *
+ * DESCRIPTION
+ *   Set up the object caches and the pid hash table, and put the initial
+ *   process into it.
+ *
+ * RETURN
+ *   0 on success, -1 on memory shortage
+ */
+int init_processes(struct vm_sim *sim)
+{
+	kmem_cache_init(&sim->pte_directory_cache, "pte_directory",
+			PTE_DIRECTORY_SIZE, &sim->slab_caches);
+	kmem_cache_init(&sim->table_cache, "pagetable",
+			NR_PTES_PER_PAGE * sizeof(void *), &sim->slab_caches);
+	kmem_cache_init(&sim->process_cache, "process",
+			sizeof(struct process), &sim->slab_caches);
+	if (sim->thp) {
+		kmem_cache_init(&sim->huge_pte_cache, "huge_pte",
+				sizeof(struct huge_pte), &sim->slab_caches);
+	}
+
+	sim->pid_hash_bits = PID_HASH_INIT_BITS;
+	sim->pid_hash = calloc(1U << sim->pid_hash_bits, sizeof(*sim->pid_hash));
+	if (!sim->pid_hash) {
+		fprintf(stderr, "Unable to initialize the pid hash\n");
+		return -1;
+	}
+	__hash_process(sim, current);
+
+	return 0;
+}
+
+/**
+ * init_pageframes()
+ *
+ * DESCRIPTION
+ *   Build the free frame index. All page frames are free at the beginning.
+ *
+ * RETURN
+ *   0 on success, -1 on memory shortage
+ */
+int init_pageframes(struct vm_sim *sim)
+{
+	if (hbitmap_init(&sim->free_frames, NR_PAGEFRAMES, true)) {
+		fprintf(stderr, "Unable to initialize page frames\n");
+		return -1;
+	}
+	return 0;
+}
+
+void fini_pageframes(struct vm_sim *sim)
+{
+	hbitmap_fini(&sim->free_frames);
+}
+
+/* Whether @pfn is in a block mapped by huge PTEs */
+static inline bool __huge_mapped(struct vm_sim *sim, unsigned int pfn)
+{
+	return sim->huge_mapcounts &&
+			sim->huge_mapcounts[pfn >> PTES_PER_PAGE_SHIFT];
+}
+
+/* The number of PTEs mapping @pfn, including the huge ones */
+static inline unsigned int __page_mapcount(struct vm_sim *sim, unsigned int pfn)
+{
+	return sim->mapcounts[pfn] + (sim->huge_mapcounts ?
+			sim->huge_mapcounts[pfn >> PTES_PER_PAGE_SHIFT] : 0);
+}
+
+/**
+ * get_page(@pd, @index) / put_page(@pd, @index)
+ *
+ * DESCRIPTION
+ *   Increase/decrease the mapcount of the page frame that the PTE at @index
+ *   of @pd maps, and link/unlink the PTE to/from the reverse mapping of the
+ *   frame. The page frame leaves the free frame index on its first mapping,
+ *   and gets back when it is unmapped last. The replacement policy tracks the
+ *   frames in use likewise. Frames in huge mapped blocks are left alone until
+ *   the huge mapping goes away. The charge of the frame is dropped when it
+ *   gets free, while the caller charges the frame newly taken.
+ */
+static inline void get_page(struct vm_sim *sim, struct pte_directory *pd,
+		unsigned int index)
+{
+	unsigned int pfn = pte_pfn(&pd->ptes[index]);
+
+	rmap_account_rss(sim, pfn, -1);
+	rmap_add(sim, pfn, pd, index);
+	rmap_account_rss(sim, pfn, 1);
+
+	if (sim->mapcounts[pfn]++ == 0 && !__huge_mapped(sim, pfn)) {
+		hbitmap_clear(&sim->free_frames, pfn);
+		reclaim_add(&sim->reclaim, pfn);
+	}
+}
+
+static inline void put_page(struct vm_sim *sim, struct pte_directory *pd,
+		unsigned int index)
+{
+	unsigned int pfn = pte_pfn(&pd->ptes[index]);
+
+	rmap_account_rss(sim, pfn, -1);
+	rmap_del(sim, pfn, pd, index);
+	rmap_account_rss(sim, pfn, 1);
+
+	if (--sim->mapcounts[pfn] == 0 && !__huge_mapped(sim, pfn)) {
+		hbitmap_set(&sim->free_frames, pfn);
+		reclaim_del(&sim->reclaim, pfn);
+		swap_cache_drop_frame(&sim->swap, pfn);
+		ksm_drop_frame(&sim->ksm, pfn);
+		readahead_drop_frame(&sim->readahead, pfn);
+		numa_drop_frame(&sim->numa, pfn);
+		memcg_uncharge(&sim->memcg, pfn);
+	}
+}
+
+/* Whether a PTE before @index of @pd maps the same frame as the one at @index */
+static bool __mapped_before(struct vm_sim *sim, struct pte_directory *pd,
+		unsigned int index)
+{
+	struct rmap_item *item;
+
+	for_each_rmap(sim, pte_pfn(&pd->ptes[index]), item) {
+		if (item->entry == pd && item->index < index) return true;
+	}
+	return false;
+}
+
+/**
+ * __account_directory(@sim, @pd, @sign) / __account_block(@sim, @pfn, @sign)
+ *
+ * DESCRIPTION
+ *   Bracket a change to the sharers of @pd, or of the huge PTE mapping the
+ *   block from @pfn, with rmap_account_rss() for the frames mapped there.
+ *   Each frame is accounted once however many PTEs of @pd map it.
+ */
+static void __account_directory(struct vm_sim *sim, struct pte_directory *pd,
+		int sign)
+{
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		if (!pte_valid(&pd->ptes[i]) || __mapped_before(sim, pd, i)) continue;
+
+		rmap_account_rss(sim, pte_pfn(&pd->ptes[i]), sign);
+	}
+}
+
+static void __account_block(struct vm_sim *sim, unsigned int pfn, int sign)
+{
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		rmap_account_rss(sim, pfn + i, sign);
+	}
+}
+
+/* Shoot down the translations of @vpn in all processes sharing @sharers */
+static void __shootdown_sharers(struct vm_sim *sim, struct list_head *sharers,
+		unsigned int vpn)
+{
+	struct pt_sharer *s;
+
+	list_for_each_entry(s, sharers, list) {
+		tlb_shootdown(sim, s->process->pid, vpn);
+	}
+}
+
+/**
+ * __alloc_pte_directory()
+ *
+ * DESCRIPTION
+ *   Allocate an empty pte_directory for @vpn referenced by the page table of
+ *   @p.
+ */
+static struct pte_directory *__alloc_pte_directory(struct vm_sim *sim,
+		struct process *p, unsigned int vpn)
+{
+	struct pte_directory *pd = kmem_cache_alloc(&sim->pte_directory_cache);
+
+	pd->refcount = 1;
+	pd->vpn = vpn & ~(NR_PTES_PER_PAGE - 1);
+	INIT_LIST_HEAD(&pd->sharers);
+	sharer_add(sim, &pd->sharers, p);
+	p->rss.nr_pt_pages++;
+	return pd;
+}
+
+/**
+ * __put_pte_directory()
+ *
+ * DESCRIPTION
+ *   Drop the reference of @p to @pd. When the last page table lets it go,
+ *   the pages and swap slots mapped in it are released, and @pd is recycled.
+ */
+static void __put_pte_directory(struct vm_sim *sim, struct process *p,
+		struct pte_directory *pd)
+{
+	__account_directory(sim, pd, -1);
+	sharer_del(sim, &pd->sharers, p);
+	pd->refcount--;
+	__account_directory(sim, pd, 1);
+
+	p->rss.nr_pt_pages--;
+	if (pd->refcount) return;
+
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		struct pte *pte = &pd->ptes[i];
+
+		if (pte_swapped(pte)) swap_free(&sim->swap, pte_pfn(pte));
+		else if (pte_valid(pte)) put_page(sim, pd, i);
+	}
+	kmem_cache_free(&sim->pte_directory_cache, pd);
+}
+
+/**
+ * __put_huge_pte()
+ *
+ * DESCRIPTION
+ *   Drop the reference of @p to @h. When the last page table lets it go, the
+ *   frames in the block become free unless they are mapped by PTEs. Those
+ *   still mapped are handed over to the replacement policy.
+ */
+static void __put_huge_pte(struct vm_sim *sim, struct process *p,
+		struct huge_pte *h)
+{
+	unsigned int pfn = pte_pfn(&h->pte);
+
+	__account_block(sim, pfn, -1);
+	sharer_del(sim, &h->sharers, p);
+
+	if (--h->refcount == 0) {
+		rmap_del(sim, pfn, huge_to_pt(h), 0);
+
+		if (--sim->huge_mapcounts[pfn >> PTES_PER_PAGE_SHIFT] == 0) {
+			for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+				if (sim->mapcounts[pfn + i]) {
+					reclaim_add(&sim->reclaim, pfn + i);
+				} else {
+					hbitmap_set(&sim->free_frames, pfn + i);
+					numa_drop_frame(&sim->numa, pfn + i);
+					memcg_uncharge(&sim->memcg, pfn + i);
+				}
+			}
+		}
+		kmem_cache_free(&sim->huge_pte_cache, h);
+	}
+	__account_block(sim, pfn, 1);
+}
+
+/**
+ * __free_table()
+ *
+ * DESCRIPTION
+ *   Tear down @table of @p at @level and everything below it.
+ */
+static void __free_table(struct vm_sim *sim, struct process *p, void **table,
+		unsigned int level)
+{
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		if (!table[i]) continue;
+
+		if (level == NR_PT_LEVELS - 2) {
+			if (pt_huge(table[i])) {
+				__put_huge_pte(sim, p, pt_to_huge(table[i]));
+			} else {
+				__put_pte_directory(sim, p, table[i]);
+			}
+		} else {
+			__free_table(sim, p, table[i], level + 1);
+		}
+	}
+	kmem_cache_free(&sim->table_cache, table);
+	p->rss.nr_pt_pages--;
+}
+
+/**
+ * __unshare_pte_directory(@sim, @p, @slot)
+ *
+ * DESCRIPTION
+ *   Give @p owning @slot a private copy of the shared directory in @slot.
+ *   The pages in the directory become shared by two directories, so the
+ *   writable PTEs turn into copy-on-write ones in both of them.
+ *   The TLB does not need to be flushed since the shared directory has been
+ *   write-protected and the translations in it remain the same.
+ */
+static struct pte_directory *__unshare_pte_directory(struct vm_sim *sim,
+		struct process *p, struct pte_directory **slot)
+{
+	struct pte_directory *shared = *slot;
+	struct pte_directory *pd;
+
+	if (shared->refcount == 1) return shared;
+
+	/* Every writable PTE turns into a copy-on-write one */
+	pte_wrprotect_all(shared->ptes, NR_PTES_PER_PAGE);
+
+	pd = kmem_cache_alloc(&sim->pte_directory_cache);
+	memcpy(pd, shared, PTE_DIRECTORY_SIZE);
+	pd->refcount = 1;
+	INIT_LIST_HEAD(&pd->sharers);
+	sharer_add(sim, &pd->sharers, p);
+
+	/* The PTEs of the copy map the same pages, so they join the rmaps */
+	for(int i=0;i<NR_PTES_PER_PAGE;i++){
+		struct pte *pte = &pd->ptes[i];
+
+		if(pte_swapped(pte)) swap_dup(&sim->swap, pte_pfn(pte));
+		else if(pte_valid(pte)) get_page(sim, pd, i);
+	}
+
+	/* The shared directory maps its pages for one process fewer without @p */
+	__account_directory(sim, shared, -1);
+	sharer_del(sim, &shared->sharers, p);
+	shared->refcount--;
+	__account_directory(sim, shared, 1);
+	*slot = pd;
+
+	return pd;
+}
+
+/**
+ * __get_pt_slot(@sim, @pt, @vpn, @populate)
+ *
+ * DESCRIPTION
+ *   Walk @pt down to the slot for the pte_directory (or the huge PTE) of
+ *   @vpn. Missing tables on the way are populated if @populate is @true,
+ *   and counted in the process of @pt.
+ *
+ * RETURN
+ *   The slot, or NULL if a table on the way does not exist
+ */
+static void **__get_pt_slot(struct vm_sim *sim, struct pagetable *pt,
+		unsigned int vpn, bool populate)
+{
+	struct rss *rss = &container_of(pt, struct process, pagetable)->rss;
+	void **table;
+	unsigned int index;
+
+	if (!pt->outer_ptes) {
+		if (!populate) return NULL;
+		pt->outer_ptes = kmem_cache_alloc(&sim->table_cache);
+		rss->nr_pt_pages++;
+	}
+	table = pt->outer_ptes;
+
+	for (unsigned int level = 0; level < NR_PT_LEVELS - 2; level++) {
+		index = pt_index(sim, vpn, level);
+		if (!table[index]) {
+			if (!populate) return NULL;
+			table[index] = kmem_cache_alloc(&sim->table_cache);
+			rss->nr_pt_pages++;
+		}
+		table = table[index];
+	}
+
+	return &table[pt_index(sim, vpn, NR_PT_LEVELS - 2)];
+}
+
+/* The huge PTE mapping @vpn in @pt, or NULL if @vpn is not mapped huge */
+static struct huge_pte *__get_huge_pte(struct vm_sim *sim,
+		struct pagetable *pt, unsigned int vpn)
+{
+	void **slot = __get_pt_slot(sim, pt, vpn, false);
+
+	return slot && pt_huge(*slot) ? pt_to_huge(*slot) : NULL;
+}
+
+/**
+ * __split_huge_pte(@sim, @p, @slot, @vpn)
+ *
+ * DESCRIPTION
+ *   Replace the huge PTE in @slot of @p with a pte_directory mapping the same
+ *   page frames with individual PTEs. If the huge PTE is shared with others,
+ *   they keep it, and the writable pages turn into copy-on-write ones on
+ *   both sides as in __unshare_pte_directory().
+ */
+static struct pte_directory *__split_huge_pte(struct vm_sim *sim,
+		struct process *p, void **slot, unsigned int vpn)
+{
+	struct huge_pte *h = pt_to_huge(*slot);
+	struct pte_directory *pd = __alloc_pte_directory(sim, p, vpn);
+
+	if (h->refcount > 1) pte_wrprotect_all(&h->pte, 1);
+
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		struct pte *pte = &pd->ptes[i];
+
+		pte_set(pte, pte_pfn(&h->pte) + i, h->pte.word & PTE_FLAGS_MASK);
+		get_page(sim, pd, i);
+	}
+	*slot = pd;
+	__put_huge_pte(sim, p, h);
+
+	/* Drop the huge translation of @p */
+	tlb_shootdown(sim, p->pid, vpn);
+	sim->stats.nr_huge_splits++;
+
+	return pd;
+}
+
+/**
+ * __get_pte_directory(@sim, @p, @vpn, @write)
+ *
+ * DESCRIPTION
+ *   Walk the page table of @p down to the pte_directory for @vpn. When @write
+ *   is @true, the caller is about to modify the directory; missing tables on
+ *   the way are populated, the directory is unshared if it is shared with
+ *   others, and the huge PTE covering @vpn is split.
+ *
+ * RETURN
+ *   The pte_directory for @vpn, or NULL if it does not exist and @write is
+ *   @false. NULL is returned also for huge mapped @vpn if @write is @false.
+ */
+static struct pte_directory *__get_pte_directory(struct vm_sim *sim,
+		struct process *p, unsigned int vpn, bool write)
+{
+	void **slot = __get_pt_slot(sim, &p->pagetable, vpn, write);
+
+	if (!slot) return NULL;
+	if (!write) return pt_huge(*slot) ? NULL : *slot;
+
+	if (!*slot) {
+		*slot = __alloc_pte_directory(sim, p, vpn);
+		return *slot;
+	}
+	if (pt_huge(*slot)) return __split_huge_pte(sim, p, slot, vpn);
+
+	return __unshare_pte_directory(sim, p, (struct pte_directory **)slot);
+}
+
+/**
+ * __migrate_page(@sim, @from, @to)
+ *
+ * DESCRIPTION
+ *   Move the page in the page frame @from to the free page frame @to. The
+ *   PTEs mapping @from are found through the reverse mapping and redirected
+ *   to @to, and their stale translations are shot down in the processes
+ *   sharing them. @from becomes free, and @to is charged to the group of
+ *   @from. A merged page stays merged in @to.
+ */
+static void __migrate_page(struct vm_sim *sim, unsigned int from,
+		unsigned int to)
+{
+	long slot = swap_cache_slot(&sim->swap, from);
+	struct mem_group *owner = memcg_owner(&sim->memcg, from);
+	struct rmap_item *item, *n;
+
+	/* Before @from gets free and counted wasted, or forgotten merged */
+	readahead_move(&sim->readahead, from, to);
+	ksm_move_frame(&sim->ksm, from, to);
+
+	for_each_rmap_safe(sim, from, item, n) {
+		struct pte_directory *pd = item->entry;
+		unsigned int index = item->index;
+
+		assert(!pt_huge(item->entry));
+
+		put_page(sim, pd, index);
+		pte_set_pfn(&pd->ptes[index], to);
+		get_page(sim, pd, index);
+		__shootdown_sharers(sim, &pd->sharers, pd->vpn + index);
+	}
+	if (slot >= 0) swap_cache_add(&sim->swap, slot, to);
+	ksm_set_content(&sim->ksm, to, ksm_content(&sim->ksm, from));
+	memcg_charge(&sim->memcg, to, owner);
+}
+
+/**
+ * __compact_block(@sim)
+ *
+ * DESCRIPTION
+ *   Make an aligned block of NR_PTES_PER_PAGE page frames free by migrating
+ *   the pages in the block to free frames elsewhere. The block with the
+ *   fewest pages in use is chosen. The free frames in the block are taken
+ *   out of the free frame index first so that the pages are not migrated
+ *   into the block itself.
+ *
+ * RETURN
+ *   The first page frame of the block
+ *   -1 if there are not enough free frames outside any block
+ */
+static long __compact_block(struct vm_sim *sim)
+{
+	unsigned int nr_blocks = NR_PAGEFRAMES >> PTES_PER_PAGE_SHIFT;
+	unsigned int nr_free = 0;
+	unsigned int best_used = NR_PTES_PER_PAGE;
+	long best = -1;
+	long pfn;
+
+	for (unsigned int b = 0; b < nr_blocks; b++) {
+		unsigned int used = 0;
+
+		for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+			if (!hbitmap_test(&sim->free_frames,
+					(b << PTES_PER_PAGE_SHIFT) + i)) used++;
+		}
+		nr_free += NR_PTES_PER_PAGE - used;
+
+		if (sim->huge_mapcounts[b] || used >= best_used) continue;
+		best = b << PTES_PER_PAGE_SHIFT;
+		best_used = used;
+	}
+	for (pfn = nr_blocks << PTES_PER_PAGE_SHIFT; pfn < NR_PAGEFRAMES; pfn++) {
+		if (hbitmap_test(&sim->free_frames, pfn)) nr_free++;
+	}
+
+	if (best < 0) return -1;
+	if (nr_free - (NR_PTES_PER_PAGE - best_used) < best_used) return -1;
+
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		hbitmap_clear(&sim->free_frames, best + i);
+	}
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		if (!sim->mapcounts[best + i]) continue;
+
+		pfn = hbitmap_find_first(&sim->free_frames);
+		__migrate_page(sim, best + i, pfn);
+		hbitmap_clear(&sim->free_frames, best + i);
+		sim->stats.nr_migrations++;
+	}
+	return best;
+}
+
+/**
+ * migrate_numa_page(@sim, @pfn, @node)
+ *
+ * DESCRIPTION
+ *   Move the page in @pfn to the smallest free frame of @node, where the
+ *   remote accesses to the page come from. Called by the framework with
+ *   mm_lock() held. The page may have been freed or replaced since the
+ *   accesses, and pages in huge mapped blocks stay where they are.
+ *
+ * RETURN
+ *   @true if the page is moved
+ *   @false otherwise, including when @node has no free frame
  */
-extern struct list_head processes;
+bool migrate_numa_page(struct vm_sim *sim, unsigned int pfn, unsigned int node)
+{
+	long to;
+
+	if (!sim->mapcounts[pfn] || __huge_mapped(sim, pfn)) return false;
+	if (numa_node(&sim->numa, pfn) == node) return false;
+
+	to = numa_find_free_frame_on(&sim->numa, &sim->free_frames, node);
+	if (to < 0) {
+		sim->numa.nr_failed++;
+		return false;
+	}
+	__migrate_page(sim, pfn, to);
+	sim->numa.nr_migrations++;
+
+	return true;
+}
+
+/**
+ * __put_empty_directory(@sim, @p, @vpn)
+ *
+ * DESCRIPTION
+ *   Release the private pte_directory for @vpn of @p if nothing is mapped
+ *   in it any longer.
+ */
+static void __put_empty_directory(struct vm_sim *sim, struct process *p,
+		unsigned int vpn)
+{
+	void **slot = __get_pt_slot(sim, &p->pagetable, vpn, false);
+	struct pte_directory *pd = *slot;
+
+	if (pte_count_present(pd->ptes, NR_PTES_PER_PAGE)) return;
+
+	__put_pte_directory(sim, p, pd);
+	*slot = NULL;
+}
+
+/**
+ * __alloc_huge_page(@sim, @p, @slot, @vpn, @rw)
+ *
+ * DESCRIPTION
+ *   Map the first free aligned block of page frames to the empty @slot of @p
+ *   with a huge PTE. When no block is free, one is compacted out of the
+ *   scattered free frames. Huge pages are not worth evicting other pages, so
+ *   this fails rather than reclaiming frames when compaction fails too, or
+ *   when the block does not fit in the memory group of @p.
+ *
+ * RETURN
+ *   The page frame mapped to @vpn
+ *   -1 if no block of NR_PTES_PER_PAGE frames is free
+ */
+static long __alloc_huge_page(struct vm_sim *sim, struct process *p,
+		void **slot, unsigned int vpn, unsigned int rw)
+{
+	long pfn;
+	struct huge_pte *h;
+
+	if (memcg_over_limit(p->memcg, NR_PTES_PER_PAGE)) return -1;
+
+	pfn = hbitmap_find_aligned(&sim->free_frames, PTES_PER_PAGE_SHIFT);
+	if (pfn < 0) pfn = __compact_block(sim);
+	if (pfn < 0) return -1;
+
+	h = kmem_cache_alloc(&sim->huge_pte_cache);
+	h->refcount = 1;
+	h->vpn = vpn & ~(NR_PTES_PER_PAGE - 1);
+	INIT_LIST_HEAD(&h->sharers);
+	sharer_add(sim, &h->sharers, p);
+	pte_set(&h->pte, pfn, PTE_VALID | (rw != RW_READ ? PTE_WRITABLE : 0));
+
+	sim->huge_mapcounts[pfn >> PTES_PER_PAGE_SHIFT]++;
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		hbitmap_clear(&sim->free_frames, pfn + i);
+		ksm_set_content(&sim->ksm, pfn + i, 0);
+		memcg_charge(&sim->memcg, pfn + i, p->memcg);
+	}
+	rmap_add(sim, pfn, huge_to_pt(h), 0);
+	__account_block(sim, pfn, 1);
+	*slot = huge_to_pt(h);
+	sim->stats.nr_huge_allocs++;
+	evtrace_emit(&sim->evtrace, this_cpu->id, EVTRACE_ALLOC,
+			p->pid, h->vpn, pfn, rw);
+
+	return pfn + vpn % NR_PTES_PER_PAGE;
+}
+
+/**
+ * __try_to_unmap(@sim, @pfn, @slot)
+ *
+ * DESCRIPTION
+ *   Turn every PTE mapping @pfn into the swap entry for @slot. The PTEs are
+ *   found through the reverse mapping of @pfn, and the translations are shot
+ *   down in all processes sharing the directories of the PTEs. Frames in huge
+ *   mapped blocks are never chosen as the victim, so every PTE is in a
+ *   pte_directory.
+ */
+static void __try_to_unmap(struct vm_sim *sim, unsigned int pfn,
+		unsigned int slot)
+{
+	struct rmap_item *item, *n;
+
+	for_each_rmap_safe(sim, pfn, item, n) {
+		struct pte_directory *pd = item->entry;
+		unsigned int index = item->index;
+		struct pte *pte = &pd->ptes[index];
+
+		assert(!pt_huge(item->entry));
+
+		put_page(sim, pd, index);
+		pte_clear_flags(pte, PTE_VALID | PTE_ACCESSED | PTE_DIRTY);
+		pte_set_flags(pte, PTE_SWAPPED);
+		pte_set_pfn(pte, slot);
+		swap_dup(&sim->swap, slot);
+
+		__shootdown_sharers(sim, &pd->sharers, pd->vpn + index);
+	}
+}
+
+/**
+ * __evict_page(@sim, @pfn)
+ *
+ * DESCRIPTION
+ *   Evict the victim @pfn to the swap area. A frame still in the swap cache
+ *   is clean, so it goes back to its slot without being written.
+ *
+ * RETURN
+ *   The freed page frame number
+ *   -1 if there is no victim or the swap area is full
+ */
+static long __evict_page(struct vm_sim *sim, long pfn)
+{
+	long slot;
+
+	if (pfn < 0) return -1;
+
+	slot = swap_cache_slot(&sim->swap, pfn);
+	if (slot < 0) {
+		slot = swap_alloc_slot(&sim->swap);
+		if (slot < 0) return -1;
+
+		if (swap_writepage(&sim->swap, slot, pfn,
+					ksm_content(&sim->ksm, pfn))) {
+			fprintf(sim->output.fp, "Unable to write swap slot %ld\n", slot);
+			swap_dup(&sim->swap, slot);
+			swap_free(&sim->swap, slot);
+			return -1;
+		}
+	}
+
+	__try_to_unmap(sim, pfn, slot);
+	assert(sim->mapcounts[pfn] == 0);
+
+	return pfn;
+}
+
+/* Evict the page frame chosen by the replacement policy */
+static long __reclaim_page(struct vm_sim *sim)
+{
+	return __evict_page(sim, reclaim_select_victim(&sim->reclaim));
+}
+
+struct __reclaim_scope {
+	struct memcg *memcg;
+	struct mem_group *group;
+};
+
+static bool __charged_under(unsigned int pfn, void *arg)
+{
+	struct __reclaim_scope *scope = arg;
+
+	return memcg_under(memcg_owner(scope->memcg, pfn), scope->group);
+}
+
+/* Evict the page frame that the policy chooses among those charged under @g */
+static long __reclaim_group(struct vm_sim *sim, struct mem_group *g)
+{
+	struct __reclaim_scope scope = { &sim->memcg, g };
+
+	return __evict_page(sim, reclaim_select_victim_if(&sim->reclaim,
+				__charged_under, &scope));
+}
+
+/**
+ * __try_charge(@sim, @nr)
+ *
+ * DESCRIPTION
+ *   Make room for @nr more pages in the memory group of @current. The pages
+ *   charged under the group at the limit are evicted until they fit.
+ *
+ * RETURN
+ *   @true if @nr pages can be charged
+ *   @false if they cannot, which counts as a failure of the group
+ */
+static bool __try_charge(struct vm_sim *sim, unsigned int nr)
+{
+	struct mem_group *g;
+
+	while ((g = memcg_over_limit(current->memcg, nr))) {
+		if (!swap_enabled(&sim->swap) || __reclaim_group(sim, g) < 0) {
+			g->nr_failed++;
+			return false;
+		}
+		g->nr_reclaimed++;
+	}
+	return true;
+}
+
+/**
+ * __find_free_frame()
+ *
+ * RETURN
+ *   The free frame for a new page of @current, which is the smallest free pfn
+ *   or the smallest one on the node that the NUMA policy picks.
+ *   -1 if no frame is free for @current.
+ */
+static long __find_free_frame(struct vm_sim *sim)
+{
+	if (!numa_enabled(&sim->numa)) return hbitmap_find_first(&sim->free_frames);
+
+	return numa_find_free_frame(&sim->numa, &current->numa, &sim->free_frames);
+}
+
+/**
+ * __get_free_frame()
+ *
+ * RETURN
+ *   The free frame from __find_free_frame(), or the pfn reclaimed when no
+ *   frame is free. A process bound to its NUMA node evicts pages until a
+ *   frame of the node gets free.
+ *   -1 if all page frames are in use and cannot be reclaimed, or the memory
+ *   group of @current is at its limit.
+ */
+static long __get_free_frame(struct vm_sim *sim)
+{
+	long pfn;
+
+	if (!__try_charge(sim, 1)) return -1;
+
+	pfn = __find_free_frame(sim);
+	if (pfn >= 0 || !swap_enabled(&sim->swap)) return pfn;
+
+	do {
+		pfn = __reclaim_page(sim);
+	} while (pfn >= 0 && !numa_allowed(&sim->numa, &current->numa, pfn));
+
+	return pfn;
+}
+
+/**
+ * __swap_in(@sim, @pd, @index)
+ *
+ * DESCRIPTION
+ *   Bring the page for the swap entry at @index of @pd back to a page frame.
+ *   If the slot is still referenced by other swap entries, the frame is kept
+ *   in the swap cache so that they can share it.
+ */
+static bool __swap_in(struct vm_sim *sim, struct pte_directory *pd,
+		unsigned int index)
+{
+	struct pte *pte = &pd->ptes[index];
+	unsigned int slot = pte_pfn(pte);
+	long pfn = swap_cache_lookup(&sim->swap, slot);
+	unsigned int content;
+
+	if (pfn < 0) {
+		pfn = __get_free_frame(sim);
+		if (pfn < 0) return false;
+
+		if (swap_readpage(&sim->swap, slot, &content)) {
+			fprintf(sim->output.fp, "Unable to read swap slot %u\n", slot);
+			return false;
+		}
+		ksm_set_content(&sim->ksm, pfn, content);
+		memcg_charge(&sim->memcg, pfn, current->memcg);
+		if (sim->swap.swap_map[slot] > 1) swap_cache_add(&sim->swap, slot, pfn);
+	}
+
+	pte_clear_flags(pte, PTE_SWAPPED);
+	pte_set_flags(pte, PTE_VALID);
+	pte_set_pfn(pte, pfn);
+	get_page(sim, pd, index);
+
+	swap_free(&sim->swap, slot);
+
+	return true;
+}
+
+
+/**
+ * __map_new_page(@sim, @pd, @index, @pfn, @rw)
+ *
+ * DESCRIPTION
+ *   Map the free page frame @pfn to the PTE at @index of the private @pd as
+ *   a new zero-filled page for @rw, charged to the group of @current. A swap
+ *   entry in the PTE is dropped.
+ */
+static void __map_new_page(struct vm_sim *sim, struct pte_directory *pd,
+		unsigned int index, unsigned int pfn, unsigned int rw)
+{
+	struct pte *pte = &pd->ptes[index];
+
+	/* A new page is filled with zeros */
+	ksm_set_content(&sim->ksm, pfn, 0);
+	memcg_charge(&sim->memcg, pfn, current->memcg);
+
+	/* The swap entry in the PTE, if any, is dropped */
+	if(pte_swapped(pte)){
+		swap_free(&sim->swap, pte_pfn(pte));
+		pte_clear_flags(pte, PTE_SWAPPED);
+	}
+
+	pte_set_flags(pte, PTE_VALID);
+
+	if(rw == 1) pte_clear_flags(pte, PTE_WRITABLE);
+	else pte_set_flags(pte, PTE_WRITABLE);
+
+	pte_set_pfn(pte, pfn);
+
+	/* Count the new mapping in the mapcount and the rmap of the frame */
+	get_page(sim, pd, index);
+	evtrace_emit(&sim->evtrace, this_cpu->id, EVTRACE_ALLOC,
+			current->pid, pd->vpn + index, pfn, rw);
+}
+
+/**
+ * __alloc_in_huge_page(@sim, @slot, @vpn, @rw)
+ *
+ * DESCRIPTION
+ *   Allocate @vpn in the huge page in @slot of @current for @rw. The huge
+ *   page is split if it is mapped for the other, and the PTE of @vpn takes
+ *   @rw. A page shared with others becomes copy-on-write for writes.
+ *
+ * RETURN
+ *   The page frame mapped to @vpn
+ */
+static unsigned int __alloc_in_huge_page(struct vm_sim *sim, void **slot,
+		unsigned int vpn, unsigned int rw)
+{
+	struct huge_pte *h = pt_to_huge(*slot);
+	struct pte_directory *pd;
+	struct pte *pte;
+
+	if (!pte_test(&h->pte, PTE_WRITABLE | PTE_COW) == (rw == RW_READ)) {
+		return pte_pfn(&h->pte) + vpn % NR_PTES_PER_PAGE;
+	}
+
+	pd = __split_huge_pte(sim, current, slot, vpn);
+	pte = &pd->ptes[vpn % NR_PTES_PER_PAGE];
+
+	pte_clear_flags(pte, PTE_WRITABLE | PTE_COW);
+	if (rw != RW_READ) {
+		pte_set_flags(pte, __page_mapcount(sim, pte_pfn(pte)) > 1 ?
+				PTE_COW : PTE_WRITABLE);
+	}
+	return pte_pfn(pte);
+}
+
+/**
+ * alloc_page(@sim, @vpn, @rw)
+ *
+ * DESCRIPTION
+ *   Allocate a page frame that is not allocated to any process, and map it
+ *   to @vpn. When the system has multiple free pages, this function should
+ *   allocate the page frame with the **smallest pfn**.
+ *   You may construct the page table of the @current process. When the page
+ *   is allocated with RW_WRITE flag, the page may be later accessed for writes.
+ *   However, the pages populated with RW_READ only should not be accessed with
+ *   RW_WRITE accesses. 
+ *
+ *   Huge pages are mapped on demand faults only (see __fault_in()). @vpn in
+ *   a huge page mapped for @rw already is taken as it is, and the huge page
+ *   is split when it is mapped for the other.
+ *
+ * RETURN
+ *   Return allocated page frame number.
+ *   Return -1 if all page frames are allocated.
+ */
+unsigned int alloc_page(struct vm_sim *sim, unsigned int vpn, unsigned int rw){
+	/** NR_PAGEFRAMES : 128 by default
+	 *  PTES_PER_PAGE_SHIFT : 4 by default
+	 *  NR_PTES_PER_PAGE : 1 << PTES_PER_PAGE_SHIFT(4) : 2^0->2^4(16)
+	 *  RW_READ : 0x01
+	 *  RW_WRITE : 0x02
+	 *  r:1 / w:2 / rw:3
+	 *
+	 * The page table of @current is populated as needed.
+	 */
+
+	struct pte_directory *pd;	/* The last level of the page table */
+	long pfn_index;
+
+	if (sim->thp) {
+		void **slot = __get_pt_slot(sim, &current->pagetable, vpn, false);
+
+		if (slot && pt_huge(*slot)) return __alloc_in_huge_page(sim, slot, vpn, rw);
+	}
+
+	/* The smallest free pfn from the free frame index, or evict one */
+	pfn_index = __get_free_frame(sim);
+
+	/**
+	 * Return -1 if no page frame is available, which __alloc_page() in vm.c
+	 * reports. Otherwise, the MMU translates @vpn to the frame from now on.
+	 */
+	if(pfn_index < 0)
+		return -1;
+
+	/* Make the directory if missing, or copy it if shared */
+	pd = __get_pte_directory(sim, current, vpn, true);
+	__map_new_page(sim, pd, vpn % NR_PTES_PER_PAGE, pfn_index, rw);
+
+    return pfn_index;
+}
 
 /**
- * Currently running process
+ * alloc_pages(@sim, @vpn, @nr, @stride, @rw, @pfns)
+ *
+ * DESCRIPTION
+ *   Allocate pages to the @nr VPNs from @vpn every @stride as alloc_page()
+ *   does for each of them. The VPNs should be in the same pte_directory, so
+ *   that the page table is walked for the first one only. Stops at the first
+ *   VPN mapped already, and when no page frame is available. A range covering
+ *   a whole empty directory is mapped with a huge page if possible.
+ *
+ * RETURN
+ *   The number of pages allocated. @pfns has the page frame of each.
  */
-extern struct process *current;
+unsigned int alloc_pages(struct vm_sim *sim, unsigned int vpn, unsigned int nr,
+		unsigned int stride, unsigned int rw, unsigned int *pfns)
+{
+	struct pte_directory *pd;
+	unsigned int i;
+	long pfn;
+
+	if (__get_huge_pte(sim, &current->pagetable, vpn)) return 0;
+
+	if (sim->thp && nr == NR_PTES_PER_PAGE && stride == 1) {
+		void **slot = __get_pt_slot(sim, &current->pagetable, vpn, true);
+
+		if (!*slot && (pfn = __alloc_huge_page(sim, current, slot, vpn, rw)) >= 0) {
+			for (i = 0; i < nr; i++) pfns[i] = pfn + i;
+			return nr;
+		}
+	}
+
+	pd = __get_pte_directory(sim, current, vpn, false);
+	if (pd && pte_valid(&pd->ptes[vpn % NR_PTES_PER_PAGE])) return 0;
+
+	/* alloc_page() maps the first page, making the directory if missing */
+	pfns[0] = alloc_page(sim, vpn, rw);
+	if (pfns[0] == (unsigned int)-1) return 0;
+
+	pd = __get_pte_directory(sim, current, vpn, false);
+	/* The rest are in the huge page that the first one went to */
+	if (!pd) return 1;
+
+	for (i = 1; i < nr; i++) {
+		vpn += stride;
+		if (pte_valid(&pd->ptes[vpn % NR_PTES_PER_PAGE])) break;
+
+		pfn = __get_free_frame(sim);
+		if (pfn < 0) break;
+
+		__map_new_page(sim, pd, vpn % NR_PTES_PER_PAGE, pfn, rw);
+		pfns[i] = pfn;
+	}
+	return i;
+}
 
 /**
- * Page Table Base Register that MMU will walk through for address translation
+ * free_page(@sim, @vpn)
+ *
+ * DESCRIPTION
+ *   Deallocate the page from the current processor. Make sure that the fields
+ *   for the corresponding PTE (valid, writable, pfn) is set @false or 0.
+ *   Also, consider carefully for the case when a page is shared by two processes,
+ *   and one process is to free the page.
+ *
+ * RETURN
+ *   @true if @vpn was mapped or swapped out
+ *   @false if nothing is allocated at @vpn
  */
-extern struct pagetable *ptbr;
+bool free_page(struct vm_sim *sim, unsigned int vpn){
+	struct pte_directory *pd;
+	struct pte *pte;
+
+	/* A huge page is always mapped */
+	if(__get_huge_pte(sim, &current->pagetable, vpn) == NULL){
+		pd = __get_pte_directory(sim, current, vpn, false);
+		if(pd == NULL) return false;
+		pte = &pd->ptes[vpn % NR_PTES_PER_PAGE];
+		if(!pte_present(pte)) return false;
+	}
+
+	/* Free from a private copy of a shared directory, or split a huge page */
+	pd = __get_pte_directory(sim, current, vpn, true);
+	pte = &pd->ptes[vpn % NR_PTES_PER_PAGE];
+
+	if(pte_swapped(pte)){
+		swap_free(&sim->swap, pte_pfn(pte));
+	} else {
+		evtrace_emit(&sim->evtrace, this_cpu->id, EVTRACE_FREE,
+				current->pid, vpn, pte_pfn(pte), 0);
+		put_page(sim, pd, vpn % NR_PTES_PER_PAGE);
+		tlb_shootdown(sim, current->pid, vpn);
+	}
+
+	pte_clear(pte);
+
+	/* Release the directory once its last page is freed */
+	__put_empty_directory(sim, current, vpn);
+
+	return true;
+}
 
 /**
- * The number of mappings for each page frame. Can be used to determine how
- * many processes are using the page frames.
+ * free_pages(@sim, @vpn, @nr, @stride, @results, @pfns)
+ *
+ * DESCRIPTION
+ *   Deallocate the pages at the @nr VPNs from @vpn every @stride as
+ *   free_page() does for each of them. The VPNs should be in the same
+ *   pte_directory, which is walked to once for them all. @results tells
+ *   what was at each VPN, and @pfns has the page frame freed for FREE_OK.
  */
-extern unsigned int mapcounts[];
+void free_pages(struct vm_sim *sim, unsigned int vpn, unsigned int nr,
+		unsigned int stride, enum free_result *results, unsigned int *pfns)
+{
+	struct pte_directory *pd;
+	unsigned int i;
+
+	/* A huge page is always mapped */
+	if(__get_huge_pte(sim, &current->pagetable, vpn) == NULL){
+		pd = __get_pte_directory(sim, current, vpn, false);
+
+		for (i = 0; pd && i < nr; i++) {
+			struct pte *pte = &pd->ptes[(vpn + i * stride) % NR_PTES_PER_PAGE];
+
+			if (pte_present(pte)) break;
+		}
+		if (!pd || i == nr) {
+			for (i = 0; i < nr; i++) results[i] = FREE_NONE;
+			return;
+		}
+	}
+
+	/* Free from a private copy of a shared directory, or split a huge page */
+	pd = __get_pte_directory(sim, current, vpn, true);
+
+	for (i = 0; i < nr; i++) {
+		unsigned int index = (vpn + i * stride) % NR_PTES_PER_PAGE;
+		struct pte *pte = &pd->ptes[index];
+
+		if(pte_swapped(pte)){
+			swap_free(&sim->swap, pte_pfn(pte));
+			results[i] = FREE_SWAPPED;
+		} else if (pte_valid(pte)) {
+			pfns[i] = pte_pfn(pte);
+			evtrace_emit(&sim->evtrace, this_cpu->id, EVTRACE_FREE,
+					current->pid, vpn + i * stride, pfns[i], 0);
+			put_page(sim, pd, index);
+			tlb_shootdown(sim, current->pid, vpn + i * stride);
+			results[i] = FREE_OK;
+		} else {
+			results[i] = FREE_NONE;
+			continue;
+		}
+
+		pte_clear(pte);
+	}
 
+	/* Release the directory once its last page is freed */
+	__put_empty_directory(sim, current, vpn);
+}
+
+
+static inline void __count_fault(struct vm_sim *sim, unsigned int vpn,
+		enum fault_class class)
+{
+	stats_count_fault(&sim->stats, current->nr_faults, class);
+	evtrace_emit(&sim->evtrace, this_cpu->id, EVTRACE_FAULT,
+			current->pid, vpn, 0, class);
+}
+
+/* Whether the frames of @h are mapped by nothing but @h */
+static bool __huge_exclusive(struct vm_sim *sim, struct huge_pte *h)
+{
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		if (sim->mapcounts[pte_pfn(&h->pte) + i]) return false;
+	}
+	return true;
+}
 
 /**
- * alloc_page(@vpn, @rw)
+ * __fault_in(@sim, @vpn, @rw)
  *
  * DESCRIPTION
- *   Allocate a page frame that is not allocated to any process, and map it
- *   to @vpn. When the system has multiple free pages, this function should
- *   allocate the page frame with the **smallest pfn**.
- *   You may construct the page table of the @current process. When the page
- *   is allocated with RW_WRITE flag, the page may be later accessed for writes.
- *   However, the pages populated with RW_READ only should not be accessed with
- *   RW_WRITE accesses. 
+ *   Map a page to @vpn on a demand fault, and map the neighbours of @vpn that
+ *   the fault-around and the readahead of @current ask for, in the same way.
+ *   The neighbours only take free frames (see readahead.h). With THP, a fault
+ *   on an empty directory maps the whole directory with a huge page instead.
  *
  * RETURN
- *   Return allocated page frame number.
- *   Return -1 if all page frames are allocated.
+ *   @true if @vpn is mapped
  */
-unsigned int alloc_page(unsigned int vpn, unsigned int rw){
-	/** NR_PAGEFRAMES : 128
-	 *  PTES_PER_PAGE_SHIFT : 4
-	 *  NR_PTES_PER_PAGE : 1 << PTES_PER_PAGE_SHIFT(4) : 2^0->2^4(16)
-	 *  RW_READ : 0x01
-	 *  RW_WRITE : 0x02
-	 *  r:1 / w:2 / rw:3
-	 * 
-	 * currnet process에 page table 만들어야 됨
-	 */
+static bool __fault_in(struct vm_sim *sim, unsigned int vpn, unsigned int rw)
+{
+	struct pte_directory *pd;
+	unsigned int start, end;
 
-	// Hiereachical Page Tables
-	int pd_index = vpn / NR_PTES_PER_PAGE; //page directory : outer
-    int pte_index = vpn % NR_PTES_PER_PAGE; //page table entity : inner
-    int pfn_index; // physical frame number
-	
-    for(pfn_index = 0; pfn_index < NR_PAGEFRAMES; pfn_index++){
-		if(mapcounts[pfn_index]==0) // linke된 곳이 없음
-			break;
-    }
-
-   /* 메모리가 이미 찼을 경우 -1 return
-	* vm.c에서 __alloc_page를 통해 처리됨
-	* 메모리가 가득차지 않을 경우 __translate를 통해 
-	* vpn을 pfn으로 translate함
-	*/
-    if(pfn_index >= NR_PAGEFRAMES) //page frame의 개수를 넘어가면 -1 
-		return -1;
-	
-    if(current->pagetable.outer_ptes[pd_index]==NULL){ //pd is invalid
-		current->pagetable.outer_ptes[pd_index] = malloc(sizeof(struct pte_directory));
-    }
-    current->pagetable.outer_ptes[pd_index]->ptes[pte_index].valid = true;
+	if (sim->thp) {
+		void **slot = __get_pt_slot(sim, &current->pagetable, vpn, true);
 
-	if(rw == 1) current->pagetable.outer_ptes[pd_index]->ptes[pte_index].writable = false;
-	else current->pagetable.outer_ptes[pd_index]->ptes[pte_index].writable = true;
+		if (!*slot && __alloc_huge_page(sim, current, slot, vpn, rw) >= 0) {
+			return true;
+		}
+	}
 
-    current->pagetable.outer_ptes[pd_index]->ptes[pte_index].pfn = pfn_index;
-	
-	mapcounts[pfn_index]++; //page frame이 할당되었으므로 비어있는 index에 link된 개수 업데이트
+	if (alloc_page(sim, vpn, rw) == (unsigned int)-1) return false;
 
-    return pfn_index;
-}
+	if (!readahead_enabled(&sim->readahead)) return true;
 
-/**
- * free_page(@vpn)
- *
- * DESCRIPTION
- *   Deallocate the page from the current processor. Make sure that the fields
- *   for the corresponding PTE (valid, writable, pfn) is set @false or 0.
- *   Also, consider carefully for the case when a page is shared by two processes,
- *   and one process is to free the page.
- */
-void free_page(unsigned int vpn){
-	int pd_index = vpn / NR_PTES_PER_PAGE;
-    int pte_index = vpn % NR_PTES_PER_PAGE;
+	readahead_window(&sim->readahead, &current->readahead, vpn,
+			NR_PTES_PER_PAGE, &start, &end);
 
-	mapcounts[current->pagetable.outer_ptes[pd_index]->ptes[pte_index].pfn]--;
+	/* The private directory that alloc_page() has made */
+	pd = __get_pte_directory(sim, current, vpn, false);
 
-	current->pagetable.outer_ptes[pd_index]->ptes[pte_index].valid = false;
-	current->pagetable.outer_ptes[pd_index]->ptes[pte_index].writable = false;
-	current->pagetable.outer_ptes[pd_index]->ptes[pte_index].pfn = 0;
-}
+	for (unsigned int i = start; i < end; i++) {
+		struct pte *pte = &pd->ptes[i % NR_PTES_PER_PAGE];
+		long pfn;
 
+		if (pte_present(pte)) continue;
+
+		/* Nothing is evicted for the pages mapped ahead */
+		pfn = __find_free_frame(sim);
+		if (pfn < 0 || memcg_over_limit(current->memcg, 1)) {
+			end = i;
+			break;
+		}
+		__map_new_page(sim, pd, i % NR_PTES_PER_PAGE, pfn, rw);
+		readahead_mark(&sim->readahead, pfn);
+	}
+	readahead_done(&current->readahead, end);
+
+	return true;
+}
 
 /**
  * handle_page_fault()
  *
  * DESCRIPTION
  *   Handle the page fault for accessing @vpn for @rw. This function is called
- *   by the framework when the __translate() for @vpn fails. This implies;
+ *   by the framework when the MMU fails to translate @vpn. This implies;
  *   0. page directory is invalid
  *   1. pte is invalid
  *   2. pte is not writable but @rw is for write
@@ -140,36 +1313,108 @@ void free_page(unsigned int vpn){
  *   @true on successful fault handling
  *   @false otherwise
  */
-bool handle_page_fault(unsigned int vpn, unsigned int rw){
-	int pte_index= vpn % 16;
-	int pd_index = vpn / 16;
+bool handle_page_fault(struct vm_sim *sim, unsigned int vpn, unsigned int rw){
+	struct pte_directory *pd = __get_pte_directory(sim, current, vpn, false);
+	struct huge_pte *h = __get_huge_pte(sim, &current->pagetable, vpn);
+	struct pte *pte;
 
-	//page directory is invalid
-	if(current->pagetable.outer_ptes[pd_index]==NULL){
-		current->pagetable.outer_ptes[pd_index] = malloc(sizeof(struct pte_directory));
-		current->pagetable.outer_ptes[pd_index]->ptes[pte_index].pfn = alloc_page(vpn,rw);
-		return true;
+	/* Only writes fault on a huge page */
+	if(h != NULL){
+		if(!pte_test(&h->pte, PTE_WRITABLE | PTE_COW)){
+			__count_fault(sim, vpn, FAULT_READ_ONLY);
+			return false;
+		}
+
+		/* Make the huge page writable in place if nothing else maps it */
+		if(h->refcount == 1 && pte_test(&h->pte, PTE_COW) && __huge_exclusive(sim, h)){
+			__count_fault(sim, vpn, FAULT_COW_REUSE);
+			pte_set_flags(&h->pte, PTE_WRITABLE);
+			pte_clear_flags(&h->pte, PTE_COW);
+			tlb_shootdown(sim, current->pid, vpn);
+			return true;
+		}
+
+		/* Otherwise split it, and copy on write as the small pages */
+		pd = __get_pte_directory(sim, current, vpn, true);
+	}
+
+	/* page directory is invalid */
+	if(pd == NULL){
+		__count_fault(sim, vpn, FAULT_MISSING_DIRECTORY);
+		return __fault_in(sim, vpn, rw);
+	}
+	pte = &pd->ptes[vpn % NR_PTES_PER_PAGE];
+
+	/**
+	 * page is swapped out. The PTE is updated in place even in a shared
+	 * directory since all the sharers see the same page.
+	 */
+	if(pte_swapped(pte)){
+		__count_fault(sim, vpn, FAULT_SWAP_IN);
+		return __swap_in(sim, pd, vpn % NR_PTES_PER_PAGE);
 	}
 	
-	//pte is invalid
-	if(current->pagetable.outer_ptes[pd_index]->ptes[pte_index].valid == false){
-		current->pagetable.outer_ptes[pd_index]->ptes[pte_index].pfn = alloc_page(vpn,rw);
-		return true;
+	/* pte is invalid */
+	if(!pte_valid(pte)){
+		__count_fault(sim, vpn, FAULT_INVALID_PTE);
+		return __fault_in(sim, vpn, rw);
+	}
+
+	/* read-only page */
+	if(!pte_test(pte, PTE_WRITABLE | PTE_COW)){
+		__count_fault(sim, vpn, FAULT_READ_ONLY);
+		return false;
 	}
 
-	if(current->pagetable.outer_ptes[pd_index]->ptes[pte_index].private==true &&
-	   mapcounts[ptbr->outer_ptes[pd_index]->ptes[pte_index].pfn]>1){//하나의 pfn에 2개이상 할당
-		current->pagetable.outer_ptes[pd_index]->ptes[pte_index].writable=1;// 쓰기모드로 변경
-		mapcounts[ptbr->outer_ptes[pd_index]->ptes[pte_index].pfn]--;//해당 pfn 1줄이고
-		current->pagetable.outer_ptes[pd_index]->ptes[pte_index].private=false;
-		alloc_page(vpn,rw);//새로운 pfn 할당
+	/* directory is shared with other processes; get our own copy first */
+	if(pd->refcount > 1){
+		pd = __get_pte_directory(sim, current, vpn, true);
+		pte = &pd->ptes[vpn % NR_PTES_PER_PAGE];
+	}
+
+	/**
+	 * Copy the page mapped more than once. A page left in the swap cache is
+	 * shared with the other swap entries of the slot as well.
+	 */
+	if(pte_test(pte, PTE_COW) &&
+	   (__page_mapcount(sim, pte_pfn(pte))>1 || swap_cache_slot(&sim->swap, pte_pfn(pte)) >= 0)){
+		unsigned int old_pfn = pte_pfn(pte);
+		unsigned int content = ksm_content(&sim->ksm, old_pfn);
+		struct mem_group *owner = memcg_owner(&sim->memcg, old_pfn);
+
+		__count_fault(sim, vpn, FAULT_COW_COPY);
+		/* A merged page is unmerged */
+		if(ksm_stable(&sim->ksm, old_pfn)) sim->ksm.nr_cow_faults++;
+		pte_set_flags(pte, PTE_WRITABLE);
+		put_page(sim, pd, vpn % NR_PTES_PER_PAGE);
+		/* Not to be evicted while looking for a new frame */
+		pte_clear_flags(pte, PTE_VALID | PTE_COW);
+		tlb_shootdown(sim, current->pid, vpn);
+		/* Map a new frame, or restore the mapping on failure */
+		if(alloc_page(sim, vpn,rw) == (unsigned int)-1){
+			pte_set(pte, old_pfn, (pte->word & PTE_FLAGS_MASK & ~PTE_WRITABLE) | PTE_VALID | PTE_COW);
+			get_page(sim, pd, vpn % NR_PTES_PER_PAGE);
+			/* A frame left only in the swap cache was freed, and comes back */
+			if(!memcg_owner(&sim->memcg, old_pfn)) memcg_charge(&sim->memcg, old_pfn, owner);
+			return false;
+		}
+		/* Copy the contents */
+		ksm_set_content(&sim->ksm, pte_pfn(pte), content);
+		evtrace_emit(&sim->evtrace, this_cpu->id, EVTRACE_COW,
+				current->pid, vpn, old_pfn, rw);
 		return true;
 	}	
 
-	if(current->pagetable.outer_ptes[pd_index]->ptes[pte_index].private==true &&
-	   mapcounts[ptbr->outer_ptes[pd_index]->ptes[pte_index].pfn]==1){//하나의 pfn에 1개만 할당됨
-		current->pagetable.outer_ptes[pd_index]->ptes[pte_index].writable = 1;//쓰기 모드로 변경
-		current->pagetable.outer_ptes[pd_index]->ptes[pte_index].private=false;
+	/* Reuse the page mapped only here, which may be a merged page left alone */
+	if(pte_test(pte, PTE_COW) && __page_mapcount(sim, pte_pfn(pte))==1){
+		__count_fault(sim, vpn, FAULT_COW_REUSE);
+		if(ksm_stable(&sim->ksm, pte_pfn(pte))){
+			sim->ksm.nr_cow_faults++;
+			ksm_drop_frame(&sim->ksm, pte_pfn(pte));
+		}
+		pte_set_flags(pte, PTE_WRITABLE);
+		pte_clear_flags(pte, PTE_COW);
+		tlb_shootdown(sim, current->pid, vpn);
 		return true;
 	}
 
@@ -177,88 +1422,645 @@ bool handle_page_fault(unsigned int vpn, unsigned int rw){
 }
 
 
+/**
+ * __fork_table()
+ *
+ * DESCRIPTION
+ *   Duplicate the page table of the parent at @level for @child. Only the
+ *   upper-level tables are copied, and the pte_directories are shared with
+ *   @child by increasing their refcounts. Shared directories are
+ *   write-protected as a whole, so fork does not touch any PTE.
+ */
+static void **__fork_table(struct vm_sim *sim, struct process *child,
+		void **parent, unsigned int level)
+{
+	void **table = kmem_cache_alloc(&sim->table_cache);
+
+	child->rss.nr_pt_pages++;
+
+	for(int i=0;i<NR_PTES_PER_PAGE;i++){
+		if(parent[i] == NULL) continue;
+
+		if(level == NR_PT_LEVELS - 2){
+			if(pt_huge(parent[i])){
+				struct huge_pte *h = pt_to_huge(parent[i]);
+
+				h->refcount++;
+				sharer_add(sim, &h->sharers, child);
+			} else {
+				struct pte_directory *pd = parent[i];
+
+				pd->refcount++;
+				sharer_add(sim, &pd->sharers, child);
+				child->rss.nr_pt_pages++;
+			}
+			table[i] = parent[i];
+		} else {
+			table[i] = __fork_table(sim, child, parent[i], level + 1);
+		}
+	}
+	return table;
+}
+
+
+/**
+ * create_process(@sim, @pid, @parent)
+ *
+ * DESCRIPTION
+ *   Create a process with @pid as the last child of @parent. The process
+ *   has no address space and is not on any CPU or the ready queue yet. It
+ *   starts in the memory group of @parent.
+ */
+struct process *create_process(struct vm_sim *sim, unsigned int pid,
+		struct process *parent)
+{
+	struct process *p = kmem_cache_alloc(&sim->process_cache);
+
+	p->pid = pid;
+	INIT_LIST_HEAD(&p->list);
+	INIT_LIST_HEAD(&p->children);
+	p->parent = parent;
+	list_add_tail(&p->sibling, &parent->children);
+	p->memcg = parent->memcg;
+	numa_assign_home(&sim->numa, &p->numa);
+	__hash_process(sim, p);
+
+	return p;
+}
+
+/**
+ * attach_pt_entry(@sim, @p, @vpn, @entry)
+ *
+ * DESCRIPTION
+ *   Let the page table of @p share @entry, a pte_directory or a tagged huge
+ *   PTE, for @vpn as fork does. Missing tables on the way are populated.
+ */
+void attach_pt_entry(struct vm_sim *sim, struct process *p, unsigned int vpn,
+		void *entry)
+{
+	*__get_pt_slot(sim, &p->pagetable, vpn, true) = entry;
+
+	if (pt_huge(entry)) {
+		struct huge_pte *h = pt_to_huge(entry);
+
+		h->refcount++;
+		sharer_add(sim, &h->sharers, p);
+	} else {
+		struct pte_directory *pd = entry;
+
+		pd->refcount++;
+		sharer_add(sim, &pd->sharers, p);
+	}
+}
+
 /**
  * switch_process()
  *
  * DESCRIPTION
- *   If there is a process with @pid in @processes, switch to the process.
- *   The @current process at the moment should be put into the @processes
- *   list, and @current should be replaced to the requested process.
- *   Make sure that the next process is unlinked from the @processes, and
- *   @ptbr is set properly.
+ *   If there is a process with @pid in @sim->processes, switch to the
+ *   process. The @current process at the moment should be put into the
+ *   @sim->processes list, and @current should be replaced to the requested
+ *   process. Make sure that the next process is unlinked from the
+ *   @sim->processes, and @ptbr is set properly.
  *
- *   If there is no process with @pid in the @processes list, fork a process
- *   from the @current. This implies the forked child process should have
- *   the identical page table entry 'values' to its parent's (i.e., @current)
- *   page table. 
+ *   A process running on another CPU cannot be switched to.
+ *
+ *   If there is no process with @pid in the @sim->processes list, fork a process
+ *   from the @current, or from the init process if the CPU is idle. This
+ *   implies the forked child process should have the identical page table
+ *   entry 'values' to its parent's (i.e., @current) page table. 
  *   To implement the copy-on-write feature, you should manipulate the writable
- *   bit in PTE and mapcounts for shared pages. You may use pte->private for 
- *   storing some useful information :-)
+ *   bit in PTE and mapcounts for shared pages. You may use PTE_COW for 
+ *   telling copy-on-write pages from read-only ones :-)
  */
-void switch_process(unsigned int pid){
+void switch_process(struct vm_sim *sim, unsigned int pid){
 	struct process *temp = NULL;
 	struct process *child = NULL;
+	struct process *parent = current;
+	struct cpu *cpu;
 
-	// printf("pid : %d\n",pid);
-
-	/** 
-	 * pid가 있는 process가 있는 경우 그 process로 switch
-	 * @current process는 @processes list에 put, 그리고 @current process는
-	 * requested process로 replace
-	 * next process가 @processes로부터 unlinked되고 @ptbr이 올바르게 설정되어있는지 확인
-	*/ 
-	list_for_each_entry(temp,&processes,list){
-		if(temp->pid == pid){ // pid가 있음
-			list_add_tail(&current->list,&processes);
-			list_del_init(&temp->list);
-			current = temp;
-			ptbr = &(temp->pagetable);
-			return;
-		}//if (입력된 pid와 process의 pid가 같음)
-	}//list_for_each_entry
-
-	/** 
-	 * pid가 있는 process가 없는 경우 @currnet에서 process를 fork
- 	 * forked child process가 parent's page table(current)과 동일한 page table entry를
-	 * 가져야 함을 의미한다.
-	 * copy-on-write를 구현하기 위해서는 pte의 writable bit와 
-	 * shared page의 mapcount를 manipulate해야함(wirtable를 꺼두어야 함)
-	 * 일부 useful information을 저장하기 위해서는 pte->private를 사용할 수 있음
+	/**
+	 * Switch to the process with @pid if there is. @current goes into
+	 * @sim->processes, and the process is unlinked from there to become
+	 * @current with @ptbr pointing to its page table.
 	 */
-	child = malloc(sizeof(struct process)); // fork할 process
-	child->pid = pid;
+	temp = __find_process(sim, pid);
+	if(temp == current) return;
 
-	for(int i=0;i<NR_PTES_PER_PAGE;i++){
-		if(current->pagetable.outer_ptes[i] != NULL){ //currnet pd is valid
-			child->pagetable.outer_ptes[i] = malloc(sizeof(struct pte_directory));
+	/* A zombie waiting to be reaped */
+	if(temp != NULL && temp->exited){
+		fprintf(sim->output.fp, "%u has exited\n", pid);
+		return;
+	}
 
-			for(int j=0;j<NR_PTES_PER_PAGE;j++){
-				if(current->pagetable.outer_ptes[i]->ptes[j].valid){
+	if(temp != NULL){
+		/* A process running on another CPU cannot be taken */
+		for_each_cpu(sim, cpu) {
+			if (cpu->curr != temp) continue;
+			fprintf(sim->output.fp, "%u is running on cpu %u\n", pid, cpu->id);
+			return;
+		}
+		if(current) list_add_tail(&current->list,&sim->processes);
+		list_del_init(&temp->list);
+		current = temp;
+		ptbr = &(temp->pagetable);
+		evtrace_emit(&sim->evtrace, this_cpu->id, EVTRACE_SWITCH, pid, 0, 0, 0);
+		return;
+	}
 
-					if(current->pagetable.outer_ptes[i]->ptes[j].writable==true)//쓰기모드 아닌거
-						current->pagetable.outer_ptes[i]->ptes[j].private = true;
+	/**
+	 * Otherwise, fork a child of @current sharing its page table entries.
+	 * The writable pages become copy-on-write ones, which PTE_COW tells from
+	 * the read-only ones. An idle CPU forks from the init process.
+	 */
+	if(parent == NULL) parent = __find_process(sim, 0);
 
-					child->pagetable.outer_ptes[i]->ptes[j].writable = false;//CoW
-					current->pagetable.outer_ptes[i]->ptes[j].writable = false;//CoW
-					
-					child->pagetable.outer_ptes[i]->ptes[j].valid = 
-						current->pagetable.outer_ptes[i]->ptes[j].valid;
+	child = create_process(sim, pid, parent);
+	output_fork(sim, parent->pid, pid);
+	evtrace_emit(&sim->evtrace, this_cpu->id, EVTRACE_FORK, parent->pid, 0, pid, 0);
 
-					child->pagetable.outer_ptes[i]->ptes[j].pfn = 
-						current->pagetable.outer_ptes[i]->ptes[j].pfn;
+	if(parent->pagetable.outer_ptes != NULL){
+		child->pagetable.outer_ptes = __fork_table(sim, child, parent->pagetable.outer_ptes, 0);
 
-					child->pagetable.outer_ptes[i]->ptes[j].private =
-						current->pagetable.outer_ptes[i]->ptes[j].private;
+		/* All pages of the parent are shared with the child, and no one else */
+		child->rss.resident = parent->rss.resident;
+		child->rss.shared = parent->rss.resident;
+		parent->rss.shared = parent->rss.resident;
 
-					mapcounts[child->pagetable.outer_ptes[i]->ptes[j].pfn]++;
-				}
-			}//for i
-		}//if (pd is valid)
-	}//for j
+		/* The writable translations of the parent are gone on every CPU */
+		tlb_shootdown(sim, parent->pid, TLB_FLUSH_ALL);
+	}
 
 
-	list_add_tail(&current->list,&processes);
+	if(current) list_add_tail(&current->list,&sim->processes);
 	current = child;
 	ptbr = &(child->pagetable);
+	evtrace_emit(&sim->evtrace, this_cpu->id, EVTRACE_SWITCH, pid, 0, 0, 0);
+}
+
+
+/**
+ * __write_protect_page(@sim, @pfn)
+ *
+ * DESCRIPTION
+ *   Turn the writable PTEs mapping @pfn into copy-on-write ones, and shoot
+ *   down their translations.
+ */
+static void __write_protect_page(struct vm_sim *sim, unsigned int pfn)
+{
+	struct rmap_item *item;
+
+	for_each_rmap(sim, pfn, item) {
+		struct pte_directory *pd = item->entry;
+		struct pte *pte = &pd->ptes[item->index];
+
+		if (!pte_test(pte, PTE_WRITABLE)) continue;
+
+		pte_clear_flags(pte, PTE_WRITABLE);
+		pte_set_flags(pte, PTE_COW);
+		__shootdown_sharers(sim, &pd->sharers, pd->vpn + item->index);
+	}
+}
+
+/**
+ * __merge_page(@sim, @from, @to)
+ *
+ * DESCRIPTION
+ *   Fold the page frame @from into the identical frame @to. Every PTE
+ *   mapping either of them becomes copy-on-write, and the PTEs mapping @from
+ *   are redirected to @to through the reverse mapping. @from becomes free,
+ *   and @to becomes a stable frame.
+ */
+static void __merge_page(struct vm_sim *sim, unsigned int from, unsigned int to)
+{
+	struct rmap_item *item, *n;
+
+	if (!ksm_stable(&sim->ksm, to)) {
+		__write_protect_page(sim, to);
+		sim->ksm.stable[to] = true;
+	}
+
+	for_each_rmap_safe(sim, from, item, n) {
+		struct pte_directory *pd = item->entry;
+		unsigned int index = item->index;
+		struct pte *pte = &pd->ptes[index];
+
+		pte_wrprotect_all(pte, 1);
+		put_page(sim, pd, index);
+		pte_set_pfn(pte, to);
+		get_page(sim, pd, index);
+		__shootdown_sharers(sim, &pd->sharers, pd->vpn + index);
+	}
+	sim->ksm.nr_merged++;
+}
+
+/**
+ * merge_pages()
+ *
+ * DESCRIPTION
+ *   Scan the page frames in use, and merge those with the same content.
+ *   Frames in huge mapped blocks and in the swap cache are left alone.
+ */
+void merge_pages(struct vm_sim *sim)
+{
+	ksm_scan_begin(&sim->ksm);
+
+	for (unsigned int pfn = 0; pfn < NR_PAGEFRAMES; pfn++) {
+		long same;
+
+		if (!sim->mapcounts[pfn] || __huge_mapped(sim, pfn)) continue;
+		if (swap_cache_slot(&sim->swap, pfn) >= 0) continue;
+
+		same = ksm_find_identical(&sim->ksm, pfn);
+		if (same >= 0) __merge_page(sim, pfn, same);
+	}
+}
+
+/**
+ * __sample_table()
+ *
+ * DESCRIPTION
+ *   Count the pages mapped under @table at @level into @s by their accessed
+ *   and dirty bits.
+ */
+static void __sample_table(struct vm_sim *sim, void **table, unsigned int level,
+		struct wss_sample *s)
+{
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		void *entry = table[i];
+
+		if (!entry) continue;
+
+		if (level < NR_PT_LEVELS - 2) {
+			__sample_table(sim, entry, level + 1, s);
+		} else if (pt_huge(entry)) {
+			struct pte *pte = &pt_to_huge(entry)->pte;
+
+			s->resident += NR_PTES_PER_PAGE;
+			if (pte_test(pte, PTE_ACCESSED)) s->accessed += NR_PTES_PER_PAGE;
+			if (pte_test(pte, PTE_DIRTY)) s->dirty += NR_PTES_PER_PAGE;
+		} else {
+			struct pte *ptes = ((struct pte_directory *)entry)->ptes;
+
+			s->resident += pte_count(ptes, NR_PTES_PER_PAGE, PTE_VALID);
+			s->accessed += pte_count(ptes, NR_PTES_PER_PAGE,
+					PTE_VALID | PTE_ACCESSED);
+			s->dirty += pte_count(ptes, NR_PTES_PER_PAGE,
+					PTE_VALID | PTE_DIRTY);
+		}
+	}
+}
+
+/**
+ * __age_table()
+ *
+ * DESCRIPTION
+ *   Clear the accessed and dirty bits of the pages mapped under @table at
+ *   @level, and shoot down their translations in all processes sharing them.
+ */
+static void __age_table(struct vm_sim *sim, void **table, unsigned int level)
+{
+	const uint64_t bits = PTE_ACCESSED | PTE_DIRTY;
+
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		void *entry = table[i];
+
+		if (!entry) continue;
+
+		if (level < NR_PT_LEVELS - 2) {
+			__age_table(sim, entry, level + 1);
+		} else if (pt_huge(entry)) {
+			struct huge_pte *h = pt_to_huge(entry);
+
+			if (!pte_test(&h->pte, bits)) continue;
+			pte_clear_flags(&h->pte, bits);
+			__shootdown_sharers(sim, &h->sharers, h->vpn);
+		} else {
+			struct pte_directory *pd = entry;
+
+			for (int j = 0; j < NR_PTES_PER_PAGE; j++) {
+				if (!pte_test(&pd->ptes[j], bits)) continue;
+				pte_clear_flags(&pd->ptes[j], bits);
+				__shootdown_sharers(sim, &pd->sharers, pd->vpn + j);
+			}
+		}
+	}
+}
+
+static void __scan_process(struct vm_sim *sim, struct process *p, bool age)
+{
+	void **outer_ptes = p->pagetable.outer_ptes;
+
+	if (age) {
+		if (outer_ptes) __age_table(sim, outer_ptes, 0);
+		return;
+	}
+	memset(&p->wss, 0x00, sizeof(p->wss));
+	if (outer_ptes) __sample_table(sim, outer_ptes, 0, &p->wss);
+	wss_record(&sim->wss, p->pid, &p->wss);
+}
+
+/**
+ * scan_working_sets()
+ *
+ * DESCRIPTION
+ *   Sample the pages that each process accessed and wrote since the last
+ *   scan, and start a new interval. All processes are sampled before any
+ *   bit is cleared since the processes sharing a directory see the same bits.
+ */
+void scan_working_sets(struct vm_sim *sim)
+{
+	struct process *p;
+	struct cpu *cpu;
+
+	sim->wss.nr_scans++;
+
+	for (int age = 0; age < 2; age++) {
+		for_each_cpu(sim, cpu) {
+			if (cpu->curr) __scan_process(sim, cpu->curr, age);
+		}
+		list_for_each_entry(p, &sim->processes, list) {
+			__scan_process(sim, p, age);
+		}
+	}
+}
+
+/**
+ * set_memory_group(@sim, @id)
+ *
+ * DESCRIPTION
+ *   Move @current into the memory group @id, which is created under the group
+ *   of @current if it does not exist. The pages charged so far stay charged
+ *   to the old group.
+ *
+ * RETURN
+ *   @true on success, @false on memory shortage
+ */
+bool set_memory_group(struct vm_sim *sim, unsigned int id)
+{
+	struct mem_group *g = memcg_get_group(&sim->memcg, id, current->memcg);
+
+	if (!g) {
+		fprintf(sim->output.fp, "Unable to create group %u\n", id);
+		return false;
+	}
+	current->memcg = g;
+	return true;
+}
+
+/**
+ * set_memory_limit(@sim, @nr)
+ *
+ * DESCRIPTION
+ *   Limit the memory group of @current to @nr pages, or lift the limit if @nr
+ *   is 0. The pages over the new limit are evicted as many as possible, and
+ *   the group can take no new page until it gets under the limit.
+ */
+void set_memory_limit(struct vm_sim *sim, unsigned int nr)
+{
+	struct mem_group *g = current->memcg;
+
+	g->limit = nr;
+
+	while (g->limit && g->usage > g->limit && swap_enabled(&sim->swap)) {
+		if (__reclaim_group(sim, g) < 0) break;
+		g->nr_reclaimed++;
+	}
+}
+
+/* Count the pages mapped under @table at @level into @rss */
+static void __count_table(struct vm_sim *sim, void **table, unsigned int level,
+		struct rss *rss)
+{
+	rss->nr_pt_pages++;
+
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		void *entry = table[i];
+
+		if (!entry) continue;
+
+		if (level < NR_PT_LEVELS - 2) {
+			__count_table(sim, entry, level + 1, rss);
+		} else if (pt_huge(entry)) {
+			unsigned int pfn = pte_pfn(&pt_to_huge(entry)->pte);
+
+			for (int j = 0; j < NR_PTES_PER_PAGE; j++) {
+				rss->resident++;
+				if (rmap_nr_processes(sim, pfn + j) > 1) rss->shared++;
+			}
+		} else {
+			struct pte_directory *pd = entry;
+
+			rss->nr_pt_pages++;
+			for (int j = 0; j < NR_PTES_PER_PAGE; j++) {
+				if (!pte_valid(&pd->ptes[j])) continue;
+
+				rss->resident++;
+				if (rmap_nr_processes(sim, pte_pfn(&pd->ptes[j])) > 1) {
+					rss->shared++;
+				}
+			}
+		}
+	}
+}
+
+/**
+ * account_restored_memory()
+ *
+ * DESCRIPTION
+ *   Count the footprints of the processes restored from a snapshot by walking
+ *   their page tables.
+ */
+void account_restored_memory(struct vm_sim *sim)
+{
+	struct process *p;
+
+	for (unsigned int i = 0; i < (1U << sim->pid_hash_bits); i++) {
+		hlist_for_each_entry(p, &sim->pid_hash[i], hash) {
+			memset(&p->rss, 0x00, sizeof(p->rss));
+			if (p->pagetable.outer_ptes) {
+				__count_table(sim, p->pagetable.outer_ptes, 0, &p->rss);
+			}
+		}
+	}
+}
+
+/**
+ * __reap_process()
+ *
+ * DESCRIPTION
+ *   Release the zombie @p for good. Its pid can be used again afterward.
+ */
+static void __reap_process(struct vm_sim *sim, struct process *p)
+{
+	output_reap(sim, p->parent->pid, p->pid);
+
+	list_del(&p->sibling);
+	hlist_del(&p->hash);
+	sim->nr_processes--;
+	kmem_cache_free(&sim->process_cache, p);
+}
+
+/**
+ * exit_process(@sim, @pid)
+ *
+ * DESCRIPTION
+ *   Terminate the process with @pid. Its address space is torn down in one
+ *   pass over the page table; the pages only it maps go back to the free
+ *   page frames, and the directories and tables are recycled. A process
+ *   running on a CPU leaves the CPU idle. The process becomes a zombie until
+ *   its parent waits for it, and its children are handed over to the init
+ *   process, which reaps the zombies among them right away.
+ *
+ * RETURN
+ *   @true if the process is terminated
+ *   @false if there is no such process, or @pid is the init process
+ */
+bool exit_process(struct vm_sim *sim, unsigned int pid)
+{
+	struct process *p = __find_process(sim, pid);
+	struct process *init = &sim->init;
+	struct process *child, *n;
+	struct cpu *cpu;
+	bool running = false;
+
+	if (!p || p->exited) {
+		fprintf(sim->output.fp, "No process %u\n", pid);
+		return false;
+	}
+	if (p == init) {
+		fprintf(sim->output.fp, "Unable to kill the init process\n");
+		return false;
+	}
+
+	for_each_cpu(sim, cpu) {
+		if (cpu->curr != p) continue;
+		cpu->curr = NULL;
+		cpu->pt_base = NULL;
+		running = true;
+	}
+	if (!running) list_del_init(&p->list);
+
+	if (p->pagetable.outer_ptes) {
+		__free_table(sim, p, p->pagetable.outer_ptes, 0);
+		p->pagetable.outer_ptes = NULL;
+	}
+	/* The pid may be reused after being reaped */
+	tlb_shootdown(sim, pid, TLB_FLUSH_ALL);
+
+	p->exited = true;
+	output_exit(sim, pid);
+	evtrace_emit(&sim->evtrace, this_cpu->id, EVTRACE_EXIT, pid, 0, 0, 0);
+
+	list_for_each_entry_safe(child, n, &p->children, sibling) {
+		list_move_tail(&child->sibling, &init->children);
+		child->parent = init;
+		if (child->exited) __reap_process(sim, child);
+	}
+	return true;
+}
+
+/**
+ * wait_process(@sim, @pid)
+ *
+ * DESCRIPTION
+ *   Let @current reap its exited child with @pid. Since a trace cannot
+ *   block, waiting for a child still running fails instead.
+ *
+ * RETURN
+ *   @true if the child is reaped
+ *   @false otherwise
+ */
+bool wait_process(struct vm_sim *sim, unsigned int pid)
+{
+	struct process *p = __find_process(sim, pid);
+
+	if (!p || p->parent != current) {
+		fprintf(sim->output.fp, "No child %u\n", pid);
+		return false;
+	}
+	if (!p->exited) {
+		fprintf(sim->output.fp, "%u has not exited\n", pid);
+		return false;
+	}
+	__reap_process(sim, p);
+	return true;
+}
+
+/**
+ * fini_processes()
+ *
+ * DESCRIPTION
+ *   Tear down the page tables of all processes at the end of the simulation,
+ *   and release the object caches.
+ */
+void fini_processes(struct vm_sim *sim)
+{
+	struct process *p;
+	struct cpu *cpu;
+
+	for_each_cpu(sim, cpu) {
+		p = cpu->curr;
+		if (!p || !p->pagetable.outer_ptes) continue;
+		__free_table(sim, p, p->pagetable.outer_ptes, 0);
+		p->pagetable.outer_ptes = NULL;
+	}
+	list_for_each_entry(p, &sim->processes, list) {
+		if (!p->pagetable.outer_ptes) continue;
+		__free_table(sim, p, p->pagetable.outer_ptes, 0);
+		p->pagetable.outer_ptes = NULL;
+	}
+
+	kmem_cache_destroy(&sim->process_cache);
+	kmem_cache_destroy(&sim->table_cache);
+	kmem_cache_destroy(&sim->pte_directory_cache);
+	if (sim->thp) kmem_cache_destroy(&sim->huge_pte_cache);
+
+	free(sim->pid_hash);
+	sim->pid_hash = NULL;
 }
 
+/**
+ * reset_processes()
+ *
+ * DESCRIPTION
+ *   Bring the system back to the state right after the startup; every
+ *   process but the init process is gone without being reaped, the address
+ *   space of the init process is torn down, and CPU 0 runs the init process
+ *   while the others are idle. All page frames and swap slots become free.
+ *   The TLBs are left to the caller.
+ */
+void reset_processes(struct vm_sim *sim)
+{
+	struct process *init = &sim->init;
+	struct process *p;
+	struct hlist_node *n;
+	struct cpu *cpu;
+
+	for (unsigned int i = 0; i < (1U << sim->pid_hash_bits); i++) {
+		hlist_for_each_entry_safe(p, n, &sim->pid_hash[i], hash) {
+			if (p->pagetable.outer_ptes) {
+				__free_table(sim, p, p->pagetable.outer_ptes, 0);
+				p->pagetable.outer_ptes = NULL;
+			}
+			hlist_del(&p->hash);
+			if (p != init) kmem_cache_free(&sim->process_cache, p);
+		}
+	}
+	sim->nr_processes = 0;
+
+	INIT_LIST_HEAD(&sim->processes);
+	INIT_LIST_HEAD(&init->list);
+	INIT_LIST_HEAD(&init->children);
+	memset(init->nr_faults, 0x00, sizeof(init->nr_faults));
+	init->memcg = &sim->memcg.root;
+	__hash_process(sim, init);
+
+	for_each_cpu(sim, cpu) {
+		cpu->curr = NULL;
+		cpu->pt_base = NULL;
+		cpu->nr_shootdowns = 0;
+	}
+	sim->cpus->curr = init;
+	sim->cpus->pt_base = &init->pagetable;
+}
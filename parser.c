@@ -13,40 +13,57 @@
  *
  **********************************************************************/
 
-#include <string.h>
-#include <ctype.h>
-
 #include "types.h"
 #include "parser.h"
 
-int parse_command(char *command, int *nr_tokens, char *tokens[])
+/* Character classes of the tokenizer */
+#define CH_SPACE	0x01
+#define CH_END		0x02
+#define CH_COMMENT	0x04	/* Only at the beginning of a token */
+#define CH_UPPER	0x08
+
+#define __UPPER(c)	[c] = CH_UPPER
+
+static const unsigned char char_class[256] = {
+	['\0'] = CH_END,
+	[' '] = CH_SPACE, ['\t'] = CH_SPACE, ['\n'] = CH_SPACE,
+	['\v'] = CH_SPACE, ['\f'] = CH_SPACE, ['\r'] = CH_SPACE,
+	['#'] = CH_COMMENT,
+	__UPPER('A'), __UPPER('B'), __UPPER('C'), __UPPER('D'), __UPPER('E'),
+	__UPPER('F'), __UPPER('G'), __UPPER('H'), __UPPER('I'), __UPPER('J'),
+	__UPPER('K'), __UPPER('L'), __UPPER('M'), __UPPER('N'), __UPPER('O'),
+	__UPPER('P'), __UPPER('Q'), __UPPER('R'), __UPPER('S'), __UPPER('T'),
+	__UPPER('U'), __UPPER('V'), __UPPER('W'), __UPPER('X'), __UPPER('Y'),
+	__UPPER('Z'),
+};
+
+int parse_command(char *command, int *nr_tokens, struct token tokens[])
 {
-	char *curr = command;
-	int token_started = false;
-	*nr_tokens = 0;
-
-	while (*curr != '\0') {
-		if (isspace(*curr)) {
-			*curr = '\0';
-			token_started = false;
-		} else {
-			if (!token_started) {
-				tokens[*nr_tokens] = curr;
-				*nr_tokens += 1;
-				token_started = true;
-			}
-		}
+	unsigned char *curr = (unsigned char *)command;
+	int nr = 0;
 
-		curr++;
-	}
+	while (nr < MAX_NR_TOKENS) {
+		unsigned char *start;
+		unsigned char class;
+
+		while (char_class[*curr] & CH_SPACE) curr++;
 
-	for (int i = 0; i < *nr_tokens; i++) {
-		if (strncmp(tokens[i], "#", strlen("#")) == 0) {
-			*nr_tokens = i;
-			tokens[i] = NULL;
-			break;
+		/* The rest of the line is a comment */
+		if (char_class[*curr] & (CH_END | CH_COMMENT)) break;
+
+		start = curr;
+		while (!((class = char_class[*curr]) & (CH_SPACE | CH_END))) {
+			if (class & CH_UPPER) *curr += 'a' - 'A';
+			curr++;
 		}
+		tokens[nr].str = (char *)start;
+		tokens[nr].len = curr - start;
+		nr++;
+
+		if (class & CH_END) break;
+		*curr++ = '\0';
 	}
+	*nr_tokens = nr;
 
-	return (*nr_tokens > 0);
+	return (nr > 0);
 }
@@ -21,23 +21,30 @@
 #define MAX_COMMAND_LEN	4096 /* Maximum length of assembly string */
 
 
+struct token {
+	char *str;		/* Points into the command, terminated with '\0' */
+	unsigned int len;
+};
+
 /***********************************************************************
  * parse_command()
  *
  * DESCRIPTION
- *  Parse @command, and put each command token into @tokens[] and the number of
- *  tokes into @nr_tokens. You may use this implemention or your own from PA0.
+ *  Parse @command in a single pass, and put each command token into @tokens[]
+ *  and the number of tokens into @nr_tokens. The tokens are not copied; they
+ *  are terminated in place in @command and made lowercase.
  *
  *  A command token is defined as a string without any whitespace (i.e., *space*
- *  and *tab* in this programming assignment). For exmaple,
- *   command = "  cp  -pr /home/sslab   /path/to/dest  "
+ *  and *tab* in this programming assignment). A token starting with '#'
+ *  comments out the rest of @command. At most MAX_NR_TOKENS tokens are taken.
+ *  For exmaple,
+ *   command = "  cp  -pr /home/sslab   /path/to/dest  # copy"
  *
  *  then, nr_tokens = 4, and tokens is
- *    tokens[0] = "cp"
- *    tokens[1] = "-pr"
- *    tokens[2] = "/home/sslab"
- *    tokens[3] = "/path/to/dest"
- *    tokens[>=4] = NULL
+ *    tokens[0] = { "cp", 2 }
+ *    tokens[1] = { "-pr", 3 }
+ *    tokens[2] = { "/home/sslab", 11 }
+ *    tokens[3] = { "/path/to/dest", 13 }
  *
  *
  * RETURN VALUE
@@ -45,6 +52,6 @@
  *  Return 0 otherwise
  *
  */
-int parse_command(char *command, int *nr_tokens, char *tokens[]);
+int parse_command(char *command, int *nr_tokens, struct token tokens[]);
 
 #endif
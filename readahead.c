@@ -0,0 +1,80 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "readahead.h"
+
+int readahead_init(struct readahead *ra, unsigned int window,
+		unsigned int max_pages, unsigned int nr_frames)
+{
+	memset(ra, 0x00, sizeof(*ra));
+
+	if (!window) return 0;
+
+	ra->window = window;
+	ra->max_pages = max_pages;
+	ra->nr_frames = nr_frames;
+
+	ra->speculative = calloc(nr_frames, sizeof(*ra->speculative));
+	if (!ra->speculative) return -1;
+
+	return 0;
+}
+
+void readahead_fini(struct readahead *ra)
+{
+	free(ra->speculative);
+	ra->speculative = NULL;
+}
+
+void readahead_window(struct readahead *ra, struct readahead_state *state,
+		unsigned int vpn, unsigned int nr_ptes,
+		unsigned int *start, unsigned int *end)
+{
+	unsigned int limit = (vpn & ~(nr_ptes - 1)) + nr_ptes;
+
+	if (state->primed && vpn == state->next_vpn) {
+		unsigned int size = state->size ? state->size * 2 : ra->window * 2;
+
+		state->size = size < ra->max_pages ? size : ra->max_pages;
+		ra->nr_sequential++;
+	} else {
+		state->size = 0;
+	}
+
+	*start = vpn & ~(ra->window - 1);
+	*end = *start + ra->window;
+	if (vpn + state->size > *end) *end = vpn + state->size;
+	if (*end > limit) *end = limit;
+}
+
+void readahead_show(struct readahead *ra, FILE *fp)
+{
+	unsigned long nr_pending = ra->nr_mapped - ra->nr_hits - ra->nr_wasted;
+
+	fprintf(fp, "Fault-around\n");
+	fprintf(fp, "  window    : %u pages, read ahead up to %u pages\n",
+			ra->window, ra->max_pages);
+	fprintf(fp, "  sequential: %lu faults\n", ra->nr_sequential);
+	fprintf(fp, "  mapped    : %lu pages ahead of accesses\n", ra->nr_mapped);
+	fprintf(fp, "  avoided   : %lu faults\n", ra->nr_hits);
+	fprintf(fp, "  wasted    : %lu frames freed without access\n",
+			ra->nr_wasted);
+	fprintf(fp, "  pending   : %lu pages not accessed yet\n\n", nr_pending);
+}
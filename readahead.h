@@ -0,0 +1,153 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __READAHEAD_H__
+#define __READAHEAD_H__
+
+#include <stdio.h>
+
+#include "types.h"
+
+/**
+ * Fault-around and readahead
+ *
+ * A demand fault on an invalid PTE maps the neighbouring VPNs as well, so
+ * that the accesses to them do not fault. The VPNs mapped on a fault are
+ * the aligned block of @window pages around the faulting VPN and, when the
+ * process faults where the previous fault left off, the readahead window
+ * following the faulting VPN. The readahead window of a process starts at
+ * twice @window and doubles on each sequential fault up to @max_pages. It
+ * drops to zero on the first fault off the sequence.
+ *
+ * The pages are mapped only within the pte_directory of the faulting VPN,
+ * only for the VPNs neither mapped nor swapped out, and only onto free
+ * frames. Nothing is evicted for them.
+ *
+ * The frames mapped ahead are marked until they are accessed, which counts
+ * a fault avoided, or freed, which counts a frame wasted.
+ */
+struct readahead {
+	unsigned int window;		/* Pages around a fault, 0 if disabled */
+	unsigned int max_pages;		/* Upper bound of the readahead window */
+
+	unsigned int nr_frames;
+	bool *speculative;		/* Frames mapped ahead and not accessed */
+
+	unsigned long nr_sequential;	/* Faults found sequential */
+	unsigned long nr_mapped;	/* Pages mapped ahead of accesses */
+	unsigned long nr_hits;		/* Faults avoided */
+	unsigned long nr_wasted;	/* Freed without being accessed */
+};
+
+/* Readahead state of a process */
+struct readahead_state {
+	unsigned int next_vpn;		/* Where a sequential fault comes next */
+	unsigned int size;		/* Readahead window, 0 if not sequential */
+	bool primed;			/* @next_vpn is valid */
+};
+
+/***********************************************************************
+ * readahead_init()
+ *
+ * DESCRIPTION
+ *   Map @window pages around each demand fault, and read ahead up to
+ *   @max_pages pages on sequential faults, for @nr_frames page frames.
+ *   Nothing is mapped ahead if @window is 0.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 on memory shortage
+ */
+int readahead_init(struct readahead *ra, unsigned int window,
+		unsigned int max_pages, unsigned int nr_frames);
+void readahead_fini(struct readahead *ra);
+
+static inline bool readahead_enabled(struct readahead *ra)
+{
+	return ra->window > 0;
+}
+
+/***********************************************************************
+ * readahead_window()
+ *
+ * DESCRIPTION
+ *   Update @state for the demand fault at @vpn, and get the VPNs to map for
+ *   the fault in [@start, @end). The range stays in the aligned block of
+ *   @nr_ptes VPNs, that is, in the pte_directory of @vpn. Tell where the
+ *   mapping stopped with readahead_done() afterwards.
+ */
+void readahead_window(struct readahead *ra, struct readahead_state *state,
+		unsigned int vpn, unsigned int nr_ptes,
+		unsigned int *start, unsigned int *end);
+
+/* The VPNs below @end are mapped for the last fault of @state */
+static inline void readahead_done(struct readahead_state *state,
+		unsigned int end)
+{
+	state->next_vpn = end;
+	state->primed = true;
+}
+
+/* @pfn is mapped ahead of the accesses */
+static inline void readahead_mark(struct readahead *ra, unsigned int pfn)
+{
+	ra->speculative[pfn] = true;
+	ra->nr_mapped++;
+}
+
+static inline bool readahead_speculative(struct readahead *ra,
+		unsigned int pfn)
+{
+	return ra->speculative && ra->speculative[pfn];
+}
+
+/**
+ * @pfn is accessed. Called on each access without mm_lock() when the
+ * translation hits the TLB, so the first access claims the mark atomically.
+ */
+static inline void readahead_hit(struct readahead *ra, unsigned int pfn)
+{
+	if (!readahead_speculative(ra, pfn)) return;
+
+	if (__atomic_exchange_n(&ra->speculative[pfn], false, __ATOMIC_RELAXED)) {
+		__atomic_fetch_add(&ra->nr_hits, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/* @pfn is freed. Should be called when the frame gets back free */
+static inline void readahead_drop_frame(struct readahead *ra, unsigned int pfn)
+{
+	if (!readahead_speculative(ra, pfn)) return;
+
+	if (__atomic_exchange_n(&ra->speculative[pfn], false, __ATOMIC_RELAXED)) {
+		__atomic_fetch_add(&ra->nr_wasted, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/* The page in @from moves to @to */
+static inline void readahead_move(struct readahead *ra, unsigned int from,
+		unsigned int to)
+{
+	if (!ra->speculative) return;
+
+	ra->speculative[to] = ra->speculative[from];
+	ra->speculative[from] = false;
+}
+
+/**
+ * Print the counters.
+ */
+void readahead_show(struct readahead *ra, FILE *fp);
+
+#endif
@@ -0,0 +1,321 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "reclaim.h"
+
+#define list_head(r, list)	((r)->nr_frames + (list))
+
+static inline bool __list_empty(struct reclaim *r, unsigned int list)
+{
+	return r->next[list_head(r, list)] == list_head(r, list);
+}
+
+static void __list_add_tail(struct reclaim *r, unsigned int pfn, unsigned int list)
+{
+	unsigned int head = list_head(r, list);
+	unsigned int last = r->prev[head];
+
+	r->next[pfn] = head;
+	r->prev[pfn] = last;
+	r->next[last] = pfn;
+	r->prev[head] = pfn;
+
+	r->on_list[pfn] = list + 1;
+	r->list_size[list]++;
+}
+
+static void __list_del(struct reclaim *r, unsigned int pfn)
+{
+	r->next[r->prev[pfn]] = r->next[pfn];
+	r->prev[r->next[pfn]] = r->prev[pfn];
+
+	r->list_size[r->on_list[pfn] - 1]--;
+	r->on_list[pfn] = 0;
+}
+
+static inline unsigned int __list_first(struct reclaim *r, unsigned int list)
+{
+	return r->next[list_head(r, list)];
+}
+
+/**
+ * Clear the reference bit of @pfn, and tell whether it was set. TLB hits set
+ * the bits without mm_lock(), so they are accessed atomically here too.
+ */
+static inline bool __test_and_clear_referenced(struct reclaim *r, unsigned int pfn)
+{
+	return __atomic_exchange_n(&r->referenced[pfn], false, __ATOMIC_RELAXED);
+}
+
+static inline bool __eligible(struct reclaim *r, unsigned int pfn)
+{
+	return !r->eligible || r->eligible(pfn, r->eligible_arg);
+}
+
+/* The oldest eligible frame in @list */
+static long __first_eligible(struct reclaim *r, unsigned int list)
+{
+	unsigned int head = list_head(r, list);
+
+	for (unsigned int pfn = r->next[head]; pfn != head; pfn = r->next[pfn]) {
+		if (__eligible(r, pfn)) return pfn;
+	}
+	return -1;
+}
+
+
+/**
+ * FIFO: evict the frame allocated first
+ */
+static void fifo_add(struct reclaim *r, unsigned int pfn)
+{
+	__list_add_tail(r, pfn, RECLAIM_LIST_INACTIVE);
+}
+
+static void fifo_del(struct reclaim *r, unsigned int pfn)
+{
+	if (r->on_list[pfn]) __list_del(r, pfn);
+}
+
+static long fifo_select_victim(struct reclaim *r)
+{
+	return __first_eligible(r, RECLAIM_LIST_INACTIVE);
+}
+
+/**
+ * CLOCK: FIFO giving a second chance to the referenced frames
+ */
+static long __clock_select(struct reclaim *r, unsigned int list)
+{
+	/* Two rounds at most, since the first one clears the reference bits */
+	for (unsigned int i = 0; i < r->list_size[list] * 2; i++) {
+		unsigned int pfn = __list_first(r, list);
+
+		/* Take the frame unless it is referenced, clearing the bit */
+		if (__eligible(r, pfn) && !__test_and_clear_referenced(r, pfn)) {
+			return pfn;
+		}
+
+		/* Advance the hand */
+		__list_del(r, pfn);
+		__list_add_tail(r, pfn, list);
+	}
+	return -1;
+}
+
+static long clock_select_victim(struct reclaim *r)
+{
+	return __clock_select(r, RECLAIM_LIST_INACTIVE);
+}
+
+/**
+ * LRU approximation with aging. On every eviction, the age of each frame is
+ * shifted right with the reference bit at the top, and the frame with the
+ * smallest age is chosen. It takes O(n) for each eviction.
+ */
+static void lru_add(struct reclaim *r, unsigned int pfn)
+{
+	r->ages[pfn] = 0;
+	__list_add_tail(r, pfn, RECLAIM_LIST_INACTIVE);
+}
+
+static long lru_select_victim(struct reclaim *r)
+{
+	unsigned int head = list_head(r, RECLAIM_LIST_INACTIVE);
+	long victim = -1;
+
+	for (unsigned int pfn = r->next[head]; pfn != head; pfn = r->next[pfn]) {
+		r->ages[pfn] = (r->ages[pfn] >> 1) |
+				(__test_and_clear_referenced(r, pfn) ? 0x80 : 0);
+
+		if (!__eligible(r, pfn)) continue;
+		if (victim < 0 || r->ages[pfn] < r->ages[victim]) victim = pfn;
+	}
+	return victim;
+}
+
+/**
+ * Simplified 2Q. New frames go to the A1 queue. Frames referenced while in A1
+ * are promoted to the Am queue when they reach the end of A1. Victims are
+ * taken from A1 while A1 holds more than 1/4 of frames, and from Am with
+ * CLOCK otherwise. So frames touched once cannot flush out the hot ones.
+ */
+static long twoq_select_victim(struct reclaim *r)
+{
+	unsigned int head = list_head(r, RECLAIM_LIST_INACTIVE);
+	unsigned int pfn = r->next[head];
+	long victim;
+
+	while (pfn != head &&
+			(r->list_size[RECLAIM_LIST_INACTIVE] > r->nr_frames / 4 ||
+			 __list_empty(r, RECLAIM_LIST_ACTIVE))) {
+		unsigned int next = r->next[pfn];
+
+		if (__eligible(r, pfn)) {
+			if (!__test_and_clear_referenced(r, pfn)) return pfn;
+
+			__list_del(r, pfn);
+			__list_add_tail(r, pfn, RECLAIM_LIST_ACTIVE);
+		}
+		pfn = next;
+	}
+
+	victim = __clock_select(r, RECLAIM_LIST_ACTIVE);
+	if (victim >= 0) return victim;
+
+	/* Am has no eligible frame. Take one from A1 regardless of its size */
+	return __first_eligible(r, RECLAIM_LIST_INACTIVE);
+}
+
+
+static struct reclaim_policy policies[] = {
+	{
+		.name = "fifo",
+		.description = "First-in, first-out",
+		.add = fifo_add,
+		.del = fifo_del,
+		.select_victim = fifo_select_victim,
+	},
+	{
+		.name = "clock",
+		.description = "Second chance with reference bits",
+		.add = fifo_add,
+		.del = fifo_del,
+		.select_victim = clock_select_victim,
+	},
+	{
+		.name = "lru",
+		.description = "LRU approximation with 8-bit aging",
+		.add = lru_add,
+		.del = fifo_del,
+		.select_victim = lru_select_victim,
+	},
+	{
+		.name = "2q",
+		.description = "Simplified 2Q with A1 and Am queues",
+		.add = fifo_add,
+		.del = fifo_del,
+		.select_victim = twoq_select_victim,
+	},
+};
+
+#define NR_POLICIES	(sizeof(policies) / sizeof(*policies))
+
+static struct reclaim_policy *__find_policy(const char *name)
+{
+	for (int i = 0; i < NR_POLICIES; i++) {
+		if (strcmp(policies[i].name, name) == 0) return policies + i;
+	}
+	return NULL;
+}
+
+bool reclaim_policy_exists(const char *name)
+{
+	return __find_policy(name) != NULL;
+}
+
+int reclaim_init(struct reclaim *r, const char *name, unsigned int nr_pageframes)
+{
+	memset(r, 0x00, sizeof(*r));
+
+	r->policy = __find_policy(name);
+	if (!r->policy) return -1;
+
+	r->nr_frames = nr_pageframes;
+	r->next = malloc(sizeof(*r->next) * (r->nr_frames + NR_RECLAIM_LISTS));
+	r->prev = malloc(sizeof(*r->prev) * (r->nr_frames + NR_RECLAIM_LISTS));
+	r->on_list = calloc(r->nr_frames, sizeof(*r->on_list));
+	r->ages = calloc(r->nr_frames, sizeof(*r->ages));
+	r->referenced = calloc(r->nr_frames, sizeof(*r->referenced));
+
+	if (!r->next || !r->prev || !r->on_list || !r->ages || !r->referenced) {
+		reclaim_fini(r);
+		return -1;
+	}
+
+	for (unsigned int i = 0; i < NR_RECLAIM_LISTS; i++) {
+		r->next[list_head(r, i)] = r->prev[list_head(r, i)] = list_head(r, i);
+	}
+	return 0;
+}
+
+void reclaim_fini(struct reclaim *r)
+{
+	free(r->next);
+	free(r->prev);
+	free(r->on_list);
+	free(r->ages);
+	free(r->referenced);
+
+	r->next = r->prev = NULL;
+	r->on_list = r->ages = NULL;
+	r->referenced = NULL;
+	r->policy = NULL;
+}
+
+void reclaim_add(struct reclaim *r, unsigned int pfn)
+{
+	if (!r->policy) return;
+
+	__atomic_store_n(&r->referenced[pfn], false, __ATOMIC_RELAXED);
+	r->policy->add(r, pfn);
+}
+
+void reclaim_del(struct reclaim *r, unsigned int pfn)
+{
+	if (!r->policy) return;
+
+	r->policy->del(r, pfn);
+}
+
+long reclaim_select_victim(struct reclaim *r)
+{
+	if (!r->policy) return -1;
+
+	return r->policy->select_victim(r);
+}
+
+long reclaim_select_victim_if(struct reclaim *r,
+		bool (*eligible)(unsigned int pfn, void *arg), void *arg)
+{
+	long victim;
+
+	if (!r->policy) return -1;
+
+	r->eligible = eligible;
+	r->eligible_arg = arg;
+	victim = r->policy->select_victim(r);
+	r->eligible = NULL;
+	r->eligible_arg = NULL;
+
+	return victim;
+}
+
+const char *reclaim_policy_name(struct reclaim *r)
+{
+	return r->policy ? r->policy->name : "none";
+}
+
+void reclaim_print_policies(void)
+{
+	for (int i = 0; i < NR_POLICIES; i++) {
+		printf("      %-6s: %s\n", policies[i].name, policies[i].description);
+	}
+}
@@ -0,0 +1,120 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __RECLAIM_H__
+#define __RECLAIM_H__
+
+#include "types.h"
+
+struct reclaim;
+
+/**
+ * Page replacement policy
+ *
+ * A policy tracks the page frames in use, and picks a victim frame to evict
+ * when the system runs out of free frames. Policies can make use of the
+ * reference bit of each frame, which is set by MMU on every successful
+ * translation and cleared by the policies.
+ */
+struct reclaim_policy {
+	const char *name;
+	const char *description;
+
+	/* The page frame @pfn is in use / becomes free */
+	void (*add)(struct reclaim *r, unsigned int pfn);
+	void (*del)(struct reclaim *r, unsigned int pfn);
+
+	/* Return the frame to evict, or -1 if no frame is in use */
+	long (*select_victim)(struct reclaim *r);
+};
+
+/**
+ * Frame lists
+ *
+ * Page frames are chained in doubly-linked lists indexed by pfn. The list
+ * heads are placed after the last frame, so @next[nr_frames + list] is the
+ * first (oldest) frame and @prev[nr_frames + list] is the last (youngest)
+ * frame of @list.
+ */
+enum {
+	RECLAIM_LIST_INACTIVE = 0,	/* FIFO, CLOCK, LRU, and A1 of 2Q */
+	RECLAIM_LIST_ACTIVE,		/* Am of 2Q */
+	NR_RECLAIM_LISTS,
+};
+
+/**
+ * Replacement state of a system. Disabled when @policy is NULL.
+ */
+struct reclaim {
+	struct reclaim_policy *policy;
+
+	unsigned int nr_frames;
+	unsigned int *next;
+	unsigned int *prev;
+	unsigned char *on_list;		/* list + 1, 0 if not on any list */
+	unsigned int list_size[NR_RECLAIM_LISTS];
+
+	unsigned char *ages;		/* For LRU approximation */
+
+	bool *referenced;		/* Reference bits for each page frame */
+
+	/* The frames to choose the victim from, or NULL for all frames */
+	bool (*eligible)(unsigned int pfn, void *arg);
+	void *eligible_arg;
+};
+
+/* Called on TLB hits without mm_lock() in the SMP mode */
+static inline void reclaim_mark_referenced(struct reclaim *r, unsigned int pfn)
+{
+	if (r->referenced) {
+		__atomic_store_n(&r->referenced[pfn], true, __ATOMIC_RELAXED);
+	}
+}
+
+/***********************************************************************
+ * reclaim_init()
+ *
+ * DESCRIPTION
+ *   Set up @r with the replacement policy @name for @nr_pageframes frames.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 if @name is unknown or on memory shortage
+ */
+int reclaim_init(struct reclaim *r, const char *name, unsigned int nr_pageframes);
+void reclaim_fini(struct reclaim *r);
+bool reclaim_policy_exists(const char *name);
+
+void reclaim_add(struct reclaim *r, unsigned int pfn);
+void reclaim_del(struct reclaim *r, unsigned int pfn);
+long reclaim_select_victim(struct reclaim *r);
+
+/***********************************************************************
+ * reclaim_select_victim_if()
+ *
+ * DESCRIPTION
+ *   Pick the victim as reclaim_select_victim() does, but only among the frames
+ *   that @eligible returns @true for. The hand of the policy moves on over the
+ *   other frames without touching their reference bits.
+ *
+ * RETURN VALUE
+ *   The frame to evict, or -1 if no eligible frame is in use
+ */
+long reclaim_select_victim_if(struct reclaim *r,
+		bool (*eligible)(unsigned int pfn, void *arg), void *arg);
+
+const char *reclaim_policy_name(struct reclaim *r);
+void reclaim_print_policies(void);
+
+#endif
@@ -0,0 +1,199 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "rmap.h"
+#include "slab.h"
+
+int rmap_init(struct vm_sim *sim)
+{
+	sim->rmaps = malloc(sizeof(*sim->rmaps) * NR_PAGEFRAMES);
+	if (!sim->rmaps) {
+		fprintf(stderr, "Unable to initialize the reverse mapping\n");
+		return -1;
+	}
+	for (unsigned int i = 0; i < NR_PAGEFRAMES; i++) {
+		INIT_LIST_HEAD(&sim->rmaps[i]);
+	}
+
+	kmem_cache_init(&sim->rmap_cache, "rmap_item",
+			sizeof(struct rmap_item), &sim->slab_caches);
+	kmem_cache_init(&sim->sharer_cache, "pt_sharer",
+			sizeof(struct pt_sharer), &sim->slab_caches);
+	return 0;
+}
+
+void rmap_fini(struct vm_sim *sim)
+{
+	if (!sim->rmaps) return;
+
+	kmem_cache_destroy(&sim->sharer_cache);
+	kmem_cache_destroy(&sim->rmap_cache);
+
+	free(sim->rmaps);
+	sim->rmaps = NULL;
+}
+
+void rmap_add(struct vm_sim *sim, unsigned int pfn, void *entry,
+		unsigned int index)
+{
+	struct rmap_item *item = kmem_cache_alloc(&sim->rmap_cache);
+
+	item->entry = entry;
+	item->index = index;
+	list_add_tail(&item->list, &sim->rmaps[pfn]);
+}
+
+void rmap_del(struct vm_sim *sim, unsigned int pfn, void *entry,
+		unsigned int index)
+{
+	struct rmap_item *item;
+
+	for_each_rmap(sim, pfn, item) {
+		if (item->entry != entry || item->index != index) continue;
+
+		list_del(&item->list);
+		kmem_cache_free(&sim->rmap_cache, item);
+		return;
+	}
+	assert(!"No rmap for the PTE");
+}
+
+void sharer_add(struct vm_sim *sim, struct list_head *sharers,
+		struct process *p)
+{
+	struct pt_sharer *s = kmem_cache_alloc(&sim->sharer_cache);
+
+	s->process = p;
+	list_add_tail(&s->list, sharers);
+}
+
+void sharer_del(struct vm_sim *sim, struct list_head *sharers,
+		struct process *p)
+{
+	struct pt_sharer *s;
+
+	list_for_each_entry(s, sharers, list) {
+		if (s->process != p) continue;
+
+		list_del(&s->list);
+		kmem_cache_free(&sim->sharer_cache, s);
+		return;
+	}
+	assert(!"Not a sharer of the directory");
+}
+
+/* The first page frame of the block that a huge PTE maps @pfn with */
+static inline unsigned int __huge_head(struct vm_sim *sim, unsigned int pfn)
+{
+	return pfn & ~(NR_PTES_PER_PAGE - 1);
+}
+
+unsigned int rmap_nr_processes(struct vm_sim *sim, unsigned int pfn)
+{
+	struct rmap_item *item;
+	unsigned int nr = 0;
+
+	for_each_rmap(sim, pfn, item) {
+		if (pt_huge(item->entry)) continue;
+		nr += ((struct pte_directory *)item->entry)->refcount;
+	}
+
+	if (!sim->thp) return nr;
+
+	for_each_rmap(sim, __huge_head(sim, pfn), item) {
+		if (!pt_huge(item->entry)) continue;
+		nr += pt_to_huge(item->entry)->refcount;
+	}
+	return nr;
+}
+
+static inline void __account_sharers(struct list_head *sharers, int sign,
+		bool shared)
+{
+	struct pt_sharer *s;
+
+	list_for_each_entry(s, sharers, list) {
+		s->process->rss.resident += sign;
+		if (shared) s->process->rss.shared += sign;
+	}
+}
+
+void rmap_account_rss(struct vm_sim *sim, unsigned int pfn, int sign)
+{
+	bool shared = rmap_nr_processes(sim, pfn) > 1;
+	struct rmap_item *item;
+
+	for_each_rmap(sim, pfn, item) {
+		if (pt_huge(item->entry)) continue;
+		__account_sharers(&((struct pte_directory *)item->entry)->sharers,
+				sign, shared);
+	}
+
+	if (!sim->thp) return;
+
+	for_each_rmap(sim, __huge_head(sim, pfn), item) {
+		if (!pt_huge(item->entry)) continue;
+		__account_sharers(&pt_to_huge(item->entry)->sharers, sign, shared);
+	}
+}
+
+void rmap_show(struct vm_sim *sim, unsigned int pfn)
+{
+	FILE *fp = sim->output.fp;
+	struct rmap_item *item;
+	struct pt_sharer *s;
+
+	if (pfn >= NR_PAGEFRAMES) {
+		fprintf(fp, "No pfn %u\n", pfn);
+		return;
+	}
+
+	fprintf(fp, "\n*** PFN %u ***\n", pfn);
+
+	for_each_rmap(sim, pfn, item) {
+		struct pte_directory *pd = item->entry;
+		struct pte *pte;
+
+		if (pt_huge(item->entry)) continue;
+
+		pte = &pd->ptes[item->index];
+		list_for_each_entry(s, &pd->sharers, list) {
+			fprintf(fp, "pid %-3u vpn %-3u v%c\n", s->process->pid,
+					pd->vpn + item->index,
+					pte_writable(pd, pte) ? 'w' : ' ');
+		}
+	}
+
+	if (!sim->thp) return;
+
+	for_each_rmap(sim, __huge_head(sim, pfn), item) {
+		struct huge_pte *h = pt_to_huge(item->entry);
+
+		if (!pt_huge(item->entry)) continue;
+
+		list_for_each_entry(s, &h->sharers, list) {
+			fprintf(fp, "pid %-3u vpn %-3u h%c\n", s->process->pid,
+					h->vpn + pfn - pte_pfn(&h->pte),
+					huge_pte_writable(h) ? 'w' : ' ');
+		}
+	}
+}
@@ -0,0 +1,94 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __RMAP_H__
+#define __RMAP_H__
+
+#include "types.h"
+#include "list_head.h"
+
+struct vm_sim;
+struct process;
+
+/**
+ * Reverse mapping
+ *
+ * Each page frame has a chain of rmap items, one for each PTE mapping the
+ * frame. An item points to the pte_directory holding the PTE, or to the huge
+ * PTE mapping the block of the frame. Huge PTEs are chained to the first frame
+ * of the block. Since a directory can be shared by several processes after
+ * fork, each directory and huge PTE lists the processes pointing to it in its
+ * @sharers. So the processes and VPNs mapping a frame are found by following
+ * the chain and the sharers, without walking any page table.
+ */
+struct rmap_item {
+	void *entry;		/* pte_directory, or huge PTE tagged with PT_HUGE */
+	unsigned int index;	/* Index of the PTE in the pte_directory */
+	struct list_head list;	/* Chained in the rmap of the page frame */
+};
+
+struct pt_sharer {
+	struct process *process;
+	struct list_head list;	/* Chained in @sharers of the directory */
+};
+
+#define for_each_rmap(sim, pfn, item)	\
+	list_for_each_entry(item, &(sim)->rmaps[pfn], list)
+
+#define for_each_rmap_safe(sim, pfn, item, n)	\
+	list_for_each_entry_safe(item, n, &(sim)->rmaps[pfn], list)
+
+/***********************************************************************
+ * rmap_init()
+ *
+ * DESCRIPTION
+ *   Set up an empty rmap chain for each page frame of @sim.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 on memory shortage
+ */
+int rmap_init(struct vm_sim *sim);
+void rmap_fini(struct vm_sim *sim);
+
+/**
+ * Add/remove the PTE at @index of @entry to/from the rmap of @pfn
+ */
+void rmap_add(struct vm_sim *sim, unsigned int pfn, void *entry,
+		unsigned int index);
+void rmap_del(struct vm_sim *sim, unsigned int pfn, void *entry,
+		unsigned int index);
+
+/**
+ * Add/remove @p to/from @sharers of a pte_directory or a huge PTE
+ */
+void sharer_add(struct vm_sim *sim, struct list_head *sharers,
+		struct process *p);
+void sharer_del(struct vm_sim *sim, struct list_head *sharers,
+		struct process *p);
+
+/* The number of processes mapping @pfn */
+unsigned int rmap_nr_processes(struct vm_sim *sim, unsigned int pfn);
+
+/**
+ * Add @sign to the resident pages of every process mapping @pfn, and to their
+ * shared pages if more than one mapping. Called with -1 before and +1 after
+ * the mappings of @pfn change, so that the change of both counts out.
+ */
+void rmap_account_rss(struct vm_sim *sim, unsigned int pfn, int sign);
+
+/* Print the processes and VPNs mapping @pfn */
+void rmap_show(struct vm_sim *sim, unsigned int pfn);
+
+#endif
@@ -0,0 +1,142 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "slab.h"
+
+/**
+ * Slab descriptor. Kept apart from the slab so that the objects can start
+ * right at the beginning of the cache-line-aligned memory.
+ */
+struct slab {
+	struct list_head list;
+	void *mem;
+};
+
+void kmem_cache_init(struct kmem_cache *cache, const char *name, size_t size,
+		struct list_head *caches)
+{
+	memset(cache, 0x00, sizeof(*cache));
+
+	cache->name = name;
+	cache->object_size = size;
+
+	if (size < sizeof(void *)) size = sizeof(void *);
+	cache->size = (size + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+
+	cache->objects_per_slab = SLAB_SIZE / cache->size;
+	if (cache->objects_per_slab < SLAB_MIN_OBJECTS) {
+		cache->objects_per_slab = SLAB_MIN_OBJECTS;
+	}
+
+	INIT_LIST_HEAD(&cache->slabs);
+	list_add_tail(&cache->list, caches);
+}
+
+void kmem_cache_destroy(struct kmem_cache *cache)
+{
+	struct slab *slab, *tmp;
+
+	list_for_each_entry_safe(slab, tmp, &cache->slabs, list) {
+		list_del(&slab->list);
+		free(slab->mem);
+		free(slab);
+	}
+	list_del_init(&cache->list);
+
+	cache->freelist = NULL;
+	cache->nr_slabs = 0;
+	cache->nr_active = 0;
+}
+
+/**
+ * Allocate a new slab and put all objects in it into the freelist. Objects
+ * are chained in the address order so that they are handed out in order.
+ */
+static int __grow_cache(struct kmem_cache *cache)
+{
+	struct slab *slab = malloc(sizeof(*slab));
+	char *mem;
+
+	if (!slab) return -1;
+
+	if (posix_memalign(&slab->mem, CACHE_LINE_SIZE,
+				cache->size * cache->objects_per_slab)) {
+		free(slab);
+		return -1;
+	}
+	mem = slab->mem;
+
+	for (int i = cache->objects_per_slab - 1; i >= 0; i--) {
+		void **object = (void **)(mem + cache->size * i);
+
+		*object = cache->freelist;
+		cache->freelist = object;
+	}
+
+	list_add_tail(&slab->list, &cache->slabs);
+	cache->nr_slabs++;
+	return 0;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+	void **object;
+
+	if (!cache->freelist && __grow_cache(cache)) return NULL;
+
+	object = cache->freelist;
+	cache->freelist = *object;
+
+	cache->nr_active++;
+	cache->nr_allocs++;
+
+	memset(object, 0x00, cache->object_size);
+	return object;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *object)
+{
+	if (!object) return;
+
+	*(void **)object = cache->freelist;
+	cache->freelist = object;
+
+	cache->nr_active--;
+	cache->nr_frees++;
+}
+
+void slab_show(struct list_head *caches, FILE *fp)
+{
+	struct kmem_cache *cache;
+
+	fprintf(fp, "%-14s %8s %8s %6s %6s %6s %10s %10s\n",
+			"name", "active", "objs", "size", "/slab", "slabs",
+			"allocs", "frees");
+
+	list_for_each_entry(cache, caches, list) {
+		fprintf(fp, "%-14s %8lu %8lu %6zu %6u %6lu %10lu %10lu\n",
+				cache->name, cache->nr_active,
+				cache->nr_slabs * cache->objects_per_slab,
+				cache->size, cache->objects_per_slab,
+				cache->nr_slabs, cache->nr_allocs, cache->nr_frees);
+	}
+	fprintf(fp, "\n");
+}
@@ -0,0 +1,89 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "types.h"
+#include "list_head.h"
+
+#define CACHE_LINE_SIZE		64
+
+/* Each slab is carved into objects out of this many bytes at least */
+#define SLAB_SIZE		4096
+#define SLAB_MIN_OBJECTS	8
+
+/**
+ * Object cache
+ *
+ * Objects of the same size are carved out of slabs, which are allocated in
+ * bulk and never returned to the system until the cache is destroyed.
+ * Objects are rounded up to the cache line size and start at cache line
+ * boundaries. Freed objects are chained in @freelist through their first word
+ * and handed out again, so once the cache is warm, allocating and freeing
+ * objects does not hit malloc at all.
+ */
+struct kmem_cache {
+	const char *name;
+	size_t object_size;	/* Size requested by the user */
+	size_t size;		/* Size of each object in the slab */
+	unsigned int objects_per_slab;
+
+	void *freelist;
+	struct list_head slabs;
+
+	unsigned long nr_slabs;
+	unsigned long nr_active;	/* Objects being used */
+	unsigned long nr_allocs;
+	unsigned long nr_frees;
+
+	struct list_head list;	/* Chained in the list of all caches */
+};
+
+/***********************************************************************
+ * kmem_cache_init()
+ *
+ * DESCRIPTION
+ *   Set up @cache for objects of @size bytes, and chain it in @caches.
+ */
+void kmem_cache_init(struct kmem_cache *cache, const char *name, size_t size,
+		struct list_head *caches);
+
+/***********************************************************************
+ * kmem_cache_destroy()
+ *
+ * DESCRIPTION
+ *   Release all slabs of @cache to the system. Objects still in use become
+ *   invalid.
+ */
+void kmem_cache_destroy(struct kmem_cache *cache);
+
+/***********************************************************************
+ * kmem_cache_alloc()
+ *
+ * RETURN VALUE
+ *   A zero-filled, cache-line-aligned object
+ *   NULL on memory shortage
+ */
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *object);
+
+/* Print the occupancy of all caches in @caches */
+void slab_show(struct list_head *caches, FILE *fp);
+
+#endif
@@ -0,0 +1,1281 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "cpu.h"
+#include "tlb.h"
+#include "swap.h"
+#include "reclaim.h"
+#include "rmap.h"
+#include "ksm.h"
+#include "snapshot.h"
+
+extern struct process *create_process(struct vm_sim *sim, unsigned int pid,
+		struct process *parent);
+extern void attach_pt_entry(struct vm_sim *sim, struct process *p,
+		unsigned int vpn, void *entry);
+extern void reset_processes(struct vm_sim *sim);
+extern void account_restored_memory(struct vm_sim *sim);
+
+#define CHECKSUM_BASIS	0xcbf29ce484222325ULL
+#define CHECKSUM_PRIME	0x00000100000001b3ULL
+
+/* Continue the 64-bit FNV-1a @sum over @size bytes at @data */
+static uint64_t __checksum(uint64_t sum, const void *data, size_t size)
+{
+	const unsigned char *bytes = data;
+
+	for (size_t i = 0; i < size; i++) {
+		sum = (sum ^ bytes[i]) * CHECKSUM_PRIME;
+	}
+	return sum;
+}
+
+/* Index of a pid or an entry in the snapshot, sorted by @key for lookups */
+struct snapshot_index {
+	uintptr_t key;
+	uint32_t index;
+};
+
+static int __compare_index(const void *a, const void *b)
+{
+	uintptr_t ka = ((const struct snapshot_index *)a)->key;
+	uintptr_t kb = ((const struct snapshot_index *)b)->key;
+
+	return ka < kb ? -1 : ka > kb;
+}
+
+static uint32_t __lookup_index(struct snapshot_index *indices, unsigned int nr,
+		uintptr_t key)
+{
+	struct snapshot_index *found = bsearch(&(struct snapshot_index) {
+			.key = key }, indices, nr, sizeof(*indices), __compare_index);
+
+	return found->index;
+}
+
+/**
+ * Flattened page tables and processes. The slab caches tell how many
+ * objects are in use, so the arrays are sized up front.
+ */
+struct snapshot_builder {
+	struct vm_sim *sim;
+
+	struct process **processes;
+	struct snapshot_process *process_records;
+	unsigned int nr_processes;
+	struct snapshot_index *pids;
+
+	struct snapshot_entry *entries;
+	struct snapshot_index *entry_indices;
+	unsigned int nr_entries;
+
+	struct pte *ptes;
+	unsigned int nr_ptes;
+
+	struct snapshot_mapping *mappings;
+	unsigned int nr_mappings;
+
+	struct snapshot_rmap *rmaps;
+	unsigned int nr_rmaps;
+
+	struct snapshot_group *groups;
+	struct snapshot_index *group_indices;
+	unsigned int nr_groups;
+	uint32_t *charges;
+};
+
+static void __free_builder(struct snapshot_builder *b)
+{
+	free(b->processes);
+	free(b->process_records);
+	free(b->pids);
+	free(b->entries);
+	free(b->entry_indices);
+	free(b->ptes);
+	free(b->mappings);
+	free(b->rmaps);
+	free(b->groups);
+	free(b->group_indices);
+	free(b->charges);
+}
+
+static int __init_builder(struct snapshot_builder *b, struct vm_sim *sim)
+{
+	unsigned long nr_dirs = sim->pte_directory_cache.nr_active;
+	unsigned long nr_huge = sim->thp ? sim->huge_pte_cache.nr_active : 0;
+	unsigned int nr_groups = 0;
+	struct mem_group *g;
+
+	memset(b, 0x00, sizeof(*b));
+	b->sim = sim;
+
+	list_for_each_entry(g, &sim->memcg.groups, list) {
+		nr_groups++;
+	}
+
+	b->processes = malloc(sizeof(*b->processes) * sim->nr_processes);
+	b->process_records = malloc(sizeof(*b->process_records) * sim->nr_processes);
+	b->pids = malloc(sizeof(*b->pids) * sim->nr_processes);
+	b->entries = malloc(sizeof(*b->entries) * (nr_dirs + nr_huge + 1));
+	b->entry_indices = malloc(sizeof(*b->entry_indices) * (nr_dirs + nr_huge + 1));
+	b->ptes = malloc(sizeof(*b->ptes) * (nr_dirs * NR_PTES_PER_PAGE + nr_huge + 1));
+	b->mappings = malloc(sizeof(*b->mappings) * (sim->sharer_cache.nr_active + 1));
+	b->rmaps = malloc(sizeof(*b->rmaps) * (sim->rmap_cache.nr_active + 1));
+	b->groups = malloc(sizeof(*b->groups) * nr_groups);
+	b->group_indices = malloc(sizeof(*b->group_indices) * nr_groups);
+	b->charges = malloc(sizeof(*b->charges) * NR_PAGEFRAMES);
+
+	if (!b->processes || !b->process_records || !b->pids || !b->entries ||
+			!b->entry_indices || !b->ptes || !b->mappings || !b->rmaps ||
+			!b->groups || !b->group_indices || !b->charges) {
+		__free_builder(b);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Line up the memory groups in the creation order, so parents come first,
+ * and find the group charged for each frame.
+ */
+static void __gather_groups(struct snapshot_builder *b)
+{
+	struct vm_sim *sim = b->sim;
+	struct mem_group *g;
+	unsigned int i = 0;
+
+	list_for_each_entry(g, &sim->memcg.groups, list) {
+		b->group_indices[b->nr_groups] = (struct snapshot_index) {
+			.key = (uintptr_t)g,
+			.index = b->nr_groups,
+		};
+		b->nr_groups++;
+	}
+	qsort(b->group_indices, b->nr_groups, sizeof(*b->group_indices),
+			__compare_index);
+
+	list_for_each_entry(g, &sim->memcg.groups, list) {
+		b->groups[i++] = (struct snapshot_group) {
+			.id = g->id,
+			.parent = g->parent ? __lookup_index(b->group_indices,
+					b->nr_groups, (uintptr_t)g->parent) : SNAPSHOT_NONE,
+			.limit = g->limit,
+		};
+	}
+
+	for (unsigned int pfn = 0; pfn < NR_PAGEFRAMES; pfn++) {
+		struct mem_group *owner = memcg_owner(&sim->memcg, pfn);
+
+		b->charges[pfn] = owner ? __lookup_index(b->group_indices,
+				b->nr_groups, (uintptr_t)owner) : SNAPSHOT_NONE;
+	}
+}
+
+/* Line up the processes parents first, in the order of their children lists */
+static void __gather_processes(struct snapshot_builder *b)
+{
+	struct vm_sim *sim = b->sim;
+	struct process *child;
+
+	b->processes[b->nr_processes++] = &sim->init;
+
+	for (unsigned int i = 0; i < b->nr_processes; i++) {
+		struct process *p = b->processes[i];
+		struct snapshot_process *record = b->process_records + i;
+
+		list_for_each_entry(child, &p->children, sibling) {
+			b->processes[b->nr_processes++] = child;
+		}
+		*record = (struct snapshot_process) {
+			.pid = p->pid,
+			.parent = SNAPSHOT_NONE,
+			.exited = p->exited,
+			.numa_node = p->numa.node,
+			.numa_interleave = p->numa.interleave,
+			.group = __lookup_index(b->group_indices, b->nr_groups,
+					(uintptr_t)p->memcg),
+			.readahead = p->readahead,
+		};
+	}
+
+	for (unsigned int i = 0; i < b->nr_processes; i++) {
+		struct process *p = b->processes[i];
+
+		b->pids[i] = (struct snapshot_index) { .key = p->pid, .index = i };
+	}
+	qsort(b->pids, b->nr_processes, sizeof(*b->pids), __compare_index);
+
+	for (unsigned int i = 1; i < b->nr_processes; i++) {
+		b->process_records[i].parent = __lookup_index(b->pids,
+				b->nr_processes, b->processes[i]->parent->pid);
+	}
+}
+
+/**
+ * Store @entry found in the page table of @p. A shared entry is stored once
+ * when its first sharer is visited, along with the mappings of all sharers.
+ */
+static void __gather_entry(struct snapshot_builder *b, struct process *p,
+		void *entry)
+{
+	struct vm_sim *sim = b->sim;
+	struct snapshot_entry *e = b->entries + b->nr_entries;
+	struct list_head *sharers;
+	struct pt_sharer *s;
+
+	if (pt_huge(entry)) {
+		struct huge_pte *h = pt_to_huge(entry);
+
+		sharers = &h->sharers;
+		if (list_first_entry(sharers, struct pt_sharer, list)->process != p) {
+			return;
+		}
+		*e = (struct snapshot_entry) {
+			.vpn = h->vpn, .huge = true, .pte = b->nr_ptes,
+		};
+		b->ptes[b->nr_ptes++] = h->pte;
+	} else {
+		struct pte_directory *pd = entry;
+
+		sharers = &pd->sharers;
+		if (list_first_entry(sharers, struct pt_sharer, list)->process != p) {
+			return;
+		}
+		*e = (struct snapshot_entry) {
+			.vpn = pd->vpn, .huge = false, .pte = b->nr_ptes,
+		};
+		memcpy(b->ptes + b->nr_ptes, pd->ptes,
+				sizeof(struct pte) * NR_PTES_PER_PAGE);
+		b->nr_ptes += NR_PTES_PER_PAGE;
+	}
+
+	list_for_each_entry(s, sharers, list) {
+		b->mappings[b->nr_mappings++] = (struct snapshot_mapping) {
+			.process = __lookup_index(b->pids, b->nr_processes,
+					s->process->pid),
+			.entry = b->nr_entries,
+		};
+	}
+
+	b->entry_indices[b->nr_entries] = (struct snapshot_index) {
+		.key = (uintptr_t)entry,
+		.index = b->nr_entries,
+	};
+	b->nr_entries++;
+}
+
+static void __gather_table(struct snapshot_builder *b, struct process *p,
+		void **table, unsigned int level)
+{
+	struct vm_sim *sim = b->sim;
+
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		if (!table[i]) continue;
+
+		if (level == NR_PT_LEVELS - 2) {
+			__gather_entry(b, p, table[i]);
+		} else {
+			__gather_table(b, p, table[i], level + 1);
+		}
+	}
+}
+
+static void __gather_rmaps(struct snapshot_builder *b)
+{
+	struct vm_sim *sim = b->sim;
+	struct rmap_item *item;
+
+	qsort(b->entry_indices, b->nr_entries, sizeof(*b->entry_indices),
+			__compare_index);
+
+	for (unsigned int pfn = 0; pfn < NR_PAGEFRAMES; pfn++) {
+		for_each_rmap(sim, pfn, item) {
+			b->rmaps[b->nr_rmaps++] = (struct snapshot_rmap) {
+				.pfn = pfn,
+				.entry = __lookup_index(b->entry_indices, b->nr_entries,
+						(uintptr_t)item->entry),
+				.index = item->index,
+			};
+		}
+	}
+}
+
+static int __write_section(FILE *fp, struct snapshot_header *header,
+		enum snapshot_section_id id, const void *data,
+		size_t entry_size, size_t nr_entries)
+{
+	static const char padding[8];
+	long pos = ftell(fp);
+	long pad = (8 - pos % 8) % 8;
+
+	if (pos < 0) return -1;
+	if (pad && fwrite(padding, pad, 1, fp) != 1) return -1;
+	header->checksum = __checksum(header->checksum, padding, pad);
+
+	header->sections[id] = (struct snapshot_section) {
+		.offset = pos + pad,
+		.entry_size = entry_size,
+		.nr_entries = nr_entries,
+	};
+	if (nr_entries && fwrite(data, entry_size, nr_entries, fp) != nr_entries) {
+		return -1;
+	}
+	header->checksum = __checksum(header->checksum, data, entry_size * nr_entries);
+	return 0;
+}
+
+static int __write_sections(struct vm_sim *sim, struct snapshot_builder *b,
+		struct snapshot_header *header, FILE *fp)
+{
+	struct swap_area *swap = &sim->swap;
+	struct reclaim *r = &sim->reclaim;
+	struct snapshot_cpu cpus[MAX_NR_CPUS];
+	unsigned int *runqueue = NULL;
+	struct swap_slot *slots = NULL;
+	struct tlb_entry *tlb_entries = NULL;
+	unsigned int nr_runqueue = 0;
+	unsigned int nr_tlb_entries = sim->cpus->tlb.nr_sets * sim->cpus->tlb.nr_ways;
+	uint64_t checksum;
+	struct process *p;
+	struct cpu *cpu;
+	int ret = -1;
+
+	runqueue = malloc(sizeof(*runqueue) * b->nr_processes);
+	tlb_entries = malloc(sizeof(*tlb_entries) * (nr_tlb_entries * sim->nr_cpus + 1));
+	if (!runqueue || !tlb_entries) goto out_free;
+
+	list_for_each_entry(p, &sim->processes, list) {
+		runqueue[nr_runqueue++] = __lookup_index(b->pids, b->nr_processes, p->pid);
+	}
+
+	for_each_cpu(sim, cpu) {
+		cpus[cpu->id] = (struct snapshot_cpu) {
+			.curr = cpu->curr ? __lookup_index(b->pids, b->nr_processes,
+					cpu->curr->pid) : SNAPSHOT_NONE,
+			.tlb_seed = cpu->tlb.seed,
+			.tlb_clock = cpu->tlb.clock,
+		};
+		if (nr_tlb_entries) {
+			memcpy(tlb_entries + nr_tlb_entries * cpu->id, cpu->tlb.entries,
+					sizeof(*tlb_entries) * nr_tlb_entries);
+		}
+	}
+
+	if (__write_section(fp, header, SNAPSHOT_PROCESSES, b->process_records,
+				sizeof(*b->process_records), b->nr_processes) ||
+			__write_section(fp, header, SNAPSHOT_RUNQUEUE, runqueue,
+				sizeof(*runqueue), nr_runqueue) ||
+			__write_section(fp, header, SNAPSHOT_CPUS, cpus,
+				sizeof(*cpus), sim->nr_cpus) ||
+			__write_section(fp, header, SNAPSHOT_ENTRIES, b->entries,
+				sizeof(*b->entries), b->nr_entries) ||
+			__write_section(fp, header, SNAPSHOT_PTES, b->ptes,
+				sizeof(*b->ptes), b->nr_ptes) ||
+			__write_section(fp, header, SNAPSHOT_MAPPINGS, b->mappings,
+				sizeof(*b->mappings), b->nr_mappings) ||
+			__write_section(fp, header, SNAPSHOT_RMAP, b->rmaps,
+				sizeof(*b->rmaps), b->nr_rmaps) ||
+			__write_section(fp, header, SNAPSHOT_MAPCOUNTS, sim->mapcounts,
+				sizeof(*sim->mapcounts), NR_PAGEFRAMES) ||
+			__write_section(fp, header, SNAPSHOT_TLB_ENTRIES, tlb_entries,
+				sizeof(*tlb_entries), nr_tlb_entries * sim->nr_cpus) ||
+			__write_section(fp, header, SNAPSHOT_GROUPS, b->groups,
+				sizeof(*b->groups), b->nr_groups) ||
+			__write_section(fp, header, SNAPSHOT_GROUP_CHARGES, b->charges,
+				sizeof(*b->charges), NR_PAGEFRAMES)) {
+		goto out_free;
+	}
+
+	if (sim->thp && __write_section(fp, header, SNAPSHOT_HUGE_MAPCOUNTS,
+				sim->huge_mapcounts, sizeof(*sim->huge_mapcounts),
+				(NR_PAGEFRAMES >> PTES_PER_PAGE_SHIFT) + 1)) {
+		goto out_free;
+	}
+
+	if (swap_enabled(swap)) {
+		slots = malloc(sizeof(*slots) * swap->nr_slots);
+		if (!slots || swap_read_slots(swap, slots)) goto out_free;
+
+		if (__write_section(fp, header, SNAPSHOT_SWAP_MAP, swap->swap_map,
+					sizeof(*swap->swap_map), swap->nr_slots) ||
+				__write_section(fp, header, SNAPSHOT_SWAP_CACHE, swap->cache,
+					sizeof(*swap->cache), swap->nr_slots) ||
+				__write_section(fp, header, SNAPSHOT_SWAP_SLOTS, slots,
+					sizeof(*slots), swap->nr_slots) ||
+				__write_section(fp, header, SNAPSHOT_RECLAIM_NEXT, r->next,
+					sizeof(*r->next), r->nr_frames + NR_RECLAIM_LISTS) ||
+				__write_section(fp, header, SNAPSHOT_RECLAIM_PREV, r->prev,
+					sizeof(*r->prev), r->nr_frames + NR_RECLAIM_LISTS) ||
+				__write_section(fp, header, SNAPSHOT_RECLAIM_ON_LIST, r->on_list,
+					sizeof(*r->on_list), r->nr_frames) ||
+				__write_section(fp, header, SNAPSHOT_RECLAIM_AGES, r->ages,
+					sizeof(*r->ages), r->nr_frames) ||
+				__write_section(fp, header, SNAPSHOT_RECLAIM_REFERENCED,
+					r->referenced, sizeof(*r->referenced), r->nr_frames)) {
+			goto out_free;
+		}
+	}
+
+	if (ksm_enabled(&sim->ksm)) {
+		if (__write_section(fp, header, SNAPSHOT_KSM_CONTENTS,
+					sim->ksm.contents, sizeof(*sim->ksm.contents),
+					NR_PAGEFRAMES) ||
+				__write_section(fp, header, SNAPSHOT_KSM_STABLE,
+					sim->ksm.stable, sizeof(*sim->ksm.stable),
+					NR_PAGEFRAMES)) {
+			goto out_free;
+		}
+	}
+
+	if (sim->numa.nr_remote) {
+		if (__write_section(fp, header, SNAPSHOT_NUMA_REMOTE,
+					sim->numa.nr_remote, sizeof(*sim->numa.nr_remote),
+					NR_PAGEFRAMES) ||
+				__write_section(fp, header, SNAPSHOT_NUMA_LAST_NODE,
+					sim->numa.last_node, sizeof(*sim->numa.last_node),
+					NR_PAGEFRAMES)) {
+			goto out_free;
+		}
+	}
+
+	if (readahead_enabled(&sim->readahead)) {
+		if (__write_section(fp, header, SNAPSHOT_READAHEAD,
+					sim->readahead.speculative,
+					sizeof(*sim->readahead.speculative), NR_PAGEFRAMES)) {
+			goto out_free;
+		}
+	}
+
+	/* Seal the header, which is complete by now, into the checksum */
+	checksum = header->checksum;
+	header->checksum = 0;
+	header->checksum = __checksum(checksum, header, sizeof(*header));
+	ret = 0;
+
+out_free:
+	free(runqueue);
+	free(tlb_entries);
+	free(slots);
+	return ret;
+}
+
+int snapshot_save(struct vm_sim *sim, const char *path)
+{
+	struct snapshot_builder b;
+	struct snapshot_header header = {
+		.magic = SNAPSHOT_MAGIC,
+		.version = SNAPSHOT_VERSION,
+		.nr_pageframes = NR_PAGEFRAMES,
+		.ptes_per_page_shift = PTES_PER_PAGE_SHIFT,
+		.nr_pt_levels = NR_PT_LEVELS,
+		.nr_cpus = sim->nr_cpus,
+		.swap_slots = sim->swap.nr_slots,
+		.thp = sim->thp,
+		.ksm = ksm_enabled(&sim->ksm),
+		.tlb_sets = sim->cpus->tlb.nr_sets,
+		.tlb_ways = sim->cpus->tlb.nr_ways,
+		.tlb_policy = sim->cpus->tlb.policy,
+		.tlb_huge_shift = sim->cpus->tlb.huge_shift,
+		.fault_around = sim->readahead.window,
+		.numa_nodes = sim->numa.nr_nodes,
+		.numa_threshold = sim->numa.threshold,
+		.numa_next_home = sim->numa.next_home,
+		.checksum = CHECKSUM_BASIS,
+	};
+	struct process *p;
+	FILE *fp;
+	int ret = -1;
+
+	strncpy(header.reclaim_policy, reclaim_policy_name(&sim->reclaim),
+			sizeof(header.reclaim_policy) - 1);
+
+	if (__init_builder(&b, sim)) {
+		fprintf(stderr, "Unable to save the snapshot\n");
+		return -1;
+	}
+
+	__gather_groups(&b);
+	__gather_processes(&b);
+	for (unsigned int i = 0; i < b.nr_processes; i++) {
+		p = b.processes[i];
+		if (p->pagetable.outer_ptes) {
+			__gather_table(&b, p, p->pagetable.outer_ptes, 0);
+		}
+	}
+	__gather_rmaps(&b);
+
+	fp = fopen(path, "wb");
+	if (!fp) {
+		fprintf(stderr, "Unable to create %s\n", path);
+		goto out_free;
+	}
+
+	/* The header is filled in as the sections are written */
+	if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+			__write_sections(sim, &b, &header, fp) ||
+			fseek(fp, 0, SEEK_SET) ||
+			fwrite(&header, sizeof(header), 1, fp) != 1) {
+		fprintf(stderr, "Unable to write %s\n", path);
+		fclose(fp);
+		goto out_free;
+	}
+	ret = fclose(fp) ? -1 : 0;
+
+out_free:
+	__free_builder(&b);
+	return ret;
+}
+
+
+/**
+ * Sections of a mapped snapshot. Every index in them is checked before
+ * anything in the simulation is changed.
+ */
+struct snapshot {
+	void *map;
+	size_t size;
+	const struct snapshot_header *header;
+
+	const struct snapshot_process *processes;
+	const uint32_t *runqueue;
+	const struct snapshot_cpu *cpus;
+	const struct snapshot_entry *entries;
+	const struct pte *ptes;
+	const struct snapshot_mapping *mappings;
+	const struct snapshot_rmap *rmaps;
+	const unsigned int *mapcounts;
+	const unsigned int *huge_mapcounts;
+	const unsigned int *swap_map;
+	const unsigned int *swap_cache;
+	const struct swap_slot *swap_slots;
+	const unsigned int *reclaim_next;
+	const unsigned int *reclaim_prev;
+	const unsigned char *reclaim_on_list;
+	const unsigned char *reclaim_ages;
+	const bool *reclaim_referenced;
+	const unsigned int *ksm_contents;
+	const bool *ksm_stable;
+	const bool *speculative;
+	const struct tlb_entry *tlb_entries;
+	const struct snapshot_group *groups;
+	const uint32_t *group_charges;
+	const unsigned int *numa_remote;
+	const unsigned char *numa_last_node;
+
+	unsigned int nr_processes;
+	unsigned int nr_runqueue;
+	unsigned int nr_entries;
+	unsigned int nr_ptes;
+	unsigned int nr_mappings;
+	unsigned int nr_rmaps;
+	unsigned int nr_groups;
+};
+
+#define SNAPSHOT_ANY	(~0U)
+
+/**
+ * Locate the section @id of @nr entries of @entry_size bytes in @s. Any
+ * number of entries is accepted if @nr is SNAPSHOT_ANY, and the number is
+ * stored to @nr_entries if given.
+ */
+static const void *__section(struct snapshot *s, enum snapshot_section_id id,
+		size_t entry_size, unsigned int nr, unsigned int *nr_entries)
+{
+	const struct snapshot_section *section = s->header->sections + id;
+	uint64_t size = (uint64_t)section->entry_size * section->nr_entries;
+
+	/* Sections of no entries may be left out */
+	if (section->nr_entries == 0 && (nr == 0 || nr == SNAPSHOT_ANY)) {
+		if (nr_entries) *nr_entries = 0;
+		return s->map;
+	}
+	if (section->entry_size != entry_size) return NULL;
+	if (nr != SNAPSHOT_ANY && section->nr_entries != nr) return NULL;
+	if (section->offset % 8 || section->offset > s->size ||
+			size > s->size - section->offset) {
+		return NULL;
+	}
+
+	if (nr_entries) *nr_entries = section->nr_entries;
+	return (const char *)s->map + section->offset;
+}
+
+static bool __checksum_matches(struct snapshot *s)
+{
+	struct snapshot_header header = *s->header;
+	uint64_t checksum = __checksum(CHECKSUM_BASIS,
+			(const char *)s->map + sizeof(header), s->size - sizeof(header));
+
+	header.checksum = 0;
+	return __checksum(checksum, &header, sizeof(header)) == s->header->checksum;
+}
+
+static bool __geometry_matches(struct vm_sim *sim,
+		const struct snapshot_header *header)
+{
+	return header->nr_pageframes == NR_PAGEFRAMES &&
+			header->ptes_per_page_shift == PTES_PER_PAGE_SHIFT &&
+			header->nr_pt_levels == NR_PT_LEVELS &&
+			header->nr_cpus == sim->nr_cpus &&
+			header->swap_slots == sim->swap.nr_slots &&
+			header->thp == sim->thp &&
+			header->ksm == ksm_enabled(&sim->ksm);
+}
+
+static int __map_sections(struct snapshot *s)
+{
+	const struct snapshot_header *h = s->header;
+	unsigned int nr_reclaim_lists = h->swap_slots ? NR_RECLAIM_LISTS : 0;
+	unsigned int nr_frames = h->nr_pageframes;
+	bool numa_counted = h->numa_nodes && h->numa_threshold;
+
+	s->processes = __section(s, SNAPSHOT_PROCESSES, sizeof(*s->processes),
+			SNAPSHOT_ANY, &s->nr_processes);
+	s->runqueue = __section(s, SNAPSHOT_RUNQUEUE, sizeof(*s->runqueue),
+			SNAPSHOT_ANY, &s->nr_runqueue);
+	s->cpus = __section(s, SNAPSHOT_CPUS, sizeof(*s->cpus), h->nr_cpus, NULL);
+	s->entries = __section(s, SNAPSHOT_ENTRIES, sizeof(*s->entries),
+			SNAPSHOT_ANY, &s->nr_entries);
+	s->ptes = __section(s, SNAPSHOT_PTES, sizeof(*s->ptes),
+			SNAPSHOT_ANY, &s->nr_ptes);
+	s->mappings = __section(s, SNAPSHOT_MAPPINGS, sizeof(*s->mappings),
+			SNAPSHOT_ANY, &s->nr_mappings);
+	s->rmaps = __section(s, SNAPSHOT_RMAP, sizeof(*s->rmaps),
+			SNAPSHOT_ANY, &s->nr_rmaps);
+	s->mapcounts = __section(s, SNAPSHOT_MAPCOUNTS, sizeof(*s->mapcounts),
+			nr_frames, NULL);
+	s->huge_mapcounts = __section(s, SNAPSHOT_HUGE_MAPCOUNTS,
+			sizeof(*s->huge_mapcounts),
+			h->thp ? (nr_frames >> h->ptes_per_page_shift) + 1 : 0, NULL);
+	s->swap_map = __section(s, SNAPSHOT_SWAP_MAP, sizeof(*s->swap_map),
+			h->swap_slots, NULL);
+	s->swap_cache = __section(s, SNAPSHOT_SWAP_CACHE, sizeof(*s->swap_cache),
+			h->swap_slots, NULL);
+	s->swap_slots = __section(s, SNAPSHOT_SWAP_SLOTS, sizeof(*s->swap_slots),
+			h->swap_slots, NULL);
+	s->reclaim_next = __section(s, SNAPSHOT_RECLAIM_NEXT,
+			sizeof(*s->reclaim_next),
+			nr_reclaim_lists ? nr_frames + nr_reclaim_lists : 0, NULL);
+	s->reclaim_prev = __section(s, SNAPSHOT_RECLAIM_PREV,
+			sizeof(*s->reclaim_prev),
+			nr_reclaim_lists ? nr_frames + nr_reclaim_lists : 0, NULL);
+	s->reclaim_on_list = __section(s, SNAPSHOT_RECLAIM_ON_LIST,
+			sizeof(*s->reclaim_on_list), h->swap_slots ? nr_frames : 0, NULL);
+	s->reclaim_ages = __section(s, SNAPSHOT_RECLAIM_AGES,
+			sizeof(*s->reclaim_ages), h->swap_slots ? nr_frames : 0, NULL);
+	s->reclaim_referenced = __section(s, SNAPSHOT_RECLAIM_REFERENCED,
+			sizeof(*s->reclaim_referenced),
+			h->swap_slots ? nr_frames : 0, NULL);
+	s->ksm_contents = __section(s, SNAPSHOT_KSM_CONTENTS,
+			sizeof(*s->ksm_contents), h->ksm ? nr_frames : 0, NULL);
+	s->ksm_stable = __section(s, SNAPSHOT_KSM_STABLE,
+			sizeof(*s->ksm_stable), h->ksm ? nr_frames : 0, NULL);
+	s->tlb_entries = __section(s, SNAPSHOT_TLB_ENTRIES,
+			sizeof(*s->tlb_entries),
+			h->tlb_sets * h->tlb_ways * h->nr_cpus, NULL);
+	s->speculative = __section(s, SNAPSHOT_READAHEAD,
+			sizeof(*s->speculative), h->fault_around ? nr_frames : 0, NULL);
+	s->groups = __section(s, SNAPSHOT_GROUPS, sizeof(*s->groups),
+			SNAPSHOT_ANY, &s->nr_groups);
+	s->group_charges = __section(s, SNAPSHOT_GROUP_CHARGES,
+			sizeof(*s->group_charges), nr_frames, NULL);
+	s->numa_remote = __section(s, SNAPSHOT_NUMA_REMOTE,
+			sizeof(*s->numa_remote), numa_counted ? nr_frames : 0, NULL);
+	s->numa_last_node = __section(s, SNAPSHOT_NUMA_LAST_NODE,
+			sizeof(*s->numa_last_node), numa_counted ? nr_frames : 0, NULL);
+
+	if (!s->processes || !s->runqueue || !s->cpus || !s->entries ||
+			!s->ptes || !s->mappings || !s->rmaps || !s->mapcounts ||
+			!s->huge_mapcounts || !s->swap_map || !s->swap_cache ||
+			!s->swap_slots || !s->reclaim_next || !s->reclaim_prev ||
+			!s->reclaim_on_list || !s->reclaim_ages ||
+			!s->reclaim_referenced || !s->ksm_contents || !s->ksm_stable ||
+			!s->tlb_entries || !s->speculative || !s->groups ||
+			!s->group_charges || !s->numa_remote || !s->numa_last_node) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Check the indices in @s not to go out of bounds while restoring */
+static int __check_indices(struct vm_sim *sim, struct snapshot *s)
+{
+	if (s->nr_processes == 0 || s->processes[0].pid != 0 ||
+			s->processes[0].parent != SNAPSHOT_NONE) {
+		return -1;
+	}
+	for (unsigned int i = 1; i < s->nr_processes; i++) {
+		if (s->processes[i].parent >= i) return -1;
+	}
+	if (s->nr_groups == 0 || s->groups[0].parent != SNAPSHOT_NONE) return -1;
+	for (unsigned int i = 1; i < s->nr_groups; i++) {
+		if (s->groups[i].parent >= i) return -1;
+	}
+	for (unsigned int i = 0; i < s->nr_processes; i++) {
+		if (s->processes[i].group >= s->nr_groups) return -1;
+	}
+	for (unsigned int i = 0; i < NR_PAGEFRAMES; i++) {
+		if (s->group_charges[i] != SNAPSHOT_NONE &&
+				s->group_charges[i] >= s->nr_groups) {
+			return -1;
+		}
+	}
+	for (unsigned int i = 0; i < s->nr_runqueue; i++) {
+		if (s->runqueue[i] >= s->nr_processes) return -1;
+	}
+	for (unsigned int i = 0; i < sim->nr_cpus; i++) {
+		if (s->cpus[i].curr != SNAPSHOT_NONE &&
+				s->cpus[i].curr >= s->nr_processes) {
+			return -1;
+		}
+	}
+	for (unsigned int i = 0; i < s->nr_entries; i++) {
+		const struct snapshot_entry *e = s->entries + i;
+		unsigned int nr_ptes = e->huge ? 1 : NR_PTES_PER_PAGE;
+
+		if (e->pte > s->nr_ptes || nr_ptes > s->nr_ptes - e->pte) return -1;
+		if (e->vpn >= NR_VPNS) return -1;
+	}
+	for (unsigned int i = 0; i < s->nr_mappings; i++) {
+		if (s->mappings[i].process >= s->nr_processes ||
+				s->mappings[i].entry >= s->nr_entries) {
+			return -1;
+		}
+	}
+	for (unsigned int i = 0; i < s->nr_rmaps; i++) {
+		if (s->rmaps[i].pfn >= NR_PAGEFRAMES ||
+				s->rmaps[i].entry >= s->nr_entries ||
+				s->rmaps[i].index >= NR_PTES_PER_PAGE) {
+			return -1;
+		}
+	}
+	for (unsigned int i = 0; i < sim->swap.nr_slots; i++) {
+		if (s->swap_cache[i] > NR_PAGEFRAMES) return -1;
+	}
+	if (swap_enabled(&sim->swap)) {
+		/* Links of the frames not on any list are meaningless */
+		for (unsigned int i = 0; i < NR_PAGEFRAMES + NR_RECLAIM_LISTS; i++) {
+			if (i < NR_PAGEFRAMES && !s->reclaim_on_list[i]) continue;
+			if (s->reclaim_next[i] >= NR_PAGEFRAMES + NR_RECLAIM_LISTS ||
+					s->reclaim_prev[i] >= NR_PAGEFRAMES + NR_RECLAIM_LISTS) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * Check that the page tables, the reverse mappings and the map counts in @s
+ * agree, since the restored ones are trusted afterward. Every present PTE is
+ * in the reverse mapping of its frame once and the other way around, and
+ * every entry is in the page table of each sharer at its own slot.
+ */
+static int __check_mappings(struct vm_sim *sim, struct snapshot *s)
+{
+	unsigned int nr_blocks = (NR_PAGEFRAMES >> PTES_PER_PAGE_SHIFT) + 1;
+	unsigned int *mapcounts = calloc(NR_PAGEFRAMES, sizeof(*mapcounts));
+	unsigned int *huge_mapcounts = calloc(nr_blocks, sizeof(*huge_mapcounts));
+	unsigned int *swap_map = calloc(sim->swap.nr_slots + 1, sizeof(*swap_map));
+	bool *attached = calloc(s->nr_entries + 1, sizeof(*attached));
+	bool *rmapped = calloc(s->nr_ptes + 1, sizeof(*rmapped));
+	struct snapshot_index *slots = malloc(sizeof(*slots) * (s->nr_mappings + 1));
+	unsigned int nr_ptes = 0;
+	unsigned int nr_present = 0;
+	int ret = -1;
+
+	if (!mapcounts || !huge_mapcounts || !swap_map || !attached || !rmapped ||
+			!slots) {
+		goto out_free;
+	}
+
+	for (unsigned int i = 0; i < s->nr_entries; i++) {
+		const struct snapshot_entry *e = s->entries + i;
+
+		/* The entries own their PTEs in a row as they are stored */
+		if (e->pte != nr_ptes || e->vpn % NR_PTES_PER_PAGE) goto out_free;
+
+		if (e->huge) {
+			struct pte pte = s->ptes[nr_ptes++];
+			unsigned int pfn = pte_pfn(&pte);
+
+			if (!sim->thp || !pte_valid(&pte) || pte_swapped(&pte) ||
+					pfn % NR_PTES_PER_PAGE ||
+					(uint64_t)pfn + NR_PTES_PER_PAGE > NR_PAGEFRAMES) {
+				goto out_free;
+			}
+			nr_present++;
+			continue;
+		}
+
+		for (unsigned int j = 0; j < NR_PTES_PER_PAGE; j++) {
+			struct pte pte = s->ptes[nr_ptes++];
+			unsigned int pfn = pte_pfn(&pte);
+
+			if (pte_valid(&pte)) {
+				if (pte_swapped(&pte) || pfn >= NR_PAGEFRAMES) goto out_free;
+				nr_present++;
+			} else if (pte_swapped(&pte)) {
+				if (pfn >= sim->swap.nr_slots) goto out_free;
+				swap_map[pfn]++;
+			}
+		}
+	}
+
+	/* No two entries for the same slot of a page table */
+	for (unsigned int i = 0; i < s->nr_mappings; i++) {
+		const struct snapshot_mapping *m = s->mappings + i;
+
+		slots[i] = (struct snapshot_index) {
+			.key = (uintptr_t)m->process * (NR_VPNS >> PTES_PER_PAGE_SHIFT) +
+					(s->entries[m->entry].vpn >> PTES_PER_PAGE_SHIFT),
+			.index = m->entry,
+		};
+		attached[m->entry] = true;
+	}
+	qsort(slots, s->nr_mappings, sizeof(*slots), __compare_index);
+	for (unsigned int i = 1; i < s->nr_mappings; i++) {
+		if (slots[i].key == slots[i - 1].key) goto out_free;
+	}
+	for (unsigned int i = 0; i < s->nr_entries; i++) {
+		if (!attached[i]) goto out_free;
+	}
+
+	/* A huge PTE is in the reverse mapping of the first frame it maps */
+	for (unsigned int i = 0; i < s->nr_rmaps; i++) {
+		const struct snapshot_rmap *r = s->rmaps + i;
+		const struct snapshot_entry *e = s->entries + r->entry;
+		unsigned int index = e->pte + (e->huge ? 0 : r->index);
+		struct pte pte = s->ptes[index];
+
+		if ((e->huge && r->index) || !pte_valid(&pte) ||
+				pte_pfn(&pte) != r->pfn || rmapped[index]) {
+			goto out_free;
+		}
+		rmapped[index] = true;
+
+		if (e->huge) {
+			huge_mapcounts[r->pfn >> PTES_PER_PAGE_SHIFT]++;
+		} else {
+			mapcounts[r->pfn]++;
+		}
+	}
+	if (s->nr_rmaps != nr_present) goto out_free;
+
+	if (memcmp(mapcounts, s->mapcounts, sizeof(*mapcounts) * NR_PAGEFRAMES) ||
+			(sim->thp && memcmp(huge_mapcounts, s->huge_mapcounts,
+					sizeof(*huge_mapcounts) * nr_blocks)) ||
+			memcmp(swap_map, s->swap_map,
+					sizeof(*swap_map) * sim->swap.nr_slots)) {
+		goto out_free;
+	}
+	ret = 0;
+
+out_free:
+	free(mapcounts);
+	free(huge_mapcounts);
+	free(swap_map);
+	free(attached);
+	free(rmapped);
+	free(slots);
+	return ret;
+}
+
+/* Whether @pfn is mapped by a PTE or a huge PTE in @s */
+static inline bool __frame_mapped(struct vm_sim *sim, struct snapshot *s,
+		unsigned int pfn)
+{
+	return s->mapcounts[pfn] ||
+			(sim->thp && s->huge_mapcounts[pfn >> PTES_PER_PAGE_SHIFT]);
+}
+
+/**
+ * Check that each process is on the ready queue or a CPU at most once, and
+ * that each replacement list links up the frames in use marked on it in a
+ * circle from its head.
+ */
+static int __check_lists(struct vm_sim *sim, struct snapshot *s)
+{
+	bool *queued = calloc(s->nr_processes, sizeof(*queued));
+	unsigned int nr_on_lists = 0;
+	int ret = -1;
+
+	if (!queued) return -1;
+
+	for (unsigned int i = 0; i < s->nr_runqueue; i++) {
+		if (queued[s->runqueue[i]]) goto out_free;
+		queued[s->runqueue[i]] = true;
+	}
+	for (unsigned int i = 0; i < sim->nr_cpus; i++) {
+		unsigned int curr = s->cpus[i].curr;
+
+		if (curr == SNAPSHOT_NONE) continue;
+		if (queued[curr]) goto out_free;
+		queued[curr] = true;
+	}
+
+	if (!swap_enabled(&sim->swap)) {
+		ret = 0;
+		goto out_free;
+	}
+
+	for (unsigned int list = 0; list < NR_RECLAIM_LISTS; list++) {
+		unsigned int head = NR_PAGEFRAMES + list;
+		unsigned int prev = head;
+
+		for (unsigned int pfn = s->reclaim_next[head]; pfn != head;
+				prev = pfn, pfn = s->reclaim_next[pfn]) {
+			if (pfn >= NR_PAGEFRAMES || s->reclaim_on_list[pfn] != list + 1 ||
+					s->reclaim_prev[pfn] != prev ||
+					!__frame_mapped(sim, s, pfn) ||
+					nr_on_lists++ == NR_PAGEFRAMES) {
+				goto out_free;
+			}
+		}
+		if (s->reclaim_prev[head] != prev) goto out_free;
+	}
+
+	/* No frame is marked on a list without being linked on it */
+	for (unsigned int pfn = 0; pfn < NR_PAGEFRAMES; pfn++) {
+		if (s->reclaim_on_list[pfn]) nr_on_lists--;
+	}
+	if (nr_on_lists == 0) ret = 0;
+
+out_free:
+	free(queued);
+	return ret;
+}
+
+static void __restore_page_tables(struct vm_sim *sim, struct snapshot *s,
+		struct process **processes, void **entries)
+{
+	for (unsigned int i = 0; i < s->nr_entries; i++) {
+		const struct snapshot_entry *e = s->entries + i;
+
+		if (e->huge) {
+			struct huge_pte *h = kmem_cache_alloc(&sim->huge_pte_cache);
+
+			h->vpn = e->vpn;
+			INIT_LIST_HEAD(&h->sharers);
+			h->pte = s->ptes[e->pte];
+			entries[i] = huge_to_pt(h);
+		} else {
+			struct pte_directory *pd = kmem_cache_alloc(&sim->pte_directory_cache);
+
+			pd->vpn = e->vpn;
+			INIT_LIST_HEAD(&pd->sharers);
+			memcpy(pd->ptes, s->ptes + e->pte,
+					sizeof(struct pte) * NR_PTES_PER_PAGE);
+			entries[i] = pd;
+		}
+	}
+
+	for (unsigned int i = 0; i < s->nr_mappings; i++) {
+		const struct snapshot_mapping *m = s->mappings + i;
+
+		attach_pt_entry(sim, processes[m->process],
+				s->entries[m->entry].vpn, entries[m->entry]);
+	}
+
+	for (unsigned int i = 0; i < s->nr_rmaps; i++) {
+		const struct snapshot_rmap *r = s->rmaps + i;
+
+		rmap_add(sim, r->pfn, entries[r->entry], r->index);
+	}
+
+	memcpy(sim->mapcounts, s->mapcounts, sizeof(*sim->mapcounts) * NR_PAGEFRAMES);
+	if (sim->thp) {
+		memcpy(sim->huge_mapcounts, s->huge_mapcounts,
+				sizeof(*sim->huge_mapcounts) *
+				((NR_PAGEFRAMES >> PTES_PER_PAGE_SHIFT) + 1));
+	}
+	for (unsigned int pfn = 0; pfn < NR_PAGEFRAMES; pfn++) {
+		if (sim->mapcounts[pfn] || (sim->thp &&
+				sim->huge_mapcounts[pfn >> PTES_PER_PAGE_SHIFT])) {
+			hbitmap_clear(&sim->free_frames, pfn);
+		}
+	}
+}
+
+static void __restore_swap(struct vm_sim *sim, struct snapshot *s)
+{
+	struct swap_area *swap = &sim->swap;
+	struct reclaim *r = &sim->reclaim;
+	unsigned int nr_frames = NR_PAGEFRAMES;
+
+	if (!swap_enabled(swap)) return;
+
+	memcpy(swap->swap_map, s->swap_map, sizeof(*swap->swap_map) * swap->nr_slots);
+	memcpy(swap->cache, s->swap_cache, sizeof(*swap->cache) * swap->nr_slots);
+	for (unsigned int slot = 0; slot < swap->nr_slots; slot++) {
+		if (swap->swap_map[slot]) hbitmap_clear(&swap->free_slots, slot);
+		if (swap->cache[slot]) swap->cached_slot[swap->cache[slot] - 1] = slot + 1;
+	}
+	if (swap_write_slots(swap, s->swap_slots)) {
+		fprintf(stderr, "Unable to restore the swap file\n");
+	}
+
+	if (strncmp(s->header->reclaim_policy, reclaim_policy_name(r),
+				sizeof(s->header->reclaim_policy)) == 0) {
+		memcpy(r->next, s->reclaim_next,
+				sizeof(*r->next) * (nr_frames + NR_RECLAIM_LISTS));
+		memcpy(r->prev, s->reclaim_prev,
+				sizeof(*r->prev) * (nr_frames + NR_RECLAIM_LISTS));
+		memcpy(r->on_list, s->reclaim_on_list, sizeof(*r->on_list) * nr_frames);
+		memcpy(r->ages, s->reclaim_ages, sizeof(*r->ages) * nr_frames);
+		memcpy(r->referenced, s->reclaim_referenced,
+				sizeof(*r->referenced) * nr_frames);
+
+		memset(r->list_size, 0x00, sizeof(r->list_size));
+		for (unsigned int pfn = 0; pfn < nr_frames; pfn++) {
+			if (r->on_list[pfn]) r->list_size[r->on_list[pfn] - 1]++;
+		}
+		return;
+	}
+
+	/* Oldest frames first. The walk is bounded in case of a broken list */
+	for (unsigned int list = 0; list < NR_RECLAIM_LISTS; list++) {
+		unsigned int head = nr_frames + list;
+		unsigned int pfn = s->reclaim_next[head];
+
+		for (unsigned int i = 0; pfn != head && i < nr_frames; i++) {
+			if (pfn < nr_frames) reclaim_add(r, pfn);
+			pfn = s->reclaim_next[pfn];
+		}
+	}
+}
+
+static void __restore_numa(struct vm_sim *sim, struct snapshot *s,
+		struct process **processes)
+{
+	const struct snapshot_header *h = s->header;
+	struct numa *numa = &sim->numa;
+
+	for (unsigned int i = 0; i < s->nr_processes; i++) {
+		struct numa_state *state = &processes[i]->numa;
+
+		numa_set_home(numa, state, s->processes[i].numa_node);
+		if (numa_enabled(numa)) {
+			state->interleave = s->processes[i].numa_interleave % numa->nr_nodes;
+		}
+	}
+	if (!numa_enabled(numa)) return;
+
+	numa->next_home = h->numa_next_home % numa->nr_nodes;
+
+	if (numa->nr_remote && h->numa_threshold && h->numa_nodes == numa->nr_nodes) {
+		memcpy(numa->nr_remote, s->numa_remote,
+				sizeof(*numa->nr_remote) * NR_PAGEFRAMES);
+		memcpy(numa->last_node, s->numa_last_node,
+				sizeof(*numa->last_node) * NR_PAGEFRAMES);
+	}
+}
+
+/**
+ * Rebuild the memory groups and charge the frames in use to them again. A
+ * group that cannot be made leaves its processes and frames to its parent.
+ */
+static void __restore_groups(struct vm_sim *sim, struct snapshot *s,
+		struct process **processes, struct mem_group **groups)
+{
+	struct memcg *mc = &sim->memcg;
+
+	memcg_clear(mc);
+
+	groups[0] = &mc->root;
+	mc->root.limit = s->groups[0].limit;
+	for (unsigned int i = 1; i < s->nr_groups; i++) {
+		const struct snapshot_group *record = s->groups + i;
+		struct mem_group *parent = groups[record->parent];
+
+		groups[i] = memcg_get_group(mc, record->id, parent);
+		if (!groups[i]) {
+			fprintf(stderr, "Unable to restore memory group %u\n", record->id);
+			groups[i] = parent;
+			continue;
+		}
+		groups[i]->limit = record->limit;
+	}
+
+	for (unsigned int i = 0; i < s->nr_processes; i++) {
+		processes[i]->memcg = groups[s->processes[i].group];
+	}
+
+	/* Frames in use without a charge, if any, belong to the root as before */
+	for (unsigned int pfn = 0; pfn < NR_PAGEFRAMES; pfn++) {
+		uint32_t group = s->group_charges[pfn];
+
+		if (hbitmap_test(&sim->free_frames, pfn)) continue;
+		memcg_charge(mc, pfn, group == SNAPSHOT_NONE ? &mc->root : groups[group]);
+	}
+}
+
+static void __restore_cpus(struct vm_sim *sim, struct snapshot *s,
+		struct process **processes)
+{
+	const struct snapshot_header *h = s->header;
+	struct cpu *cpu;
+
+	for_each_cpu(sim, cpu) {
+		const struct snapshot_cpu *c = s->cpus + cpu->id;
+		struct tlb *tlb = &cpu->tlb;
+		unsigned int nr_entries = tlb->nr_sets * tlb->nr_ways;
+
+		cpu->curr = c->curr == SNAPSHOT_NONE ? NULL : processes[c->curr];
+		cpu->pt_base = cpu->curr ? &cpu->curr->pagetable : NULL;
+
+		if (!nr_entries) continue;
+
+		if (h->tlb_sets == tlb->nr_sets && h->tlb_ways == tlb->nr_ways &&
+				h->tlb_policy == tlb->policy &&
+				h->tlb_huge_shift == tlb->huge_shift) {
+			memcpy(tlb->entries, s->tlb_entries + nr_entries * cpu->id,
+					sizeof(*tlb->entries) * nr_entries);
+			tlb->seed = c->tlb_seed;
+			tlb->clock = c->tlb_clock;
+		} else {
+			memset(tlb->entries, 0x00, sizeof(*tlb->entries) * nr_entries);
+		}
+	}
+
+	for (unsigned int i = 0; i < s->nr_runqueue; i++) {
+		list_add_tail(&processes[s->runqueue[i]]->list, &sim->processes);
+	}
+}
+
+static int __restore(struct vm_sim *sim, struct snapshot *s)
+{
+	struct process **processes;
+	struct mem_group **groups;
+	void **entries;
+
+	processes = malloc(sizeof(*processes) * s->nr_processes);
+	groups = malloc(sizeof(*groups) * s->nr_groups);
+	entries = malloc(sizeof(*entries) * (s->nr_entries + 1));
+	if (!processes || !groups || !entries) {
+		free(processes);
+		free(groups);
+		free(entries);
+		return -1;
+	}
+
+	/* The pages mapped ahead are discarded, not wasted */
+	if (readahead_enabled(&sim->readahead)) {
+		memset(sim->readahead.speculative, 0x00,
+				sizeof(*sim->readahead.speculative) * NR_PAGEFRAMES);
+	}
+	reset_processes(sim);
+
+	processes[0] = &sim->init;
+	for (unsigned int i = 1; i < s->nr_processes; i++) {
+		const struct snapshot_process *record = s->processes + i;
+
+		processes[i] = create_process(sim, record->pid,
+				processes[record->parent]);
+		processes[i]->exited = record->exited;
+	}
+	for (unsigned int i = 0; i < s->nr_processes; i++) {
+		processes[i]->readahead = s->processes[i].readahead;
+	}
+	__restore_numa(sim, s, processes);
+
+	__restore_page_tables(sim, s, processes, entries);
+	__restore_swap(sim, s);
+
+	if (ksm_enabled(&sim->ksm)) {
+		memcpy(sim->ksm.contents, s->ksm_contents,
+				sizeof(*sim->ksm.contents) * NR_PAGEFRAMES);
+		memcpy(sim->ksm.stable, s->ksm_stable,
+				sizeof(*sim->ksm.stable) * NR_PAGEFRAMES);
+	}
+	if (readahead_enabled(&sim->readahead) && s->header->fault_around) {
+		memcpy(sim->readahead.speculative, s->speculative,
+				sizeof(*sim->readahead.speculative) * NR_PAGEFRAMES);
+	}
+
+	__restore_groups(sim, s, processes, groups);
+	__restore_cpus(sim, s, processes);
+	account_restored_memory(sim);
+
+	free(processes);
+	free(groups);
+	free(entries);
+	return 0;
+}
+
+int snapshot_load(struct vm_sim *sim, const char *path)
+{
+	struct snapshot s = { 0 };
+	struct stat st;
+	int fd;
+	int ret = -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "No snapshot %s\n", path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(*s.header)) {
+		fprintf(stderr, "Invalid snapshot %s\n", path);
+		close(fd);
+		return -1;
+	}
+
+	s.size = st.st_size;
+	s.map = mmap(NULL, s.size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (s.map == MAP_FAILED) {
+		fprintf(stderr, "Unable to map %s\n", path);
+		return -1;
+	}
+	s.header = s.map;
+
+	if (memcmp(s.header->magic, SNAPSHOT_MAGIC, sizeof(s.header->magic))) {
+		fprintf(stderr, "Invalid snapshot %s\n", path);
+		goto out_unmap;
+	}
+	if (s.header->version != SNAPSHOT_VERSION) {
+		fprintf(stderr, "Unsupported snapshot version %u\n", s.header->version);
+		goto out_unmap;
+	}
+	if (!__geometry_matches(sim, s.header)) {
+		fprintf(stderr, "Snapshot %s is taken from a different system\n", path);
+		goto out_unmap;
+	}
+	if (!__checksum_matches(&s) || __map_sections(&s) ||
+			__check_indices(sim, &s) || __check_mappings(sim, &s) ||
+			__check_lists(sim, &s)) {
+		fprintf(stderr, "Corrupted snapshot %s\n", path);
+		goto out_unmap;
+	}
+
+	ret = __restore(sim, &s);
+	if (ret) fprintf(stderr, "Unable to restore %s\n", path);
+
+out_unmap:
+	munmap(s.map, s.size);
+	return ret;
+}
@@ -0,0 +1,212 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stdint.h>
+
+#include "types.h"
+#include "readahead.h"
+
+struct vm_sim;
+
+/**
+ * Snapshot format
+ *
+ * A snapshot starts with struct snapshot_header, followed by the sections
+ * listed in the header. Each section is a flat array of fixed-size entries
+ * aligned to 8 bytes, so the file is mmap()ed and the arrays are copied or
+ * indexed in place. The structures and the PTEs are stored as they are in
+ * memory, and @entry_size of each section guards against a different layout.
+ *
+ * Pointers are replaced with indices. Processes are stored parents first
+ * starting from the init process, and each pte_directory and huge PTE shared
+ * by processes is stored once and referred by its index in the entries.
+ *
+ * Counters and statistics are not part of the state. The counters of the
+ * simulation go on across a restore, and the restored processes and memory
+ * groups start counting their faults and reclaims from zero.
+ *
+ * The memory groups are stored in the creation order starting from the root,
+ * with their limits and the group charged for each frame. Their usages are
+ * charged again from the frames, and the footprints of the processes are
+ * counted again from their page tables.
+ *
+ * The NUMA states are stored for the nodes in the header. The nodes of the
+ * processes are wrapped around the nodes of the simulation to restore into,
+ * and the remote accesses to the frames are restored only if both have the
+ * same nodes and count them.
+ *
+ * The header carries the checksum of the whole file, and the page tables,
+ * the reverse mappings, the mapcounts and the replacement lists are checked
+ * to agree with each other before anything is restored. A file failing
+ * either is rejected.
+ */
+#define SNAPSHOT_MAGIC		"VMSTATE"
+#define SNAPSHOT_VERSION	6	/* 2 adds the readahead states, 3 packs PTEs,
+					   4 adds the NUMA home nodes,
+					   5 adds the memory groups,
+					   6 adds the NUMA placement and remote
+					   accesses, 7 adds the checksum */
+
+#define SNAPSHOT_NONE		(~0U)
+
+enum snapshot_section_id {
+	SNAPSHOT_PROCESSES = 0,		/* struct snapshot_process */
+	SNAPSHOT_RUNQUEUE,		/* Process index in the ready queue order */
+	SNAPSHOT_CPUS,			/* struct snapshot_cpu */
+	SNAPSHOT_ENTRIES,		/* struct snapshot_entry */
+	SNAPSHOT_PTES,			/* struct pte of the entries */
+	SNAPSHOT_MAPPINGS,		/* struct snapshot_mapping */
+	SNAPSHOT_RMAP,			/* struct snapshot_rmap */
+	SNAPSHOT_MAPCOUNTS,
+	SNAPSHOT_HUGE_MAPCOUNTS,	/* Only with THP */
+	SNAPSHOT_SWAP_MAP,		/* Only with swap from here */
+	SNAPSHOT_SWAP_CACHE,
+	SNAPSHOT_SWAP_SLOTS,		/* struct swap_slot of the swap file */
+	SNAPSHOT_RECLAIM_NEXT,
+	SNAPSHOT_RECLAIM_PREV,
+	SNAPSHOT_RECLAIM_ON_LIST,
+	SNAPSHOT_RECLAIM_AGES,
+	SNAPSHOT_RECLAIM_REFERENCED,
+	SNAPSHOT_KSM_CONTENTS,		/* Only with same-page merging */
+	SNAPSHOT_KSM_STABLE,
+	SNAPSHOT_TLB_ENTRIES,		/* struct tlb_entry of CPU 0, 1, ... */
+	SNAPSHOT_READAHEAD,		/* Frames mapped ahead, with fault-around */
+	SNAPSHOT_GROUPS,		/* struct snapshot_group */
+	SNAPSHOT_GROUP_CHARGES,		/* Group index of each frame, or SNAPSHOT_NONE */
+	SNAPSHOT_NUMA_REMOTE,		/* Only with NUMA balancing */
+	SNAPSHOT_NUMA_LAST_NODE,
+	NR_SNAPSHOT_SECTIONS,
+};
+
+struct snapshot_section {
+	uint64_t offset;		/* From the beginning of the file */
+	uint32_t entry_size;
+	uint32_t nr_entries;
+};
+
+struct snapshot_header {
+	char magic[8];
+	uint32_t version;
+
+	/* Geometry. The simulation to restore into should have the same */
+	uint32_t nr_pageframes;
+	uint32_t ptes_per_page_shift;
+	uint32_t nr_pt_levels;
+	uint32_t nr_cpus;
+	uint32_t swap_slots;
+	uint32_t thp;
+	uint32_t ksm;
+
+	/**
+	 * The configuration that the replacement lists and the TLBs depend on.
+	 * They are restored as they are only if the simulation has the same.
+	 * Otherwise, the frames in the lists are handed over to the policy of
+	 * the simulation in the list order, and the TLBs start empty.
+	 */
+	char reclaim_policy[16];
+	uint32_t tlb_sets;
+	uint32_t tlb_ways;
+	uint32_t tlb_policy;
+	uint32_t tlb_huge_shift;
+
+	/**
+	 * The frames mapped ahead are restored if both have fault-around, and
+	 * the readahead states of the processes are restored regardless.
+	 */
+	uint32_t fault_around;
+
+	/* The NUMA nodes, and the home node for the process created next */
+	uint32_t numa_nodes;
+	uint32_t numa_threshold;
+	uint32_t numa_next_home;
+
+	/* FNV-1a of the sections, followed by the header with this cleared */
+	uint64_t checksum;
+
+	struct snapshot_section sections[NR_SNAPSHOT_SECTIONS];
+};
+
+struct snapshot_process {
+	uint32_t pid;
+	uint32_t parent;		/* SNAPSHOT_NONE for the init process */
+	uint32_t exited;
+	uint32_t numa_node;		/* Wrapped around the nodes on restore */
+	uint32_t numa_interleave;	/* Likewise */
+	uint32_t group;			/* Index of the memory group */
+	struct readahead_state readahead;
+};
+
+struct snapshot_group {
+	uint32_t id;
+	uint32_t parent;		/* SNAPSHOT_NONE for the root group */
+	uint64_t limit;
+};
+
+struct snapshot_cpu {
+	uint32_t curr;			/* SNAPSHOT_NONE if idle */
+	uint32_t tlb_seed;
+	uint64_t tlb_clock;
+};
+
+/* A pte_directory or a huge PTE */
+struct snapshot_entry {
+	uint32_t vpn;
+	uint32_t huge;
+	uint32_t pte;			/* Index of the first PTE in SNAPSHOT_PTES */
+};
+
+/* The page table of @process points to @entry */
+struct snapshot_mapping {
+	uint32_t process;
+	uint32_t entry;
+};
+
+/* The PTE at @index of @entry maps @pfn, in the order of the reverse mapping */
+struct snapshot_rmap {
+	uint32_t pfn;
+	uint32_t entry;
+	uint32_t index;
+};
+
+/***********************************************************************
+ * snapshot_save()
+ *
+ * DESCRIPTION
+ *   Write the state of @sim to the snapshot at @path. Should be called while
+ *   no CPU runs records, with mm_lock() held.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 on error
+ */
+int snapshot_save(struct vm_sim *sim, const char *path);
+
+/***********************************************************************
+ * snapshot_load()
+ *
+ * DESCRIPTION
+ *   Replace the state of @sim with the snapshot at @path. The processes and
+ *   their address spaces are discarded without any event. @sim is left
+ *   untouched if the snapshot cannot be restored into @sim. Should be called
+ *   in the same condition as snapshot_save().
+ *
+ * RETURN VALUE
+ *   0 on success, -1 on error
+ */
+int snapshot_load(struct vm_sim *sim, const char *path);
+
+#endif
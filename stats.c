@@ -0,0 +1,228 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "stats.h"
+#include "cpu.h"
+
+static const char *fault_class_names[] = {
+	[FAULT_MISSING_DIRECTORY] = "no directory",
+	[FAULT_INVALID_PTE] = "invalid pte",
+	[FAULT_SWAP_IN] = "swap-in",
+	[FAULT_COW_COPY] = "cow copy",
+	[FAULT_COW_REUSE] = "cow reuse",
+	[FAULT_READ_ONLY] = "read-only",
+};
+
+static const char *hist_names[] = {
+	[HIST_TRANSLATE] = "translate",
+	[HIST_FAULT] = "page fault",
+	[HIST_SWITCH] = "switch",
+};
+
+void stats_init(struct vm_stats *stats, bool profiling)
+{
+	memset(stats, 0x00, sizeof(*stats));
+	stats->profiling = profiling;
+}
+
+void stats_count_fault(struct vm_stats *stats, unsigned long *nr_faults,
+		enum fault_class class)
+{
+	stats->nr_faults[class]++;
+	nr_faults[class]++;
+}
+
+const char *stats_fault_name(enum fault_class class)
+{
+	return fault_class_names[class];
+}
+
+void hist_add(struct histogram *h, uint64_t ns)
+{
+	unsigned int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+
+	if (bucket >= HIST_NR_BUCKETS) bucket = HIST_NR_BUCKETS - 1;
+	h->buckets[bucket]++;
+
+	if (!h->nr_samples || ns < h->min) h->min = ns;
+	if (ns > h->max) h->max = ns;
+	h->sum += ns;
+	h->nr_samples++;
+}
+
+void __stats_record(enum stats_hist hist, uint64_t ns)
+{
+	hist_add(&this_cpu->hists[hist], ns);
+}
+
+static void __sum_histogram(struct vm_sim *sim, struct histogram *h,
+		enum stats_hist hist)
+{
+	struct cpu *cpu;
+
+	memset(h, 0x00, sizeof(*h));
+
+	for_each_cpu(sim, cpu) {
+		struct histogram *src = &cpu->hists[hist];
+
+		if (!src->nr_samples) continue;
+
+		for (int i = 0; i < HIST_NR_BUCKETS; i++) {
+			h->buckets[i] += src->buckets[i];
+		}
+		if (!h->nr_samples || src->min < h->min) h->min = src->min;
+		if (src->max > h->max) h->max = src->max;
+		h->sum += src->sum;
+		h->nr_samples += src->nr_samples;
+	}
+}
+
+static void __show_histogram(FILE *fp, const char *name, struct histogram *h)
+{
+	unsigned long peak = 0;
+
+	fprintf(fp, "  %s: %lu samples", name, h->nr_samples);
+	if (!h->nr_samples) {
+		fprintf(fp, "\n");
+		return;
+	}
+	fprintf(fp, ", min %lu avg %lu max %lu ns\n",
+			(unsigned long)h->min,
+			(unsigned long)(h->sum / h->nr_samples),
+			(unsigned long)h->max);
+
+	for (int i = 0; i < HIST_NR_BUCKETS; i++) {
+		if (h->buckets[i] > peak) peak = h->buckets[i];
+	}
+
+	for (int i = 0; i < HIST_NR_BUCKETS; i++) {
+		int width;
+
+		if (!h->buckets[i]) continue;
+
+		width = (h->buckets[i] * 40 + peak - 1) / peak;
+		fprintf(fp, "    %12llu -> %-12llu: %10lu |%-40.*s|\n",
+				i ? 1ULL << i : 0, (1ULL << (i + 1)) - 1,
+				h->buckets[i], width,
+				"****************************************");
+	}
+}
+
+static void __show_process_faults(FILE *fp, struct process *p)
+{
+	fprintf(fp, "  %5u", p->pid);
+	for (int i = 0; i < NR_FAULT_CLASSES; i++) {
+		fprintf(fp, " %12lu", p->nr_faults[i]);
+	}
+	fprintf(fp, "\n");
+}
+
+static void __show_process_memory(FILE *fp, struct process *p)
+{
+	fprintf(fp, "  %5u %5u %10lu %10lu %10lu %10lu\n", p->pid, p->memcg->id,
+			p->rss.resident, p->rss.shared, rss_private(&p->rss),
+			p->rss.nr_pt_pages);
+}
+
+void stats_show(struct vm_sim *sim)
+{
+	FILE *fp = sim->output.fp;
+	struct process *p;
+	struct cpu *cpu;
+
+	fprintf(fp, "Page faults\n");
+	fprintf(fp, "  %5s", "pid");
+	for (int i = 0; i < NR_FAULT_CLASSES; i++) {
+		fprintf(fp, " %12s", fault_class_names[i]);
+	}
+	fprintf(fp, "\n");
+
+	for_each_cpu(sim, cpu) {
+		if (cpu->curr) __show_process_faults(fp, cpu->curr);
+	}
+	list_for_each_entry(p, &sim->processes, list) {
+		__show_process_faults(fp, p);
+	}
+
+	fprintf(fp, "  %5s", "total");
+	for (int i = 0; i < NR_FAULT_CLASSES; i++) {
+		fprintf(fp, " %12lu", sim->stats.nr_faults[i]);
+	}
+	fprintf(fp, "\n\n");
+
+	fprintf(fp, "Memory usage\n");
+	fprintf(fp, "  %5s %5s %10s %10s %10s %10s\n", "pid", "group",
+			"resident", "shared", "private", "pt pages");
+	for_each_cpu(sim, cpu) {
+		if (cpu->curr) __show_process_memory(fp, cpu->curr);
+	}
+	list_for_each_entry(p, &sim->processes, list) {
+		__show_process_memory(fp, p);
+	}
+	fprintf(fp, "\n");
+
+	if (memcg_enabled(&sim->memcg)) memcg_show(&sim->memcg, fp);
+
+	if (sim->thp) {
+		fprintf(fp, "Huge pages\n");
+		fprintf(fp, "  allocated : %lu\n", sim->stats.nr_huge_allocs);
+		fprintf(fp, "  split     : %lu\n", sim->stats.nr_huge_splits);
+		fprintf(fp, "  migrated  : %lu\n\n", sim->stats.nr_migrations);
+	}
+
+	if (ksm_enabled(&sim->ksm)) ksm_show(&sim->ksm, sim->mapcounts, fp);
+	if (readahead_enabled(&sim->readahead)) readahead_show(&sim->readahead, fp);
+
+	if (wss_enabled(&sim->wss)) {
+		wss_show(&sim->wss, fp);
+		for_each_cpu(sim, cpu) {
+			if (cpu->curr) wss_show_sample(cpu->curr->pid, &cpu->curr->wss, fp);
+		}
+		list_for_each_entry(p, &sim->processes, list) {
+			wss_show_sample(p->pid, &p->wss, fp);
+		}
+		fprintf(fp, "\n");
+	}
+
+	if (numa_enabled(&sim->numa)) {
+		numa_show(&sim->numa, &sim->free_frames, fp);
+		for_each_cpu(sim, cpu) {
+			if (cpu->curr) numa_show_process(cpu->curr->pid, &cpu->curr->numa, fp);
+		}
+		list_for_each_entry(p, &sim->processes, list) {
+			numa_show_process(p->pid, &p->numa, fp);
+		}
+		fprintf(fp, "\n");
+	}
+
+	if (evtrace_enabled(&sim->evtrace)) evtrace_show(&sim->evtrace, fp);
+
+	if (!sim->stats.profiling) return;
+
+	fprintf(fp, "Latencies\n");
+	for (int i = 0; i < NR_HISTS; i++) {
+		struct histogram h;
+
+		__sum_histogram(sim, &h, i);
+		__show_histogram(fp, hist_names[i], &h);
+	}
+	fprintf(fp, "\n");
+}
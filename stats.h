@@ -0,0 +1,118 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#include "types.h"
+
+/**
+ * Classes of page faults by how handle_page_fault() resolves them
+ */
+enum fault_class {
+	FAULT_MISSING_DIRECTORY = 0,	/* No pte_directory for the VPN yet */
+	FAULT_INVALID_PTE,		/* The PTE is not valid */
+	FAULT_SWAP_IN,			/* The page is read in from the swap */
+	FAULT_COW_COPY,			/* Copy the page shared with others */
+	FAULT_COW_REUSE,		/* Reuse the page of the last sharer */
+	FAULT_READ_ONLY,		/* Write to a read-only page, rejected */
+	NR_FAULT_CLASSES,
+};
+
+/**
+ * Latency histogram. Bucket i counts the samples in [2^i, 2^(i+1)) ns, and
+ * bucket 0 includes 0 ns as well.
+ */
+#define HIST_NR_BUCKETS		40
+
+struct histogram {
+	unsigned long buckets[HIST_NR_BUCKETS];
+	unsigned long nr_samples;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+};
+
+enum stats_hist {
+	HIST_TRANSLATE = 0,	/* MMU translation in __access_memory() */
+	HIST_FAULT,		/* handle_page_fault() */
+	HIST_SWITCH,		/* switch_process() */
+	NR_HISTS,
+};
+
+/**
+ * Fault counters of the system. The histograms are kept per CPU in struct cpu
+ * since they are updated outside of mm_lock().
+ */
+struct vm_stats {
+	unsigned long nr_faults[NR_FAULT_CLASSES];
+
+	/* Huge pages mapped, and split into pte_directories */
+	unsigned long nr_huge_allocs;
+	unsigned long nr_huge_splits;
+
+	/* Pages moved to other frames to make room for huge pages */
+	unsigned long nr_migrations;
+
+	/* Latencies are measured only when profiling is enabled */
+	bool profiling;
+};
+
+struct vm_sim;
+
+void stats_init(struct vm_stats *stats, bool profiling);
+
+/***********************************************************************
+ * stats_count_fault()
+ *
+ * DESCRIPTION
+ *   Account a fault of @class to @stats and @nr_faults of a process.
+ */
+void stats_count_fault(struct vm_stats *stats, unsigned long *nr_faults,
+		enum fault_class class);
+
+const char *stats_fault_name(enum fault_class class);
+
+void hist_add(struct histogram *h, uint64_t ns);
+void __stats_record(enum stats_hist hist, uint64_t ns);
+
+static inline uint64_t stats_clock(struct vm_stats *stats)
+{
+	struct timespec ts;
+
+	if (!stats->profiling) return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Record the time elapsed since @start, which is obtained by stats_clock()
+ */
+static inline void stats_record(struct vm_stats *stats, enum stats_hist hist,
+		uint64_t start)
+{
+	if (!stats->profiling) return;
+
+	__stats_record(hist, stats_clock(stats) - start);
+}
+
+/* Print the fault counters and the histograms of @sim */
+void stats_show(struct vm_sim *sim);
+
+#endif
@@ -0,0 +1,202 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "types.h"
+#include "swap.h"
+
+int swap_init(struct swap_area *swap, unsigned int nr_slots,
+		unsigned int nr_pageframes, const char *path)
+{
+	memset(swap, 0x00, sizeof(*swap));
+	swap->fd = -1;
+
+	if (nr_slots == 0) return 0;
+
+	if (path) {
+		swap->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	} else {
+		FILE *fp = tmpfile();
+		if (fp) swap->fd = dup(fileno(fp));
+		if (fp) fclose(fp);
+	}
+	if (swap->fd < 0) return -1;
+
+	swap->swap_map = calloc(nr_slots, sizeof(*swap->swap_map));
+	swap->cache = calloc(nr_slots, sizeof(*swap->cache));
+	swap->cached_slot = calloc(nr_pageframes, sizeof(*swap->cached_slot));
+	if (!swap->swap_map || !swap->cache || !swap->cached_slot) goto out_free;
+
+	if (hbitmap_init(&swap->free_slots, nr_slots, true)) goto out_free;
+
+	swap->nr_slots = nr_slots;
+	return 0;
+
+out_free:
+	free(swap->swap_map);
+	free(swap->cache);
+	free(swap->cached_slot);
+	close(swap->fd);
+	swap->fd = -1;
+	return -1;
+}
+
+void swap_fini(struct swap_area *swap)
+{
+	if (!swap_enabled(swap)) return;
+
+	hbitmap_fini(&swap->free_slots);
+	free(swap->swap_map);
+	free(swap->cache);
+	free(swap->cached_slot);
+	close(swap->fd);
+
+	swap->nr_slots = 0;
+	swap->fd = -1;
+}
+
+long swap_alloc_slot(struct swap_area *swap)
+{
+	long slot = hbitmap_find_first(&swap->free_slots);
+
+	if (slot < 0) return -1;
+
+	hbitmap_clear(&swap->free_slots, slot);
+	swap->swap_map[slot] = 0;
+
+	return slot;
+}
+
+void swap_dup(struct swap_area *swap, unsigned int slot)
+{
+	swap->swap_map[slot]++;
+}
+
+void swap_free(struct swap_area *swap, unsigned int slot)
+{
+	if (--swap->swap_map[slot]) return;
+
+	/* The last swap entry is gone. Forget the cached frame as well */
+	if (swap->cache[slot]) {
+		swap->cached_slot[swap->cache[slot] - 1] = 0;
+		swap->cache[slot] = 0;
+	}
+	hbitmap_set(&swap->free_slots, slot);
+}
+
+int swap_writepage(struct swap_area *swap, unsigned int slot, unsigned int pfn,
+		unsigned int content)
+{
+	struct swap_slot data = {
+		.slot = slot,
+		.pfn = pfn,
+		.content = content,
+		.seq = swap->nr_swapouts,
+	};
+
+	if (pwrite(swap->fd, &data, sizeof(data), (off_t)slot * sizeof(data))
+			!= sizeof(data)) {
+		return -1;
+	}
+	swap->nr_swapouts++;
+	return 0;
+}
+
+int swap_readpage(struct swap_area *swap, unsigned int slot,
+		unsigned int *content)
+{
+	struct swap_slot data;
+
+	if (pread(swap->fd, &data, sizeof(data), (off_t)slot * sizeof(data))
+			!= sizeof(data)) {
+		return -1;
+	}
+	if (data.slot != slot) return -1;
+	*content = data.content;
+
+	swap->nr_swapins++;
+	return 0;
+}
+
+int swap_read_slots(struct swap_area *swap, struct swap_slot *slots)
+{
+	size_t size = sizeof(*slots) * swap->nr_slots;
+	ssize_t len = pread(swap->fd, slots, size, 0);
+
+	if (len < 0) return -1;
+
+	memset((char *)slots + len, 0x00, size - len);
+	return 0;
+}
+
+int swap_write_slots(struct swap_area *swap, const struct swap_slot *slots)
+{
+	size_t size = sizeof(*slots) * swap->nr_slots;
+
+	return pwrite(swap->fd, slots, size, 0) == size ? 0 : -1;
+}
+
+long swap_cache_lookup(struct swap_area *swap, unsigned int slot)
+{
+	if (!swap->cache[slot]) return -1;
+
+	swap->nr_cache_hits++;
+	return swap->cache[slot] - 1;
+}
+
+long swap_cache_slot(struct swap_area *swap, unsigned int pfn)
+{
+	if (!swap_enabled(swap) || !swap->cached_slot[pfn]) return -1;
+
+	return swap->cached_slot[pfn] - 1;
+}
+
+void swap_cache_add(struct swap_area *swap, unsigned int slot,
+		unsigned int pfn)
+{
+	swap->cache[slot] = pfn + 1;
+	swap->cached_slot[pfn] = slot + 1;
+}
+
+void swap_cache_drop_frame(struct swap_area *swap, unsigned int pfn)
+{
+	unsigned int slot;
+
+	if (!swap_enabled(swap) || !swap->cached_slot[pfn]) return;
+
+	slot = swap->cached_slot[pfn] - 1;
+	swap->cache[slot] = 0;
+	swap->cached_slot[pfn] = 0;
+}
+
+void swap_show(struct swap_area *swap, FILE *fp)
+{
+	unsigned int nr_used = 0;
+
+	for (unsigned int i = 0; i < swap->nr_slots; i++) {
+		if (!hbitmap_test(&swap->free_slots, i)) nr_used++;
+	}
+
+	fprintf(fp, "Swap %u / %u slots used\n", nr_used, swap->nr_slots);
+	fprintf(fp, "  swap-outs   : %lu\n", swap->nr_swapouts);
+	fprintf(fp, "  swap-ins    : %lu\n", swap->nr_swapins);
+	fprintf(fp, "  cache hits  : %lu\n", swap->nr_cache_hits);
+	fprintf(fp, "\n");
+}
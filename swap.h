@@ -0,0 +1,132 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __SWAP_H__
+#define __SWAP_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "bitmap.h"
+
+/**
+ * Swap area
+ *
+ * The swap area consists of @nr_slots slots in the swap file. When a page
+ * frame is swapped out, the PTEs mapping the frame are turned into swap
+ * entries that hold the slot number in @pfn with @swapped set.
+ * @swap_map[] counts the swap entries referring each slot, and the slot is
+ * released when the count drops to zero.
+ *
+ * When a swap entry is faulted in while the slot is still referenced by other
+ * swap entries, the frame is remembered in the swap cache so that the other
+ * entries are mapped to the same frame when they are faulted in.
+ */
+struct swap_area {
+	unsigned int nr_slots;
+	int fd;
+
+	unsigned int *swap_map;		/* # of swap entries for each slot */
+	struct hbitmap free_slots;
+
+	unsigned int *cache;		/* slot -> pfn + 1, 0 if not cached */
+	unsigned int *cached_slot;	/* pfn -> slot + 1, 0 if not cached */
+
+	unsigned long nr_swapouts;
+	unsigned long nr_swapins;
+	unsigned long nr_cache_hits;
+};
+
+/**
+ * Contents of a slot. Pages in the simulator do not have any content but the
+ * value for same-page merging (see ksm.h), so the slot keeps where the page
+ * came from to verify the swap-in.
+ */
+struct swap_slot {
+	uint32_t slot;
+	uint32_t pfn;
+	uint32_t content;
+	uint64_t seq;
+};
+
+static inline bool swap_enabled(struct swap_area *swap)
+{
+	return swap->nr_slots > 0;
+}
+
+/***********************************************************************
+ * swap_init()
+ *
+ * DESCRIPTION
+ *   Set up @swap with @nr_slots slots for @nr_pageframes page frames. The swap
+ *   file is created at @path, or an anonymous temporary file is used if @path
+ *   is NULL. @swap is left disabled if @nr_slots is zero.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 on error
+ */
+int swap_init(struct swap_area *swap, unsigned int nr_slots,
+		unsigned int nr_pageframes, const char *path);
+void swap_fini(struct swap_area *swap);
+
+/***********************************************************************
+ * swap_alloc_slot()
+ *
+ * DESCRIPTION
+ *   Reserve a free slot
+ *
+ * RETURN VALUE
+ *   Slot number on success
+ *   -1 if the swap area is full
+ */
+long swap_alloc_slot(struct swap_area *swap);
+
+/**
+ * Increase/decrease the number of swap entries referring @slot. The slot is
+ * released when the last swap entry goes away.
+ */
+void swap_dup(struct swap_area *swap, unsigned int slot);
+void swap_free(struct swap_area *swap, unsigned int slot);
+
+/**
+ * Write out the page frame @pfn holding @content to @slot / Read @slot back,
+ * and get its @content
+ */
+int swap_writepage(struct swap_area *swap, unsigned int slot, unsigned int pfn,
+		unsigned int content);
+int swap_readpage(struct swap_area *swap, unsigned int slot,
+		unsigned int *content);
+
+/**
+ * Copy the raw contents of all slots out of / into the swap file, so that
+ * snapshots can carry them. Slots never written read as zeros.
+ */
+int swap_read_slots(struct swap_area *swap, struct swap_slot *slots);
+int swap_write_slots(struct swap_area *swap, const struct swap_slot *slots);
+
+/**
+ * Swap cache. swap_cache_drop_frame() should be called when the page frame
+ * @pfn is not mapped by any PTE anymore.
+ */
+long swap_cache_lookup(struct swap_area *swap, unsigned int slot);
+long swap_cache_slot(struct swap_area *swap, unsigned int pfn);
+void swap_cache_add(struct swap_area *swap, unsigned int slot,
+		unsigned int pfn);
+void swap_cache_drop_frame(struct swap_area *swap, unsigned int pfn);
+
+void swap_show(struct swap_area *swap, FILE *fp);
+
+#endif
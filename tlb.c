@@ -0,0 +1,308 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "tlb.h"
+
+static const char * const policy_names[] = {
+	[TLB_POLICY_LRU] = "lru",
+	[TLB_POLICY_FIFO] = "fifo",
+	[TLB_POLICY_RANDOM] = "random",
+};
+
+int tlb_parse_policy(const char *name, enum tlb_policy *policy)
+{
+	for (int i = 0; i < sizeof(policy_names) / sizeof(*policy_names); i++) {
+		if (strcmp(name, policy_names[i]) == 0) {
+			*policy = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const char *tlb_policy_name(enum tlb_policy policy)
+{
+	return policy_names[policy];
+}
+
+int tlb_init(struct tlb *tlb, unsigned int nr_entries, unsigned int nr_ways,
+		enum tlb_policy policy, unsigned int huge_shift)
+{
+	memset(tlb, 0x00, sizeof(*tlb));
+
+	tlb->policy = policy;
+	tlb->huge_shift = huge_shift;
+	tlb->seed = 0x2021;
+
+	if (nr_entries == 0) return 0;
+
+	if (nr_ways == 0 || nr_ways > nr_entries || nr_entries % nr_ways) {
+		return -1;
+	}
+	tlb->nr_sets = nr_entries / nr_ways;
+	tlb->nr_ways = nr_ways;
+
+	/* Sets are indexed with the low bits of VPN */
+	if (tlb->nr_sets & (tlb->nr_sets - 1)) return -1;
+
+	tlb->entries = calloc(nr_entries, sizeof(*tlb->entries));
+	if (!tlb->entries) return -1;
+
+	return 0;
+}
+
+void tlb_fini(struct tlb *tlb)
+{
+	if (tlb->locked) pthread_mutex_destroy(&tlb->lock);
+	tlb->locked = false;
+
+	free(tlb->entries);
+	tlb->entries = NULL;
+	tlb->nr_sets = tlb->nr_ways = 0;
+}
+
+void tlb_enable_locking(struct tlb *tlb)
+{
+	pthread_mutex_init(&tlb->lock, NULL);
+	tlb->locked = true;
+}
+
+static inline void __tlb_lock(struct tlb *tlb)
+{
+	if (tlb->locked) pthread_mutex_lock(&tlb->lock);
+}
+
+static inline void __tlb_unlock(struct tlb *tlb)
+{
+	if (tlb->locked) pthread_mutex_unlock(&tlb->lock);
+}
+
+static inline struct tlb_entry *__tlb_set(struct tlb *tlb, unsigned int vpn)
+{
+	return tlb->entries + (vpn & (tlb->nr_sets - 1)) * tlb->nr_ways;
+}
+
+static inline struct tlb_entry *__tlb_find(struct tlb *tlb,
+		unsigned int asid, unsigned int vpn)
+{
+	struct tlb_entry *set = __tlb_set(tlb, vpn);
+
+	for (unsigned int i = 0; i < tlb->nr_ways; i++) {
+		struct tlb_entry *e = set + i;
+		if (e->valid && e->vpn == vpn && e->asid == asid && !e->huge) return e;
+	}
+	return NULL;
+}
+
+/* Find the huge entry covering @vpn */
+static inline struct tlb_entry *__tlb_find_huge(struct tlb *tlb,
+		unsigned int asid, unsigned int vpn)
+{
+	struct tlb_entry *set = __tlb_set(tlb, vpn >> tlb->huge_shift);
+	unsigned int base = (vpn >> tlb->huge_shift) << tlb->huge_shift;
+
+	for (unsigned int i = 0; i < tlb->nr_ways; i++) {
+		struct tlb_entry *e = set + i;
+		if (e->valid && e->vpn == base && e->asid == asid && e->huge) return e;
+	}
+	return NULL;
+}
+
+bool tlb_lookup(struct tlb *tlb, unsigned int asid, unsigned int vpn,
+		unsigned int rw, unsigned int *pfn)
+{
+	struct tlb_entry *e;
+
+	if (!tlb->entries) return false;
+
+	__tlb_lock(tlb);
+	e = __tlb_find(tlb, asid, vpn);
+	if (!e && tlb->huge_shift) e = __tlb_find_huge(tlb, asid, vpn);
+	if (!e || (rw == RW_WRITE && !e->writable)) {
+		tlb->nr_misses++;
+		__tlb_unlock(tlb);
+		return false;
+	}
+
+	if (tlb->policy == TLB_POLICY_LRU) e->stamp = ++tlb->clock;
+	tlb->nr_hits++;
+
+	*pfn = e->pfn;
+	if (e->huge) {
+		*pfn += vpn - e->vpn;
+		tlb->nr_huge_hits++;
+	}
+	__tlb_unlock(tlb);
+	return true;
+}
+
+static struct tlb_entry *__tlb_victim(struct tlb *tlb, struct tlb_entry *set)
+{
+	struct tlb_entry *victim = set;
+
+	for (unsigned int i = 0; i < tlb->nr_ways; i++) {
+		if (!set[i].valid) return set + i;
+	}
+
+	if (tlb->policy == TLB_POLICY_RANDOM) {
+		/* xorshift32 */
+		tlb->seed ^= tlb->seed << 13;
+		tlb->seed ^= tlb->seed >> 17;
+		tlb->seed ^= tlb->seed << 5;
+		return set + (tlb->seed % tlb->nr_ways);
+	}
+
+	/* Both LRU and FIFO evict the entry with the oldest stamp */
+	for (unsigned int i = 1; i < tlb->nr_ways; i++) {
+		if (set[i].stamp < victim->stamp) victim = set + i;
+	}
+	return victim;
+}
+
+static void __tlb_fill(struct tlb_entry *e, unsigned int asid, unsigned int vpn,
+		unsigned int pfn, bool writable, bool huge)
+{
+	e->valid = true;
+	e->writable = writable;
+	e->huge = huge;
+	e->asid = asid;
+	e->vpn = vpn;
+	e->pfn = pfn;
+}
+
+void tlb_insert(struct tlb *tlb, unsigned int asid, unsigned int vpn,
+		unsigned int pfn, bool writable)
+{
+	struct tlb_entry *e;
+
+	if (!tlb->entries) return;
+
+	__tlb_lock(tlb);
+	e = __tlb_find(tlb, asid, vpn);
+	if (!e) e = __tlb_victim(tlb, __tlb_set(tlb, vpn));
+
+	__tlb_fill(e, asid, vpn, pfn, writable, false);
+	e->stamp = ++tlb->clock;
+	__tlb_unlock(tlb);
+}
+
+void tlb_insert_huge(struct tlb *tlb, unsigned int asid, unsigned int vpn,
+		unsigned int pfn, bool writable)
+{
+	unsigned int offset = vpn & ((1U << tlb->huge_shift) - 1);
+	struct tlb_entry *e;
+
+	if (!tlb->entries || !tlb->huge_shift) return;
+
+	__tlb_lock(tlb);
+	e = __tlb_find_huge(tlb, asid, vpn);
+	if (!e) e = __tlb_victim(tlb, __tlb_set(tlb, vpn >> tlb->huge_shift));
+
+	__tlb_fill(e, asid, vpn - offset, pfn - offset, writable, true);
+	e->stamp = ++tlb->clock;
+	__tlb_unlock(tlb);
+}
+
+static void __tlb_invalidate(struct tlb *tlb, unsigned int asid, unsigned int vpn)
+{
+	struct tlb_entry *e = __tlb_find(tlb, asid, vpn);
+
+	if (e) {
+		e->valid = false;
+		tlb->nr_invalidations++;
+	}
+
+	if (!tlb->huge_shift) return;
+
+	e = __tlb_find_huge(tlb, asid, vpn);
+	if (e) {
+		e->valid = false;
+		tlb->nr_invalidations++;
+	}
+}
+
+static void __tlb_flush_asid(struct tlb *tlb, unsigned int asid)
+{
+	unsigned int nr_entries = tlb->nr_sets * tlb->nr_ways;
+
+	for (unsigned int i = 0; i < nr_entries; i++) {
+		struct tlb_entry *e = tlb->entries + i;
+
+		if (!e->valid || e->asid != asid) continue;
+		e->valid = false;
+		tlb->nr_invalidations++;
+	}
+}
+
+void tlb_invalidate(struct tlb *tlb, unsigned int asid, unsigned int vpn)
+{
+	if (!tlb->entries) return;
+
+	__tlb_lock(tlb);
+	__tlb_invalidate(tlb, asid, vpn);
+	__tlb_unlock(tlb);
+}
+
+void tlb_flush_asid(struct tlb *tlb, unsigned int asid)
+{
+	__tlb_lock(tlb);
+	__tlb_flush_asid(tlb, asid);
+	__tlb_unlock(tlb);
+}
+
+void tlb_flush_batch(struct tlb *tlb, const struct tlb_flush *batch,
+		unsigned int nr)
+{
+	__tlb_lock(tlb);
+	for (unsigned int i = 0; i < nr; i++) {
+		if (!tlb->entries) break;
+
+		if (batch[i].vpn == TLB_FLUSH_ALL) {
+			__tlb_flush_asid(tlb, batch[i].asid);
+		} else {
+			__tlb_invalidate(tlb, batch[i].asid, batch[i].vpn);
+		}
+	}
+	tlb->nr_shootdowns++;
+	__tlb_unlock(tlb);
+}
+
+void tlb_show(struct tlb *tlb, FILE *fp)
+{
+	unsigned long nr_lookups = tlb->nr_hits + tlb->nr_misses;
+
+	fprintf(fp, "TLB %u entries (%u sets x %u ways, %s)\n",
+			tlb->nr_sets * tlb->nr_ways, tlb->nr_sets, tlb->nr_ways,
+			tlb_policy_name(tlb->policy));
+	fprintf(fp, "  hits          : %lu\n", tlb->nr_hits);
+	fprintf(fp, "  misses        : %lu\n", tlb->nr_misses);
+	if (tlb->huge_shift) {
+		fprintf(fp, "  huge hits     : %lu\n", tlb->nr_huge_hits);
+	}
+	fprintf(fp, "  hit ratio     : %.2f%%\n",
+			nr_lookups ? 100.0 * tlb->nr_hits / nr_lookups : 0.0);
+	fprintf(fp, "  invalidations : %lu\n", tlb->nr_invalidations);
+	if (tlb->locked) {
+		fprintf(fp, "  shootdowns    : %lu\n", tlb->nr_shootdowns);
+	}
+	fprintf(fp, "\n");
+}
@@ -0,0 +1,174 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __TLB_H__
+#define __TLB_H__
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "types.h"
+
+/* Default geometry of the TLB */
+#define TLB_DEFAULT_ENTRIES	64
+#define TLB_DEFAULT_WAYS	4
+
+/**
+ * Replacement policies for picking a victim way in a set
+ */
+enum tlb_policy {
+	TLB_POLICY_LRU = 0,
+	TLB_POLICY_FIFO,
+	TLB_POLICY_RANDOM,
+};
+
+/**
+ * A TLB entry caches a successful translation of @vpn in the address space
+ * tagged with @asid. Entries are tagged so that the TLB does not need to be
+ * flushed on context switches.
+ *
+ * A huge entry translates 2^@huge_shift pages at once. Its @vpn and @pfn are
+ * those of the first page, and it is placed in the set indexed by the VPN
+ * shifted by @huge_shift.
+ */
+struct tlb_entry {
+	bool valid;
+	bool writable;
+	bool huge;
+	unsigned int asid;
+	unsigned int vpn;
+	unsigned int pfn;
+	unsigned long stamp;	/* Last use (LRU) or fill (FIFO) time */
+};
+
+/**
+ * Set-associative TLB
+ */
+struct tlb {
+	unsigned int nr_sets;
+	unsigned int nr_ways;
+	enum tlb_policy policy;
+	unsigned int huge_shift;	/* 0 if huge entries are not used */
+
+	struct tlb_entry *entries;	/* nr_sets * nr_ways entries */
+
+	unsigned long clock;
+	unsigned int seed;
+
+	/* Lookups of reads and writes. Alloc and free do not look up the TLB */
+	unsigned long nr_hits;
+	unsigned long nr_misses;
+	unsigned long nr_huge_hits;
+	unsigned long nr_invalidations;
+	unsigned long nr_shootdowns;	/* Batches flushed by tlb_flush_batch() */
+
+	/* Serialize the owner CPU against shootdowns from the other CPUs */
+	bool locked;
+	pthread_mutex_t lock;
+};
+
+/**
+ * An invalidation request in a shootdown batch. All entries tagged with
+ * @asid are invalidated if @vpn is TLB_FLUSH_ALL.
+ */
+struct tlb_flush {
+	unsigned int asid;
+	unsigned int vpn;
+};
+
+#define TLB_FLUSH_ALL	(~0U)
+
+/***********************************************************************
+ * tlb_init()
+ *
+ * DESCRIPTION
+ *   Initialize @tlb to hold @nr_entries entries organized in @nr_ways ways.
+ *   @nr_entries / @nr_ways should be a power of two. @nr_entries == 0 makes
+ *   the TLB disabled so that every lookup misses. Huge entries covering
+ *   2^@huge_shift pages can be filled unless @huge_shift is 0.
+ *
+ * RETURN VALUE
+ *   0 on success
+ *   -1 on invalid geometry or memory shortage
+ */
+int tlb_init(struct tlb *tlb, unsigned int nr_entries, unsigned int nr_ways,
+		enum tlb_policy policy, unsigned int huge_shift);
+void tlb_fini(struct tlb *tlb);
+
+/**
+ * Make @tlb safe to be accessed by multiple threads. Every operation on @tlb
+ * takes its lock afterward.
+ */
+void tlb_enable_locking(struct tlb *tlb);
+
+/***********************************************************************
+ * tlb_parse_policy()
+ *
+ * DESCRIPTION
+ *   Convert policy name (lru, fifo, random) into enum tlb_policy.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 if @name is unknown
+ */
+int tlb_parse_policy(const char *name, enum tlb_policy *policy);
+const char *tlb_policy_name(enum tlb_policy policy);
+
+/***********************************************************************
+ * tlb_lookup()
+ *
+ * DESCRIPTION
+ *   Look up the translation of @vpn in @asid. A write access (@rw is RW_WRITE)
+ *   to the entry that is not writable is regarded as a miss so that MMU can
+ *   walk the page table and raise the page fault.
+ *
+ * RETURN VALUE
+ *   @true on hit, and @pfn is set to the cached translation
+ *   @false on miss
+ */
+bool tlb_lookup(struct tlb *tlb, unsigned int asid, unsigned int vpn,
+		unsigned int rw, unsigned int *pfn);
+
+/**
+ * Fill the translation @vpn -> @pfn into @tlb, evicting a victim if needed
+ */
+void tlb_insert(struct tlb *tlb, unsigned int asid, unsigned int vpn,
+		unsigned int pfn, bool writable);
+
+/**
+ * Fill the huge translation covering @vpn -> @pfn into @tlb
+ */
+void tlb_insert_huge(struct tlb *tlb, unsigned int asid, unsigned int vpn,
+		unsigned int pfn, bool writable);
+
+/**
+ * Invalidate the entry for @vpn in @asid, including the huge entry covering
+ * @vpn. Should be called whenever the OS changes the PTE for @vpn.
+ */
+void tlb_invalidate(struct tlb *tlb, unsigned int asid, unsigned int vpn);
+
+/**
+ * Invalidate all entries tagged with @asid
+ */
+void tlb_flush_asid(struct tlb *tlb, unsigned int asid);
+
+/**
+ * Apply the @nr invalidation requests in @batch to @tlb at once
+ */
+void tlb_flush_batch(struct tlb *tlb, const struct tlb_flush *batch,
+		unsigned int nr);
+
+void tlb_show(struct tlb *tlb, FILE *fp);
+
+#endif
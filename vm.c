@@ -17,8 +17,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <getopt.h>
-#include <ctype.h>
 #include <inttypes.h>
 #include <strings.h>
 
@@ -27,77 +25,107 @@
 
 #include "list_head.h"
 #include "vm.h"
+#include "tlb.h"
+#include "cpu.h"
+#include "btrace.h"
+#include "swap.h"
+#include "reclaim.h"
+#include "slab.h"
+#include "output.h"
+#include "stats.h"
+#include "rmap.h"
+#include "snapshot.h"
+
+extern unsigned int alloc_page(struct vm_sim *sim, unsigned int vpn, unsigned int rw);
+extern bool free_page(struct vm_sim *sim, unsigned int vpn);
+extern unsigned int alloc_pages(struct vm_sim *sim, unsigned int vpn,
+		unsigned int nr, unsigned int stride, unsigned int rw, unsigned int *pfns);
+extern void free_pages(struct vm_sim *sim, unsigned int vpn, unsigned int nr,
+		unsigned int stride, enum free_result *results, unsigned int *pfns);
+extern bool handle_page_fault(struct vm_sim *sim, unsigned int vpn, unsigned int rw);
+extern void switch_process(struct vm_sim *sim, unsigned int pid);
+extern bool exit_process(struct vm_sim *sim, unsigned int pid);
+extern bool wait_process(struct vm_sim *sim, unsigned int pid);
+extern void merge_pages(struct vm_sim *sim);
+extern void scan_working_sets(struct vm_sim *sim);
+extern bool migrate_numa_page(struct vm_sim *sim, unsigned int pfn,
+		unsigned int node);
+extern bool set_memory_group(struct vm_sim *sim, unsigned int id);
+extern void set_memory_limit(struct vm_sim *sim, unsigned int nr);
+extern int init_pageframes(struct vm_sim *sim);
+extern void fini_pageframes(struct vm_sim *sim);
+extern int init_processes(struct vm_sim *sim);
+extern void fini_processes(struct vm_sim *sim);
+
+
+/* Look up the TLB of this CPU */
+static bool __tlb_translate(struct vm_sim *sim, unsigned int rw, unsigned int vpn, unsigned int *pfn)
+{
+	if (!tlb_lookup(&this_cpu->tlb, current->pid, vpn, rw, pfn)) return false;
 
-static bool verbose = true;
+	reclaim_mark_referenced(&sim->reclaim, *pfn);
+	return true;
+}
 
 /**
- * Initial process
+ * The entry that the last walk found for the directory @dir. The accesses to
+ * a range of VPNs hold mm_lock() while they stay in a directory, and those
+ * missing the TLB there take the entry instead of walking from the root.
+ * A fault may change the page table, so it drops the entry.
  */
-static struct process init = {
-	.pid = 0,
-	.list = LIST_HEAD_INIT(init.list),
-	.pagetable = {
-		.outer_ptes = { NULL },
-	},
+struct walk_cache {
+	bool locked;		/* mm_lock() is held */
+	bool valid;		/* @entry is for @dir */
+	unsigned int dir;	/* vpn >> PTES_PER_PAGE_SHIFT */
+	void *entry;
 };
 
-/**
- * Current process. Should not be listed in the @processes
- */
-struct process *current = &init;
-
-/**
- * Ready queue. Put @current process to the tail of this list on
- * switch_process(). Don't forget to remove the switched process from the list.
- */
-LIST_HEAD(processes);
-
-/**
- * Page table base register
- */
-struct pagetable *ptbr = NULL;
-
-/**
- * Map count for each page frame
- */
-unsigned int mapcounts[NR_PAGEFRAMES] = { 0 };
-
-
-extern unsigned int alloc_page(unsigned int vpn, unsigned int rw);
-extern void free_page(unsigned int vpn);
-extern bool handle_page_fault(unsigned int vpn, unsigned int rw);
-extern void switch_process(unsigned int pid);
-
+/* The bits that the MMU sets in the PTE translating an access for @rw */
+static inline uint64_t __pte_access_bits(unsigned int rw)
+{
+	return rw == RW_WRITE ? PTE_ACCESSED | PTE_DIRTY : PTE_ACCESSED;
+}
 
 /**
- * __translate()
- *
- * DESCRIPTION
- *   This function simulates the address translation in MMU.
- *   It translates @vpn to @pfn using the page table pointed by @ptbr.
- *
- * RETURN
- *   @true on successful translation
- *   @false if unable to translate. This includes the case when the page access
- *   is for write (indicated in @rw), but the @writable of the pte is @false.
+ * Walk the page table on a TLB miss. Should be called with mm_lock() held.
+ * @wc may be NULL. The translation is cached writable only if the PTE is
+ * dirty, so that the first write to the page walks here to set the bit.
  */
-static bool __translate(unsigned int rw, unsigned int vpn, unsigned int *pfn)
+static bool __walk_translate(struct vm_sim *sim, unsigned int rw, unsigned int vpn,
+		unsigned int *pfn, struct walk_cache *wc)
 {
-	int pd_index = vpn / NR_PTES_PER_PAGE;
 	int pte_index = vpn % NR_PTES_PER_PAGE;
 
 	struct pagetable *pt = ptbr;
 	struct pte_directory *pd;
+	struct huge_pte *h;
 	struct pte *pte;
 
-	/***
-	 * Advanced tasks: Implement TLB hook here
-	 */
-
 	/* Page table is invalid */
 	if (!pt) return false;
 
-	pd = pt->outer_ptes[pd_index];
+	if (wc && wc->valid && wc->dir == vpn >> PTES_PER_PAGE_SHIFT) {
+		pd = wc->entry;
+	} else {
+		pd = pt_lookup(sim, pt, vpn);
+		if (wc) {
+			wc->valid = true;
+			wc->dir = vpn >> PTES_PER_PAGE_SHIFT;
+			wc->entry = pd;
+		}
+	}
+
+	/* The whole directory is mapped with a huge page */
+	if (pt_huge(pd)) {
+		h = pt_to_huge(pd);
+		if (rw == RW_WRITE && !huge_pte_writable(h)) return false;
+
+		pte_set_flags(&h->pte, __pte_access_bits(rw));
+		*pfn = pte_pfn(&h->pte) + pte_index;
+		tlb_insert_huge(&this_cpu->tlb, current->pid, vpn, *pfn,
+				huge_pte_writable(h) && pte_test(&h->pte, PTE_DIRTY));
+		return true;
+	}
 
 	/* Page directory does not exist */
 	if (!pd) return false;
@@ -105,51 +133,154 @@ static bool __translate(unsigned int rw, unsigned int vpn, unsigned int *pfn)
 	pte = &pd->ptes[pte_index];
 
 	/* PTE is invalid */
-	if (!pte->valid) return false;
+	if (!pte_valid(pte)) return false;
 
 	/* Unable to handle the write access */
 	if (rw == RW_WRITE) {
-		if (!pte->writable) return false;
+		if (!pte_writable(pd, pte)) return false;
 	}
-	*pfn = pte->pfn;
+	pte_set_flags(pte, __pte_access_bits(rw));
+	*pfn = pte_pfn(pte);
+	reclaim_mark_referenced(&sim->reclaim, *pfn);
+
+	tlb_insert(&this_cpu->tlb, current->pid, vpn, *pfn,
+			pte_writable(pd, pte) && pte_test(pte, PTE_DIRTY));
 
 	return true;
 }
 
+/**
+ * Find the page frame mapped to @vpn without accessing it. Unlike the MMU in
+ * __access_memory(), nothing is marked referenced or accessed, and the TLB is
+ * neither looked up nor filled, since alloc and free are not accesses.
+ */
+static bool __lookup_page(struct vm_sim *sim, unsigned int vpn, unsigned int *pfn)
+{
+	void *entry = ptbr ? pt_lookup(sim, ptbr, vpn) : NULL;
+	struct pte_directory *pd = entry;
+	struct pte *pte;
+
+	if (!pd) return false;
+
+	if (pt_huge(entry)) {
+		*pfn = pte_pfn(&pt_to_huge(entry)->pte) + vpn % NR_PTES_PER_PAGE;
+		return true;
+	}
+
+	pte = &pd->ptes[vpn % NR_PTES_PER_PAGE];
+	if (!pte_valid(pte)) return false;
+
+	*pfn = pte_pfn(pte);
+	return true;
+}
+
+/**
+ * Classify the fault on @vpn by the PTE, as the MMU reports in the error code
+ */
+static enum fault_type __fault_type(struct vm_sim *sim, unsigned int vpn)
+{
+	void *entry = ptbr ? pt_lookup(sim, ptbr, vpn) : NULL;
+	struct pte_directory *pd = entry;
+	struct pte *pte;
+
+	if (!pd) return FAULT_NOT_PRESENT;
+	if (pt_huge(entry)) return FAULT_PROTECTION;
+
+	pte = &pd->ptes[vpn % NR_PTES_PER_PAGE];
+	if (pte_valid(pte)) return FAULT_PROTECTION;
+	if (pte_swapped(pte)) return FAULT_SWAPPED;
+
+	return FAULT_NOT_PRESENT;
+}
+
+/**
+ * Move the page in @pfn to the home node of @current after the remote
+ * accesses to it. The access may have hit the TLB without mm_lock(), so the
+ * lock is taken here and left held as @wc->locked tells.
+ */
+static void __balance_numa(struct vm_sim *sim, unsigned int pfn,
+		struct walk_cache *wc)
+{
+	if (!wc->locked) {
+		mm_lock(sim);
+		wc->locked = true;
+	}
+	wc->valid = false;
+
+	migrate_numa_page(sim, pfn, current->numa.node);
+	tlb_shootdown_flush(sim);
+}
+
+/**
+ * Give the page in @pfn the content written to @vpn. The contents change under
+ * mm_lock() only, so a write that hit the TLB takes the lock unless the content
+ * is there already, and leaves it held as @wc->locked tells. The frame may have
+ * been evicted or merged since the hit, so @vpn should still map @pfn.
+ */
+static void __write_content(struct vm_sim *sim, unsigned int vpn,
+		unsigned int pfn, struct walk_cache *wc)
+{
+	unsigned int content = ksm_write_content(vpn);
+	unsigned int mapped;
+
+	if (ksm_content(&sim->ksm, pfn) == content) return;
+
+	if (!wc->locked) {
+		mm_lock(sim);
+		wc->locked = true;
+		wc->valid = false;
+	}
+	if (__lookup_page(sim, vpn, &mapped) && mapped == pfn) {
+		ksm_set_content(&sim->ksm, pfn, content);
+	}
+}
+
 /**
  * __access_memory
  *
  * DESCRIPTION
  *   Simulate the MMU in the processor and call page fault handler
- *   if necessary.
+ *   if necessary. mm_lock() is taken on a TLB miss and left held as
+ *   @wc->locked tells.
  *
  * RETURN
  *   @true on successful access
  *   @false if unable to access @vpn for @rw
  */
-static bool __access_memory(unsigned int vpn, unsigned int rw)
+static bool __access_memory(struct vm_sim *sim, unsigned int vpn, unsigned int rw,
+		struct walk_cache *wc)
 {
 	unsigned int pfn;
 	int ret;
 	int nr_retries = 0;
+	uint64_t start;
+	bool translated, hit;
 
 	/* Cannot read and write at the same time!! */
 	assert((rw & RW_READ) ^ (rw & RW_WRITE));
 
 	/**
-	 * We have NR_PTES_PER_PAGE entries in the outer table and so do for
-	 * inner page table. Thus each process can have up to NR_PTES_PER_PAGE^2
+	 * We have NR_PTES_PER_PAGE entries in each table of NR_PT_LEVELS levels.
+	 * Thus each process can have up to NR_PTES_PER_PAGE^NR_PT_LEVELS
 	 * as its VPN
 	 */
-	assert(vpn < NR_PTES_PER_PAGE * NR_PTES_PER_PAGE);
+	assert(vpn < NR_VPNS);
 
 	do {
-		/* Ask MMU to translate VPN */
-		if (__translate(rw, vpn, &pfn)) {
-			/* Success on address translation */
-			fprintf(stderr, "%3u --> %-3u\n", vpn, pfn);
-			return true;
+		/* Ask MMU to translate VPN. TLB hits do not need mm_lock() */
+		start = stats_clock(&sim->stats);
+		translated = hit = __tlb_translate(sim, rw, vpn, &pfn);
+		if (!translated) {
+			if (!wc->locked) {
+				mm_lock(sim);
+				wc->locked = true;
+				wc->valid = false;
+			}
+			translated = __walk_translate(sim, rw, vpn, &pfn, wc);
 		}
+		stats_record(&sim->stats, HIST_TRANSLATE, start);
+
+		if (translated) break;
 
 		/**
 		 * Failed to translate the address. So, call OS through the page fault
@@ -157,99 +288,306 @@ static bool __access_memory(unsigned int vpn, unsigned int rw)
 		 * Count the number of retries to prevent buggy translation.
 		 */
 		nr_retries++;
-	} while ((ret = handle_page_fault(vpn, rw)) == true && nr_retries < 2);
+		output_fault(sim, current->pid, vpn, rw, __fault_type(sim, vpn));
+
+		start = stats_clock(&sim->stats);
+		ret = handle_page_fault(sim, vpn, rw);
+		wc->valid = false;
+		tlb_shootdown_flush(sim);
+		stats_record(&sim->stats, HIST_FAULT, start);
+	} while (ret == true && nr_retries < 2);
+
+	if (translated) {
+		/* Success on address translation */
+		readahead_hit(&sim->readahead, pfn);
+		if (rw == RW_WRITE && ksm_enabled(&sim->ksm)) {
+			__write_content(sim, vpn, pfn, wc);
+		}
+		output_access(sim, current->pid, vpn, rw, true, pfn);
+		evtrace_emit(&sim->evtrace, this_cpu->id, hit ? EVTRACE_HIT : EVTRACE_MISS,
+				current->pid, vpn, pfn, rw);
+		if (numa_account(&sim->numa, &current->numa, pfn)) {
+			__balance_numa(sim, pfn, wc);
+		}
+		return true;
+	}
 
 	if (ret == false) {
-		fprintf(stderr, "Unable to access %u\n", vpn);
+		output_access(sim, current->pid, vpn, rw, false, 0);
+		evtrace_emit(&sim->evtrace, this_cpu->id, EVTRACE_MISS,
+				current->pid, vpn, EVTRACE_NO_PFN, rw);
 	}
 
 	return ret;
 }
 
-static unsigned int __make_rwflag(const char *rw)
+/* VPN of the @i-th page that @rec operates on */
+static inline unsigned int __record_vpn(const struct trace_record *rec,
+		unsigned int i)
+{
+	return rec->arg + i * rec->stride;
+}
+
+/* Number of the pages of @rec from the @i-th one in the same pte_directory */
+static unsigned int __nr_in_directory(struct vm_sim *sim,
+		const struct trace_record *rec, unsigned int i)
+{
+	unsigned int vpn = __record_vpn(rec, i);
+	unsigned int nr = ((vpn | (NR_PTES_PER_PAGE - 1)) - vpn) / rec->stride + 1;
+
+	return nr < rec->nr - i ? nr : rec->nr - i;
+}
+
+/**
+ * __access_range
+ *
+ * DESCRIPTION
+ *   Access the pages of @rec for @rw one by one. mm_lock() is held from the
+ *   first TLB miss in a pte_directory until the range leaves the directory,
+ *   so the page table is walked once for each directory unless faults
+ *   change it.
+ */
+static void __access_range(struct vm_sim *sim, const struct trace_record *rec,
+		unsigned int rw)
+{
+	struct walk_cache wc = { 0 };
+
+	for (unsigned int i = 0; i < rec->nr; i++) {
+		unsigned int vpn = __record_vpn(rec, i);
+
+		/* Let the other CPUs in between directories */
+		if (wc.locked && vpn >> PTES_PER_PAGE_SHIFT != wc.dir) {
+			mm_unlock(sim);
+			wc.locked = false;
+		}
+		__access_memory(sim, vpn, rw, &wc);
+	}
+	if (wc.locked) mm_unlock(sim);
+}
+
+static unsigned int __make_rwflag(const struct token *rw)
 {
-	int len = strlen(rw);
 	unsigned int rwflag = 0;
 
-	for (int i = 0; i < len; i++) {
-		if (rw[i] == 'r' || rw[i] == 'R') {
+	for (unsigned int i = 0; i < rw->len; i++) {
+		if (rw->str[i] == 'r' || rw->str[i] == 'R') {
 			rwflag |= RW_READ;
 		}
-		if (rw[i] == 'w' || rw[i] == 'W') {
+		if (rw->str[i] == 'w' || rw->str[i] == 'W') {
 			rwflag |= RW_WRITE;
 		}
 	}
 	return rwflag;
 }
 
-static bool __alloc_page(unsigned int vpn, unsigned int rw)
+static bool __alloc_page(struct vm_sim *sim, unsigned int vpn, unsigned int rw)
 {
+	void *entry = ptbr ? pt_lookup(sim, ptbr, vpn) : NULL;
 	unsigned int pfn;
 
 	assert(rw);
 
-	if (__translate(RW_READ, vpn, &pfn)) {
-		fprintf(stderr, "%u is already allocated to %u\n", vpn, pfn);
-		return false;
+	/* alloc_page() takes or splits a huge page for @rw */
+	if (!(entry && pt_huge(entry)) && __lookup_page(sim, vpn, &pfn)) {
+		if (!readahead_speculative(&sim->readahead, pfn)) {
+			output_alloc(sim, current->pid, vpn, rw, ALLOC_EXIST, pfn);
+			return false;
+		}
+		/* A page mapped ahead gives way to the allocation for @rw */
+		free_page(sim, vpn);
 	}
 
-	pfn = alloc_page(vpn, rw);
-	if (pfn == -1) {
-		fprintf(stderr, "memory is full\n");
+	pfn = alloc_page(sim, vpn, rw);
+	if (pfn == (unsigned int)-1) {
+		output_alloc(sim, current->pid, vpn, rw, ALLOC_FULL, 0);
 		return false;
 	}
-	fprintf(stderr, "alloc %3u --> %-3u\n", vpn, pfn);
-	
+	output_alloc(sim, current->pid, vpn, rw, ALLOC_OK, pfn);
+
 	return true;
 }
 
-static bool __free_page(unsigned int vpn)
+static bool __free_page(struct vm_sim *sim, unsigned int vpn)
 {
 	unsigned int pfn;
 
-	if (!__translate(RW_READ, vpn, &pfn)) {
-		fprintf(stderr, "%u is not allocated\n", vpn);
+	if (!__lookup_page(sim, vpn, &pfn)) {
+		/* The page may be swapped out */
+		if (free_page(sim, vpn)) {
+			output_free(sim, current->pid, vpn, FREE_SWAPPED, 0);
+			return true;
+		}
+		output_free(sim, current->pid, vpn, FREE_NONE, 0);
 		return false;
 	}
-	fprintf(stderr, "free %u (pfn %u)\n", vpn, pfn);
-	free_page(vpn);
+	output_free(sim, current->pid, vpn, FREE_OK, pfn);
+	free_page(sim, vpn);
 
 	return true;
 }
 
-static void __init_system(void)
+/**
+ * __alloc_range
+ *
+ * DESCRIPTION
+ *   Allocate the pages of @rec a pte_directory at a time with alloc_pages().
+ *   The page that alloc_pages() stops at goes through __alloc_page() to
+ *   tell why, which stops the range like it does the simulation.
+ *
+ * RETURN
+ *   @false if a page cannot be allocated
+ */
+static bool __alloc_range(struct vm_sim *sim, const struct trace_record *rec)
 {
-	ptbr = &init.pagetable;
+	unsigned int *pfns = malloc(sizeof(*pfns) * NR_PTES_PER_PAGE);
+	unsigned int i = 0;
+	bool ret = true;
+
+	if (!pfns) return false;
+
+	while (ret && i < rec->nr) {
+		unsigned int nr = __nr_in_directory(sim, rec, i);
+		unsigned int nr_allocated;
+
+		mm_lock(sim);
+		nr_allocated = alloc_pages(sim, __record_vpn(rec, i), nr,
+				rec->stride, rec->rw, pfns);
+		for (unsigned int j = 0; j < nr_allocated; j++) {
+			output_alloc(sim, current->pid, __record_vpn(rec, i + j),
+					rec->rw, ALLOC_OK, pfns[j]);
+		}
+		i += nr_allocated;
+
+		if (nr_allocated < nr) {
+			ret = __alloc_page(sim, __record_vpn(rec, i), rec->rw);
+			i++;
+		}
+		mm_unlock(sim);
+	}
+	free(pfns);
+
+	return ret;
 }
 
-static void __show_pageframes(void)
+/* Free the pages of @rec a pte_directory at a time with free_pages() */
+static void __free_range(struct vm_sim *sim, const struct trace_record *rec)
+{
+	enum free_result *results = malloc(sizeof(*results) * NR_PTES_PER_PAGE);
+	unsigned int *pfns = malloc(sizeof(*pfns) * NR_PTES_PER_PAGE);
+
+	if (!results || !pfns) goto out_free;
+
+	for (unsigned int i = 0; i < rec->nr; ) {
+		unsigned int nr = __nr_in_directory(sim, rec, i);
+
+		mm_lock(sim);
+		free_pages(sim, __record_vpn(rec, i), nr, rec->stride, results, pfns);
+		for (unsigned int j = 0; j < nr; j++) {
+			output_free(sim, current->pid, __record_vpn(rec, i + j), results[j],
+					results[j] == FREE_OK ? pfns[j] : 0);
+		}
+		mm_unlock(sim);
+		i += nr;
+	}
+
+out_free:
+	free(results);
+	free(pfns);
+}
+
+/**
+ * Show the number of processes mapping each page frame. Since @mapcounts
+ * counts a shared pte_directory once, count the processes sharing the
+ * directories in the reverse mapping of each frame.
+ */
+static void __show_pageframes(struct vm_sim *sim)
 {
 	for (unsigned int i = 0; i < NR_PAGEFRAMES; i++) {
-		if (!mapcounts[i]) continue;
-		fprintf(stderr, "%3u: %d\n", i, mapcounts[i]);
+		unsigned int nr = rmap_nr_processes(sim, i);
+
+		if (!nr) continue;
+		fprintf(sim->output.fp, "%3u: %d\n", i, nr);
 	}
-	fprintf(stderr, "\n");
+	fprintf(sim->output.fp, "\n");
 }
 
-static void __show_pagetable(void)
+static void __show_pte_directory(struct vm_sim *sim, struct pte_directory *pd, unsigned int *indices)
 {
-	fprintf(stderr, "\n*** PID %u ***\n", current->pid);
+	/* Skip the PTEs at once if none is worth showing */
+	bool all = sim->verbose;
+	int nr = all || pte_count_present(pd->ptes, NR_PTES_PER_PAGE) ?
+			NR_PTES_PER_PAGE : 0;
 
-	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
-		struct pte_directory *pd = current->pagetable.outer_ptes[i];
+	for (int i = 0; i < nr; i++) {
+		struct pte *pte = &pd->ptes[i];
+
+		if (!all && !pte_present(pte)) continue;
+
+		for (int level = 0; level < NR_PT_LEVELS - 1; level++) {
+			fprintf(sim->output.fp, "%02d:", indices[level]);
+		}
+		fprintf(sim->output.fp, "%02d %c%c | %-3d\n", i,
+			pte_valid(pte) ? 'v' : (pte_swapped(pte) ? 's' : ' '),
+			pte_writable(pd, pte) ? 'w' : ' ',
+			pte_pfn(pte));
+	}
+	printf("\n");
+}
 
-		if (!pd) continue;
+static void __show_huge_pte(struct vm_sim *sim, struct huge_pte *h,
+		unsigned int *indices)
+{
+	for (int level = 0; level < NR_PT_LEVELS - 1; level++) {
+		fprintf(sim->output.fp, "%02d:", indices[level]);
+	}
+	fprintf(sim->output.fp, "** h%c | %-3d\n",
+		huge_pte_writable(h) ? 'w' : ' ', pte_pfn(&h->pte));
+}
 
-		for (int j = 0; j < NR_PTES_PER_PAGE; j++) {
-			struct pte *pte = &pd->ptes[j];
+static void __show_table(struct vm_sim *sim, void **table, unsigned int level, unsigned int *indices)
+{
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		if (!table[i]) continue;
 
-			if (!verbose && !pte->valid) continue;
-			fprintf(stderr, "%02d:%02d %c%c | %-3d\n", i, j,
-				pte->valid ? 'v' : ' ',
-				pte->writable ? 'w' : ' ',
-				pte->pfn);
+		indices[level] = i;
+		if (level == NR_PT_LEVELS - 2 && pt_huge(table[i])) {
+			__show_huge_pte(sim, pt_to_huge(table[i]), indices);
+		} else if (level == NR_PT_LEVELS - 2) {
+			__show_pte_directory(sim, table[i], indices);
+		} else {
+			__show_table(sim, table[i], level + 1, indices);
 		}
-		printf("\n");
+	}
+}
+
+static void __show_pagetable(struct vm_sim *sim)
+{
+	unsigned int indices[NR_PT_LEVELS];
+
+	if (!current) {
+		fprintf(sim->output.fp, "\n*** CPU %u is idle ***\n", this_cpu->id);
+		return;
+	}
+
+	fprintf(sim->output.fp, "\n*** PID %u ***\n", current->pid);
+
+	if (!current->pagetable.outer_ptes) return;
+
+	__show_table(sim, current->pagetable.outer_ptes, 0, indices);
+}
+
+static void __show_tlbs(struct vm_sim *sim)
+{
+	struct cpu *cpu;
+
+	if (sim->nr_cpus == 1) {
+		tlb_show(&this_cpu->tlb, sim->output.fp);
+		return;
+	}
+
+	for_each_cpu(sim, cpu) {
+		fprintf(sim->output.fp, "CPU %u: ", cpu->id);
+		tlb_show(&cpu->tlb, sim->output.fp);
 	}
 }
 
@@ -260,8 +598,21 @@ static void __print_help(void)
 	printf("\n");
 	printf("  switch [pid] : Do context switch to pid @pid\n");
 	printf("                 Fork @pid if there is no process with the pid\n");
+	printf("  kill [pid]   : Terminate the process @pid and tear down its memory\n");
+	printf("  wait [pid]   : Reap the terminated child @pid of the current process\n");
+	printf("  merge        : Merge the identical pages now (with -k)\n");
+	printf("  group [id]   : Move the current process into the memory group @id\n");
+	printf("                 Create @id under the current group if there is none\n");
+	printf("  limit [nr]   : Limit the group of the current process to @nr pages\n");
+	printf("  save         : Save the state to the snapshot file (with -S)\n");
+	printf("  load         : Restore the state from the snapshot file (with -S)\n");
 	printf("  show         : Show the page table of the current process\n");
 	printf("  pages        : Show the status for each page frame\n");
+	printf("  tlb          : Show the TLB statistics\n");
+	printf("  swap         : Show the swap statistics\n");
+	printf("  slabs        : Show the occupancy of the object caches\n");
+	printf("  stats        : Show the page fault counters and latencies\n");
+	printf("  who [pfn]    : Show the processes mapping the page frame @pfn\n");
 	printf("\n");
 	printf("  alloc [vpn] r|w  : Allocate a page for the rw flag\n");
 	printf("  free [vpn]       : Deallocate the page at VPN @vpn\n");
@@ -269,137 +620,738 @@ static void __print_help(void)
 	printf("  read [vpn]       : Equivalent to access @vpn r\n");
 	printf("  write [vpn]      : Equivalent to access @vpn w\n");
 	printf("\n");
+	printf("  [vpn] of the commands above can be a range [first]-[last], or\n");
+	printf("  [first]-[last]:[stride] to take every @stride VPNs in the range\n");
+	printf("\n");
+	printf("  Prefix a command with @[cpu] to run it on CPU @cpu (default: 0)\n");
+	printf("\n");
+}
+
+static inline bool __digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+/**
+ * __parse_number()
+ *
+ * DESCRIPTION
+ *   Convert the number at @str as strtoimax() does in base 0, and put where
+ *   the number ends into @end. Short decimal numbers, which traces are mostly
+ *   made of, are converted right here.
+ */
+static unsigned int __parse_number(const char *str, char **end)
+{
+	const char *s = str;
+	unsigned int number = 0;
+
+	if (*s == '0') {
+		/* Octal or hexadecimal */
+		if (__digit(s[1]) || s[1] == 'x' || s[1] == 'X') {
+			return strtoimax(str, end, 0);
+		}
+		*end = (char *)s + 1;
+		return 0;
+	}
+
+	/* Up to 9 digits never overflow */
+	while (__digit(*s) && s - str < 9) {
+		number = number * 10 + (*s++ - '0');
+	}
+	if (s == str || __digit(*s)) return strtoimax(str, end, 0);
+
+	*end = (char *)s;
+	return number;
+}
+
+/**
+ * __parse_vpns()
+ *
+ * DESCRIPTION
+ *   Parse the VPNs of a memory operation in @token into @rec. @token is
+ *   a VPN, a range [first]-[last], or a strided range [first]-[last]:[stride].
+ *
+ * RETURN
+ *   0 on success
+ *   -1 if the range is malformed
+ */
+static int __parse_vpns(char *token, struct trace_record *rec)
+{
+	char *end;
+	unsigned int last;
+
+	rec->arg = __parse_number(token, &end);
+	if (*end != '-') return 0;
+
+	last = __parse_number(end + 1, &end);
+	if (*end == ':') rec->stride = __parse_number(end + 1, &end);
+
+	if (*end != '\0' || last < rec->arg || rec->stride == 0) return -1;
+
+	rec->nr = (last - rec->arg) / rec->stride + 1;
+	return 0;
 }
 
-static bool strmatch(char * const str, const char *expect)
+/**
+ * Commands of text traces, grouped by their first letter. __find_command()
+ * switches on the first letter, and compares the command with the few in
+ * the group.
+ */
+struct trace_command {
+	const char *name;
+	unsigned int len;
+	enum trace_op op;
+	int nr_args;
+};
+
+#define TRACE_COMMAND(name, op, nr_args)	\
+	{ name, sizeof(name) - 1, op, nr_args }
+
+static const struct trace_command commands_a[] = {
+	TRACE_COMMAND("a", TRACE_OP_ALLOC, 2),
+	TRACE_COMMAND("alloc", TRACE_OP_ALLOC, 2),
+	TRACE_COMMAND("access", TRACE_OP_ACCESS, 2),
+	{ NULL },
+};
+
+static const struct trace_command commands_e[] = {
+	TRACE_COMMAND("exit", TRACE_OP_EXIT, 0),
+	{ NULL },
+};
+
+static const struct trace_command commands_f[] = {
+	TRACE_COMMAND("f", TRACE_OP_FREE, 1),
+	TRACE_COMMAND("free", TRACE_OP_FREE, 1),
+	{ NULL },
+};
+
+static const struct trace_command commands_g[] = {
+	TRACE_COMMAND("group", TRACE_OP_GROUP, 1),
+	{ NULL },
+};
+
+static const struct trace_command commands_h[] = {
+	TRACE_COMMAND("help", TRACE_OP_HELP, 0),
+	{ NULL },
+};
+
+static const struct trace_command commands_k[] = {
+	TRACE_COMMAND("kill", TRACE_OP_KILL, 1),
+	{ NULL },
+};
+
+static const struct trace_command commands_l[] = {
+	TRACE_COMMAND("load", TRACE_OP_LOAD, 0),
+	TRACE_COMMAND("limit", TRACE_OP_LIMIT, 1),
+	{ NULL },
+};
+
+static const struct trace_command commands_m[] = {
+	TRACE_COMMAND("merge", TRACE_OP_MERGE, 0),
+	{ NULL },
+};
+
+static const struct trace_command commands_p[] = {
+	TRACE_COMMAND("pages", TRACE_OP_PAGES, 0),
+	{ NULL },
+};
+
+static const struct trace_command commands_r[] = {
+	TRACE_COMMAND("r", TRACE_OP_READ, 1),
+	TRACE_COMMAND("read", TRACE_OP_READ, 1),
+	{ NULL },
+};
+
+static const struct trace_command commands_s[] = {
+	TRACE_COMMAND("s", TRACE_OP_SWITCH, 1),
+	TRACE_COMMAND("switch", TRACE_OP_SWITCH, 1),
+	TRACE_COMMAND("show", TRACE_OP_SHOW, 0),
+	TRACE_COMMAND("swap", TRACE_OP_SWAP, 0),
+	TRACE_COMMAND("slabs", TRACE_OP_SLABS, 0),
+	TRACE_COMMAND("stats", TRACE_OP_STATS, 0),
+	TRACE_COMMAND("save", TRACE_OP_SAVE, 0),
+	{ NULL },
+};
+
+static const struct trace_command commands_t[] = {
+	TRACE_COMMAND("tlb", TRACE_OP_TLB, 0),
+	{ NULL },
+};
+
+static const struct trace_command commands_w[] = {
+	TRACE_COMMAND("w", TRACE_OP_WRITE, 1),
+	TRACE_COMMAND("write", TRACE_OP_WRITE, 1),
+	TRACE_COMMAND("who", TRACE_OP_WHO, 1),
+	TRACE_COMMAND("wait", TRACE_OP_WAIT, 1),
+	{ NULL },
+};
+
+static const struct trace_command commands_etc[] = {
+	TRACE_COMMAND("?", TRACE_OP_HELP, 0),
+	{ NULL },
+};
+
+static const struct trace_command *__find_command(const struct token *token)
 {
-	return (strlen(str) == strlen(expect)) &&
-			(strncmp(str, expect, strlen(expect)) == 0);
+	const struct trace_command *command;
+
+	switch (token->str[0]) {
+	case 'a': command = commands_a; break;
+	case 'e': command = commands_e; break;
+	case 'f': command = commands_f; break;
+	case 'g': command = commands_g; break;
+	case 'h': command = commands_h; break;
+	case 'k': command = commands_k; break;
+	case 'l': command = commands_l; break;
+	case 'm': command = commands_m; break;
+	case 'p': command = commands_p; break;
+	case 'r': command = commands_r; break;
+	case 's': command = commands_s; break;
+	case 't': command = commands_t; break;
+	case 'w': command = commands_w; break;
+	case '?': command = commands_etc; break;
+	default: return NULL;
+	}
+
+	for (; command->name; command++) {
+		if (command->len == token->len &&
+				memcmp(command->name, token->str, token->len) == 0) {
+			return command;
+		}
+	}
+	return NULL;
 }
 
-static void __do_simulation(FILE *input)
+/**
+ * __parse_record()
+ *
+ * DESCRIPTION
+ *   Convert the command in @tokens into @rec.
+ *
+ * RETURN
+ *   0 on success
+ *   -1 if the command is unknown
+ */
+static int __parse_record(struct token tokens[], int nr_tokens, struct trace_record *rec)
 {
-	char command[MAX_COMMAND_LEN] = { 0 };
+	const struct trace_command *command;
+	char *end;
+
+	rec->rw = 0;
+	rec->arg = 0;
+	rec->cpu = 0;
+	rec->nr = 1;
+	rec->stride = 1;
+
+	if (tokens[0].str[0] == '@') {
+		rec->cpu = __parse_number(tokens[0].str + 1, &end);
+		tokens++;
+		nr_tokens--;
+	}
+	if (nr_tokens == 0) return -1;
+
+	command = __find_command(&tokens[0]);
+	if (!command || command->nr_args != nr_tokens - 1) return -1;
+
+	rec->op = command->op;
+
+	switch (rec->op) {
+	case TRACE_OP_ACCESS:
+	case TRACE_OP_ALLOC:
+		rec->rw = __make_rwflag(&tokens[2]);
+		/* Fall through */
+	case TRACE_OP_READ:
+	case TRACE_OP_WRITE:
+	case TRACE_OP_FREE:
+		return __parse_vpns(tokens[1].str, rec);
+	default:
+		if (command->nr_args) rec->arg = __parse_number(tokens[1].str, &end);
+		return 0;
+	}
+}
 
-	__init_system();
+/**
+ * vm_read_record()
+ *
+ * DESCRIPTION
+ *   Read lines from the text trace @input until a command is parsed into
+ *   @rec. Unknown commands are reported to stdout, followed by the prompt if
+ *   @verbose.
+ *
+ * RETURN
+ *   @true if @rec is read
+ *   @false on the end of @input
+ */
+bool vm_read_record(FILE *input, struct trace_record *rec, bool verbose)
+{
+	char command[MAX_COMMAND_LEN];
 
 	while (fgets(command, sizeof(command), input)) {
-		char *tokens[MAX_NR_TOKENS] = { NULL };
-		int nr_tokens = 0;
+		struct token tokens[MAX_NR_TOKENS];
+		int nr_tokens;
+
+		if (!parse_command(command, &nr_tokens, tokens)) continue;
+
+		if (__parse_record(tokens, nr_tokens, rec) == 0) return true;
 
-		/* Make the command lowercase */
-		for (size_t i = 0; i < strlen(command); i++) {
-			command[i] = tolower(command[i]);
+		printf("Unknown command %s\n", tokens[0].str);
+		if (verbose) printf(">> ");
+	}
+	return false;
+}
+
+/**
+ * __run_record()
+ *
+ * DESCRIPTION
+ *   Dispatch @rec to the simulator.
+ *
+ * RETURN
+ *   @false if the simulation should be stopped
+ *   @true otherwise
+ */
+static bool __run_record(struct vm_sim *sim, const struct trace_record *rec)
+{
+	bool ret;
+
+	/* Memory operations need a process to run, for each VPN as one by one */
+	if (!current && rec->op <= TRACE_OP_FREE) {
+		for (unsigned int i = 0; i < rec->nr; i++) {
+			fprintf(sim->output.fp, "cpu %u is idle\n", this_cpu->id);
 		}
+		return true;
+	}
 
-		if (parse_command(command, &nr_tokens, tokens) < 0) {
-			continue;
+	switch (rec->op) {
+	case TRACE_OP_READ:
+		__access_range(sim, rec, RW_READ);
+		break;
+	case TRACE_OP_WRITE:
+		__access_range(sim, rec, RW_WRITE);
+		break;
+	case TRACE_OP_ACCESS:
+		__access_range(sim, rec, rec->rw);
+		break;
+	case TRACE_OP_ALLOC:
+		if (rec->nr > 1) return __alloc_range(sim, rec);
+
+		mm_lock(sim);
+		ret = __alloc_page(sim, rec->arg, rec->rw);
+		mm_unlock(sim);
+		return ret;
+	case TRACE_OP_FREE:
+		if (rec->nr > 1) {
+			__free_range(sim, rec);
+			break;
 		}
-		if (nr_tokens == 0) continue;
-
-		if (nr_tokens == 1) {
-			if (strmatch(tokens[0], "exit")) break;
-			if (strmatch(tokens[0], "show")) {
-				__show_pagetable();
-			} else if (strmatch(tokens[0], "pages")) {
-				__show_pageframes();
-			} else if (strmatch(tokens[0], "help") || strmatch(tokens[0], "?")) {
-				__print_help();
-			} else {
-				printf("Unknown command %s\n", tokens[0]);
-			}
-		} else if (nr_tokens == 2) {
-			unsigned int arg = strtoimax(tokens[1], NULL, 0);
-
-			if (strmatch(tokens[0], "switch") || strmatch(tokens[0], "s")) {
-				switch_process(arg);
-			} else if (strmatch(tokens[0], "free") || strmatch(tokens[0], "f")) {
-				__free_page(arg);
-			} else if (strmatch(tokens[0], "read") || strmatch(tokens[0], "r")) {
-				__access_memory(arg, RW_READ);
-			} else if (strmatch(tokens[0], "write") || strmatch(tokens[0], "w")) {
-				__access_memory(arg, RW_WRITE);
-			} else {
-				printf("Unknown command %s\n", tokens[0]);
-			}
-		} else if (nr_tokens == 3) {
-			unsigned int vpn = strtoimax(tokens[1], NULL, 0);
-			unsigned int rw = __make_rwflag(tokens[2]);
-
-			if (strmatch(tokens[0], "alloc") || strmatch(tokens[0], "a")) {
-				if (!__alloc_page(vpn, rw)) break;
-			} else if (strmatch(tokens[0], "access")) {
-				__access_memory(vpn, rw);
-			} else {
-				printf("Unknown command %s\n", tokens[0]);
-			}
+		mm_lock(sim);
+		__free_page(sim, rec->arg);
+		mm_unlock(sim);
+		break;
+	case TRACE_OP_SWITCH: {
+		struct process *prev = current;
+		uint64_t start = stats_clock(&sim->stats);
+
+		mm_lock(sim);
+		switch_process(sim, rec->arg);
+		mm_unlock(sim);
+		stats_record(&sim->stats, HIST_SWITCH, start);
+		if (current != prev) {
+			output_switch(sim, prev ? (int)prev->pid : -1, current->pid);
+		}
+		break;
+	}
+	case TRACE_OP_SHOW:
+		__show_pagetable(sim);
+		break;
+	case TRACE_OP_PAGES:
+		__show_pageframes(sim);
+		break;
+	case TRACE_OP_TLB:
+		__show_tlbs(sim);
+		break;
+	case TRACE_OP_SWAP:
+		swap_show(&sim->swap, sim->output.fp);
+		break;
+	case TRACE_OP_SLABS:
+		slab_show(&sim->slab_caches, sim->output.fp);
+		break;
+	case TRACE_OP_STATS:
+		stats_show(sim);
+		break;
+	case TRACE_OP_WHO:
+		rmap_show(sim, rec->arg);
+		break;
+	case TRACE_OP_KILL:
+		mm_lock(sim);
+		exit_process(sim, rec->arg);
+		mm_unlock(sim);
+		break;
+	case TRACE_OP_WAIT:
+		mm_lock(sim);
+		wait_process(sim, rec->arg);
+		mm_unlock(sim);
+		break;
+	case TRACE_OP_MERGE:
+		if (!ksm_enabled(&sim->ksm)) break;
+		mm_lock(sim);
+		merge_pages(sim);
+		mm_unlock(sim);
+		break;
+	case TRACE_OP_GROUP:
+	case TRACE_OP_LIMIT:
+		if (!current) {
+			fprintf(sim->output.fp, "cpu %u is idle\n", this_cpu->id);
+			break;
+		}
+		mm_lock(sim);
+		if (rec->op == TRACE_OP_GROUP) {
+			set_memory_group(sim, rec->arg);
 		} else {
-			assert(!"Unknown command in trace");
+			set_memory_limit(sim, rec->arg);
+		}
+		mm_unlock(sim);
+		break;
+	case TRACE_OP_SAVE:
+	case TRACE_OP_LOAD:
+		if (!sim->snapshot_path) {
+			fprintf(sim->output.fp, "No snapshot file is given\n");
+			break;
 		}
+		mm_lock(sim);
+		if (rec->op == TRACE_OP_SAVE) {
+			snapshot_save(sim, sim->snapshot_path);
+		} else {
+			snapshot_load(sim, sim->snapshot_path);
+		}
+		mm_unlock(sim);
+		break;
+	case TRACE_OP_HELP:
+		__print_help();
+		break;
+	case TRACE_OP_EXIT:
+	default:
+		return false;
+	}
+	return true;
+}
 
-		if (verbose) printf(">> ");
+/**
+ * __dispatch_record()
+ *
+ * DESCRIPTION
+ *   Run @rec on the CPU @rec->cpu. In the SMP mode, the records operating on
+ *   the process of the CPU are queued to the CPU, and the others wait for all
+ *   CPUs to complete the records queued so far, and then run on this thread.
+ *
+ * RETURN
+ *   @false if the simulation should be stopped
+ *   @true otherwise
+ */
+static bool __dispatch_record(struct vm_sim *sim, const struct trace_record *rec)
+{
+	bool ret;
+
+	if (rec->cpu >= sim->nr_cpus) {
+		fprintf(sim->output.fp, "No cpu %u\n", rec->cpu);
+		return true;
+	}
+
+	/* The merging scanner runs every @interval records in the background */
+	if (ksm_tick(&sim->ksm)) {
+		if (sim->nr_cpus > 1 && !cpus_sync(sim)) return false;
+		mm_lock(sim);
+		merge_pages(sim);
+		mm_unlock(sim);
 	}
+
+	/* So does the working set scanner every @interval accesses */
+	if (wss_tick(&sim->wss, rec->op <= TRACE_OP_ACCESS ? rec->nr : 0)) {
+		if (sim->nr_cpus > 1 && !cpus_sync(sim)) return false;
+		mm_lock(sim);
+		scan_working_sets(sim);
+		mm_unlock(sim);
+	}
+
+	if (sim->nr_cpus == 1) return __run_record(sim, rec);
+
+	switch (rec->op) {
+	case TRACE_OP_READ:
+	case TRACE_OP_WRITE:
+	case TRACE_OP_ACCESS:
+	case TRACE_OP_ALLOC:
+	case TRACE_OP_FREE:
+	case TRACE_OP_SWITCH:
+		return cpu_queue(sim, rec);
+	default:
+		break;
+	}
+
+	/* Nothing runs after a queued record stopped the simulation */
+	if (!cpus_sync(sim)) return false;
+	this_cpu = sim->cpus + rec->cpu;
+	ret = __run_record(sim, rec);
+	this_cpu = sim->cpus;
+
+	return ret;
 }
 
-static void __print_usage(const char * name)
+static int __start_cpus(struct vm_sim *sim)
 {
-	printf("Usage: %s {-q} {-f [workload file]}\n", name);
-	printf("\n");
-	printf("  -q: Run quietly\n\n");
+	if (sim->nr_cpus == 1) return 0;
+
+	if (cpus_start(sim, __run_record)) {
+		fprintf(stderr, "Unable to start %u cpus\n", sim->nr_cpus);
+		return -1;
+	}
+	return 0;
 }
 
-int main(int argc, char * argv[])
+static void __stop_cpus(struct vm_sim *sim)
+{
+	if (sim->nr_cpus == 1) return;
+
+	cpus_stop(sim);
+}
+
+int vm_sim_run(struct vm_sim *sim, FILE *input)
+{
+	struct trace_record rec;
+
+	if (__start_cpus(sim)) return -1;
+
+	while (vm_read_record(input, &rec, sim->verbose)) {
+		if (!__dispatch_record(sim, &rec)) break;
+
+		if (sim->verbose) printf(">> ");
+	}
+
+	__stop_cpus(sim);
+	return 0;
+}
+
+/**
+ * vm_sim_replay()
+ *
+ * DESCRIPTION
+ *   Replay the binary trace mapped in @r. Records are dispatched as they are
+ *   decoded without any string handling.
+ */
+int vm_sim_replay(struct vm_sim *sim, struct btrace_reader *r)
 {
-	int opt;
-	FILE *input = stdin;
+	struct trace_record rec;
+	bool stopped = false;
 
-	while ((opt = getopt(argc, argv, "qh")) != -1) {
-		switch (opt) {
-		case 'q':
-			verbose = false;
+	if (__start_cpus(sim)) return -1;
+
+	while (btrace_next(r, &rec)) {
+		if (!__dispatch_record(sim, &rec)) {
+			stopped = true;
 			break;
-		case 'h':
-		default:
-			__print_usage(argv[0]);
-			return EXIT_FAILURE;
 		}
 	}
 
-	if (verbose && !argv[optind]) {
-		printf("***************************************************************************\n");
-		printf(" __      ____  __     _____ _                 _       _\n");
-		printf(" \\ \\    / /  \\/  |   / ____(_)               | |     | |\n");
-		printf("  \\ \\  / /| \\  / |  | (___  _ _ __ ___  _   _| | __ _| |_ ___  _ __ \n");
-		printf("   \\ \\/ / | |\\/| |   \\___ \\| | '_ ` _ \\| | | | |/ _` | __/ _ \\| '__|\n");
-		printf("    \\  /  | |  | |   ____) | | | | | | | |_| | | (_| | || (_) | |   \n");
-		printf("     \\/   |_|  |_|  |_____/|_|_| |_| |_|\\__,_|_|\\__,_|\\__\\___/|_|\n");
-		printf("\n");
-		printf("                                            >> SCE213 2021 Spring <<\n");
-		printf("\n");
-		printf("***************************************************************************\n");
+	__stop_cpus(sim);
+
+	if (!stopped && r->pos < r->end) {
+		fprintf(sim->output.fp, "Truncated trace at offset %zu\n",
+				(size_t)(r->pos - (const uint8_t *)r->map));
+	}
+	return 0;
+}
+
+void vm_config_init(struct vm_config *config)
+{
+	*config = (struct vm_config) {
+		.nr_pageframes = DEFAULT_NR_PAGEFRAMES,
+		.nr_ptes = 1 << DEFAULT_PTES_PER_PAGE_SHIFT,
+		.nr_pt_levels = DEFAULT_NR_PT_LEVELS,
+		.nr_cpus = 1,
+		.tlb_entries = TLB_DEFAULT_ENTRIES,
+		.tlb_ways = TLB_DEFAULT_WAYS,
+		.tlb_policy = TLB_POLICY_LRU,
+		.swap_slots = 0,
+		.swap_policy = "clock",
+		.swap_path = NULL,
+		.thp = false,
+		.readahead_max = ~0U,
+		.numa_policy = NUMA_POLICY_FIRST_TOUCH,
+		.output = OUTPUT_FULL,
+		.profiling = false,
+		.verbose = true,
+	};
+}
+
+int vm_config_check(const struct vm_config *config)
+{
+	unsigned int nr_ptes = config->nr_ptes;
+
+	if (nr_ptes < 2 || (nr_ptes & (nr_ptes - 1))) {
+		fprintf(stderr, "The number of PTEs should be a power of 2\n");
+		return -1;
+	}
+	if (config->nr_pt_levels < 2) {
+		fprintf(stderr, "Need at least 2 levels of page table\n");
+		return -1;
 	}
+	if (__builtin_ctz(nr_ptes) * config->nr_pt_levels > 32) {
+		fprintf(stderr, "VPN cannot exceed 32 bits\n");
+		return -1;
+	}
+	if (config->nr_pageframes == 0) {
+		fprintf(stderr, "Need at least one page frame\n");
+		return -1;
+	}
+	if (config->nr_cpus == 0 || config->nr_cpus > MAX_NR_CPUS) {
+		fprintf(stderr, "Number of CPUs should be 1 to %d\n", MAX_NR_CPUS);
+		return -1;
+	}
+	if (config->fault_around > nr_ptes ||
+			(config->fault_around & (config->fault_around - 1))) {
+		fprintf(stderr, "Fault-around window should be a power of 2 up to %u\n",
+				nr_ptes);
+		return -1;
+	}
+	if (config->numa_nodes > NUMA_MAX_NODES ||
+			config->numa_nodes > config->nr_pageframes) {
+		fprintf(stderr, "Number of NUMA nodes should be up to %d and the page frames\n",
+				NUMA_MAX_NODES);
+		return -1;
+	}
+	return 0;
+}
 
-	if (argv[optind]) {
-		if (verbose) printf("Use file \"%s\" for input.\n", argv[optind]);
+static void __fini_system(struct vm_sim *sim)
+{
+	evtrace_fini(&sim->evtrace);
+
+	if (sim->pid_hash) fini_processes(sim);
+	rmap_fini(sim);
+	fini_pageframes(sim);
+	free(sim->mapcounts);
+	free(sim->huge_mapcounts);
+
+	cpus_fini(sim);
+	ksm_fini(&sim->ksm);
+	readahead_fini(&sim->readahead);
+	wss_fini(&sim->wss);
+	numa_fini(&sim->numa);
+	memcg_fini(&sim->memcg);
+	reclaim_fini(&sim->reclaim);
+	swap_fini(&sim->swap);
+}
+
+int vm_sim_init(struct vm_sim *sim, const struct vm_config *config, FILE *fp)
+{
+	if (vm_config_check(config)) return -1;
+
+	memset(sim, 0x00, sizeof(*sim));
+
+	sim->nr_pageframes = config->nr_pageframes;
+	sim->ptes_per_page_shift = __builtin_ctz(config->nr_ptes);
+	sim->nr_pt_levels = config->nr_pt_levels;
+	sim->verbose = config->verbose;
+	sim->thp = config->thp;
+	sim->snapshot_path = config->snapshot_path;
+
+	sim->init.pid = 0;
+	INIT_LIST_HEAD(&sim->init.list);
+	INIT_LIST_HEAD(&sim->init.children);
+	INIT_LIST_HEAD(&sim->init.sibling);
+	INIT_LIST_HEAD(&sim->processes);
+	INIT_LIST_HEAD(&sim->slab_caches);
+
+	stats_init(&sim->stats, config->profiling);
+
+	if (cpus_init(sim, config->nr_cpus,
+			config->tlb_entries, config->tlb_ways, config->tlb_policy)) {
+		fprintf(stderr, "Invalid TLB configuration %u:%u\n",
+				config->tlb_entries, config->tlb_ways);
+		return -1;
+	}
 
-		input = fopen(argv[optind], "r");
-		if (!input) {
-			fprintf(stderr, "No input file %s\n", argv[optind]);
-			return EXIT_FAILURE;
+	if (config->swap_slots) {
+		if (swap_init(&sim->swap, config->swap_slots, NR_PAGEFRAMES,
+					config->swap_path) ||
+				reclaim_init(&sim->reclaim, config->swap_policy, NR_PAGEFRAMES)) {
+			fprintf(stderr, "Unable to set up swap\n");
+			goto out_fini;
 		}
-		verbose = false;
-	} else {
-		if (verbose) printf("Use stdin for input.\n");
 	}
 
-	if (verbose) {
-		printf("Enter 'help' or '?' for help.\n\n");
-		printf(">> ");
+	if (ksm_init(&sim->ksm, config->ksm_interval, NR_PAGEFRAMES)) {
+		fprintf(stderr, "Unable to set up same-page merging\n");
+		goto out_fini;
+	}
+
+	if (readahead_init(&sim->readahead, config->fault_around,
+			config->readahead_max < NR_PTES_PER_PAGE ?
+					config->readahead_max : NR_PTES_PER_PAGE,
+			NR_PAGEFRAMES)) {
+		fprintf(stderr, "Unable to set up fault-around\n");
+		goto out_fini;
 	}
 
-	__do_simulation(input);
+	if (wss_init(&sim->wss, config->wss_interval, config->wss_path)) {
+		fprintf(stderr, "Unable to write working sets to %s\n",
+				config->wss_path);
+		goto out_fini;
+	}
+
+	if (numa_init(&sim->numa, config->numa_nodes, config->numa_policy,
+			config->numa_threshold, NR_PAGEFRAMES)) {
+		fprintf(stderr, "Unable to set up NUMA nodes\n");
+		goto out_fini;
+	}
 
-	if (input != stdin) fclose(input);
+	if (memcg_init(&sim->memcg, NR_PAGEFRAMES)) {
+		fprintf(stderr, "Unable to set up memory groups\n");
+		goto out_fini;
+	}
+	sim->init.memcg = &sim->memcg.root;
+
+	sim->mapcounts = calloc(NR_PAGEFRAMES, sizeof(*sim->mapcounts));
+	if (!sim->mapcounts) {
+		fprintf(stderr, "Unable to allocate %u page frames\n", NR_PAGEFRAMES);
+		goto out_fini;
+	}
+	if (sim->thp) {
+		sim->huge_mapcounts = calloc((NR_PAGEFRAMES >> PTES_PER_PAGE_SHIFT) + 1,
+				sizeof(*sim->huge_mapcounts));
+		if (!sim->huge_mapcounts) {
+			fprintf(stderr, "Unable to allocate %u page frames\n", NR_PAGEFRAMES);
+			goto out_fini;
+		}
+	}
+	if (init_pageframes(sim)) goto out_fini;
+
+	/* CPU 0 starts with the init process, and the others are idle */
+	current = &sim->init;
+	ptbr = &sim->init.pagetable;
+	if (init_processes(sim)) goto out_fini;
+	if (rmap_init(sim)) goto out_fini;
+
+	if (config->restore_path && snapshot_load(sim, config->restore_path)) {
+		goto out_fini;
+	}
+
+	if (evtrace_init(&sim->evtrace, sim->nr_cpus, config->evtrace_path)) {
+		fprintf(stderr, "Unable to record events to %s\n", config->evtrace_path);
+		goto out_fini;
+	}
+
+	output_init(sim, config->output, fp);
+	return 0;
+
+out_fini:
+	__fini_system(sim);
+	return -1;
+}
+
+void vm_sim_fini(struct vm_sim *sim)
+{
+	if (sim->stats.profiling) stats_show(sim);
+	output_fini(sim);
 
-	return EXIT_SUCCESS;
+	__fini_system(sim);
 }
@@ -15,39 +15,270 @@
 #ifndef __VM_H__
 #define __VM_H__
 
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
 #include "types.h"
+#include "list_head.h"
+#include "bitmap.h"
+#include "tlb.h"
+#include "btrace.h"
+#include "slab.h"
+#include "swap.h"
+#include "reclaim.h"
+#include "output.h"
+#include "stats.h"
+#include "rmap.h"
+#include "ksm.h"
+#include "readahead.h"
+#include "wss.h"
+#include "numa.h"
+#include "memcg.h"
+#include "evtrace.h"
+#include "snapshot.h"
+
+/**
+ * Geometry of the system. They are configured at startup and remain
+ * constant during the simulation. Since each simulation has its own geometry,
+ * the macros below refer to that of the simulation @sim in the scope.
+ */
+#define DEFAULT_NR_PAGEFRAMES		128
+#define DEFAULT_PTES_PER_PAGE_SHIFT	4
+#define DEFAULT_NR_PT_LEVELS		2
 
 /* The number of physical page frames of the system */
-#define NR_PAGEFRAMES	128
+#define NR_PAGEFRAMES	(sim->nr_pageframes)
 
 /* The number of PTEs in a page */
-#define PTES_PER_PAGE_SHIFT	4
+#define PTES_PER_PAGE_SHIFT	(sim->ptes_per_page_shift)
 #define NR_PTES_PER_PAGE    (1 << PTES_PER_PAGE_SHIFT)
 
+/* The number of page table levels, including the last-level pte_directory */
+#define NR_PT_LEVELS	(sim->nr_pt_levels)
+
+/* Each process can have up to NR_PTES_PER_PAGE^NR_PT_LEVELS pages */
+#define NR_VPNS		(1UL << (PTES_PER_PAGE_SHIFT * NR_PT_LEVELS))
+
 #define RW_READ  0x01
 #define RW_WRITE 0x02
 
 /**
- * 2-level page table abstraction
+ * N-level page table abstraction
+ *
+ * The page table is a radix tree. The outer-most table and the intermediate
+ * tables are arrays of NR_PTES_PER_PAGE pointers to the next level tables,
+ * and the last-level tables are pte_directories. Tables are populated only
+ * when a page is mapped under them.
+ *
+ * A PTE is packed into a 64-bit word with the flags in the lower half and the
+ * pfn in the upper half, so a pte_directory is a plain array of words. Use the
+ * accessors below instead of the word itself. An unused PTE is all zero.
  */
 struct pte {
-	bool valid;
-	bool writable;
-	unsigned int pfn;
-	unsigned int private;	/* May use to backup something ;-) */
+	uint64_t word;		/* PTE_* flags, and the pfn from PTE_PFN_SHIFT */
 };
 
+#define PTE_VALID	(1ULL << 0)
+#define PTE_WRITABLE	(1ULL << 1)
+#define PTE_COW		(1ULL << 2)	/* Write-protected for copy-on-write */
+#define PTE_ACCESSED	(1ULL << 3)
+#define PTE_DIRTY	(1ULL << 4)
+#define PTE_SWAPPED	(1ULL << 5)	/* Swapped out. The pfn is the swap slot */
+
+#define PTE_PFN_SHIFT	32
+#define PTE_FLAGS_MASK	((1ULL << PTE_PFN_SHIFT) - 1)
+
+static inline bool pte_test(struct pte *pte, uint64_t flags)
+{
+	return pte->word & flags;
+}
+
+static inline bool pte_valid(struct pte *pte)
+{
+	return pte_test(pte, PTE_VALID);
+}
+
+static inline bool pte_swapped(struct pte *pte)
+{
+	return pte_test(pte, PTE_SWAPPED);
+}
+
+/* Whether @pte maps a page frame or a swap slot */
+static inline bool pte_present(struct pte *pte)
+{
+	return pte_test(pte, PTE_VALID | PTE_SWAPPED);
+}
+
+static inline unsigned int pte_pfn(struct pte *pte)
+{
+	return pte->word >> PTE_PFN_SHIFT;
+}
+
+static inline void pte_set_flags(struct pte *pte, uint64_t flags)
+{
+	pte->word |= flags;
+}
+
+static inline void pte_clear_flags(struct pte *pte, uint64_t flags)
+{
+	pte->word &= ~flags;
+}
+
+static inline void pte_set_pfn(struct pte *pte, unsigned int pfn)
+{
+	pte->word = (pte->word & PTE_FLAGS_MASK) | (uint64_t)pfn << PTE_PFN_SHIFT;
+}
+
+static inline void pte_set(struct pte *pte, unsigned int pfn, uint64_t flags)
+{
+	pte->word = (uint64_t)pfn << PTE_PFN_SHIFT | flags;
+}
+
+static inline void pte_clear(struct pte *pte)
+{
+	pte->word = 0;
+}
+
+/**
+ * Bulk operations over an array of PTEs. They work on the words without
+ * branches so that the compiler can vectorize the loops.
+ */
+
+/* Turn the writable PTEs mapping a frame or a slot into copy-on-write ones */
+static inline void pte_wrprotect_all(struct pte *ptes, unsigned int nr)
+{
+	for (unsigned int i = 0; i < nr; i++) {
+		uint64_t word = ptes[i].word;
+		uint64_t wr = word & PTE_WRITABLE &
+			-(uint64_t)((word & (PTE_VALID | PTE_SWAPPED)) != 0);
+
+		/* PTE_COW is the bit next to PTE_WRITABLE */
+		ptes[i].word = (word & ~wr) | (wr << 1);
+	}
+}
+
+/* The number of PTEs that have all of @flags */
+static inline unsigned int pte_count(struct pte *ptes, unsigned int nr,
+		uint64_t flags)
+{
+	unsigned int count = 0;
+
+	for (unsigned int i = 0; i < nr; i++)
+		count += (ptes[i].word & flags) == flags;
+
+	return count;
+}
+
+/* The number of PTEs mapping a frame or a slot */
+static inline unsigned int pte_count_present(struct pte *ptes, unsigned int nr)
+{
+	unsigned int count = 0;
+
+	for (unsigned int i = 0; i < nr; i++)
+		count += (ptes[i].word & (PTE_VALID | PTE_SWAPPED)) != 0;
+
+	return count;
+}
+
+/**
+ * A pte_directory can be shared by multiple processes after fork. While it is
+ * shared (@refcount > 1), the directory is write-protected as a whole as if
+ * the upper-level entries pointing to it are read-only. A process should
+ * get its own copy of the directory before modifying any PTE in it.
+ *
+ * The processes sharing the directory are listed in @sharers, so that the
+ * reverse mapping can tell who maps the pages in it (see rmap.h).
+ */
 struct pte_directory {
-	struct pte ptes[NR_PTES_PER_PAGE];
+	unsigned int refcount;	/* The number of page tables pointing this */
+	unsigned int vpn;	/* VPN mapped by ptes[0] */
+	struct list_head sharers;
+	struct pte ptes[];	/* NR_PTES_PER_PAGE entries */
 };
 
+#define PTE_DIRECTORY_SIZE	\
+	(sizeof(struct pte_directory) + sizeof(struct pte) * NR_PTES_PER_PAGE)
+
 struct pagetable {
-	struct pte_directory *outer_ptes[NR_PTES_PER_PAGE];
+	void **outer_ptes;	/* NULL if nothing is mapped */
+};
+
+/**
+ * Whether @pte in @pd can be written. PTEs in a shared directory are not
+ * writable regardless of their PTE_WRITABLE.
+ */
+static inline bool pte_writable(struct pte_directory *pd, struct pte *pte)
+{
+	return pte_test(pte, PTE_WRITABLE) && pd->refcount == 1;
+}
+
+/**
+ * Huge page mapping
+ *
+ * Instead of pointing to a pte_directory, an entry of the tables right above
+ * the pte_directories can map NR_PTES_PER_PAGE contiguous page frames at once
+ * with a single PTE. The first frame is aligned to NR_PTES_PER_PAGE. Such
+ * entries are tagged with PT_HUGE in the lowest bit of the pointer. Like
+ * pte_directories, huge PTEs are shared on fork by @refcount, list their
+ * @sharers, and are write-protected while shared.
+ */
+struct huge_pte {
+	unsigned int refcount;
+	unsigned int vpn;	/* The first VPN of the huge page */
+	struct list_head sharers;
+	struct pte pte;		/* The pfn is the first page frame */
+};
+
+#define PT_HUGE		0x1UL
+
+static inline bool pt_huge(void *entry)
+{
+	return (uintptr_t)entry & PT_HUGE;
+}
+
+static inline struct huge_pte *pt_to_huge(void *entry)
+{
+	return (struct huge_pte *)((uintptr_t)entry & ~PT_HUGE);
+}
+
+static inline void *huge_to_pt(struct huge_pte *h)
+{
+	return (void *)((uintptr_t)h | PT_HUGE);
+}
+
+static inline bool huge_pte_writable(struct huge_pte *h)
+{
+	return pte_test(&h->pte, PTE_WRITABLE) && h->refcount == 1;
+}
+
+/**
+ * Memory footprint of a process, kept up to date as pages are mapped and
+ * unmapped so that it is read without walking the page table.
+ *
+ * @resident counts the VPNs mapped to page frames, and @shared those whose
+ * frame is mapped at some other place too; by another process, at another VPN,
+ * or through a directory or a huge PTE shared with another process after fork.
+ * @nr_pt_pages counts the tables and the pte_directories that the page table
+ * refers to. A directory shared by processes is counted in each of them.
+ */
+struct rss {
+	unsigned long resident;
+	unsigned long shared;
+	unsigned long nr_pt_pages;
 };
 
+static inline unsigned long rss_private(struct rss *rss)
+{
+	return rss->resident - rss->shared;
+}
 
 /**
  * Simplified PCB
+ *
+ * An exited process has no address space, and stays as a zombie in the pid
+ * hash table until its parent waits for it. Children of an exited process
+ * are handed over to the init process.
  */
 struct process {
 	unsigned int pid;
@@ -55,6 +286,288 @@ struct process {
 	struct pagetable pagetable;
 
 	struct list_head list;  /* List head to chain processes on the system */
+	struct hlist_node hash;	/* Chained in the pid hash table */
+
+	struct process *parent;		/* NULL for the init process */
+	struct list_head children;
+	struct list_head sibling;	/* Chained in @children of the parent */
+	bool exited;
+
+	struct readahead_state readahead;
+	struct wss_sample wss;		/* In the last scan of the working sets */
+	struct numa_state numa;
+
+	struct rss rss;
+	struct mem_group *memcg;	/* Group that new pages are charged to */
+
+	unsigned long nr_faults[NR_FAULT_CLASSES];
 };
 
+struct cpu;
+
+/**
+ * Configuration of a simulation. vm_config_init() fills in the defaults.
+ */
+struct vm_config {
+	unsigned int nr_pageframes;
+	unsigned int nr_ptes;		/* PTEs per page table, power of 2 */
+	unsigned int nr_pt_levels;
+	unsigned int nr_cpus;
+
+	unsigned int tlb_entries;	/* 0 to disable the TLB */
+	unsigned int tlb_ways;
+	enum tlb_policy tlb_policy;
+
+	unsigned int swap_slots;	/* 0 to disable the swap */
+	const char *swap_policy;
+	const char *swap_path;		/* NULL for an anonymous file */
+
+	bool thp;			/* Map huge pages when possible */
+	unsigned int ksm_interval;	/* 0 to disable same-page merging */
+
+	unsigned int fault_around;	/* 0 to map only the faulting page */
+	unsigned int readahead_max;	/* Clipped to a page table */
+
+	unsigned int wss_interval;	/* 0 not to scan the working sets */
+	const char *wss_path;		/* Time series of the working sets, or NULL */
+
+	unsigned int numa_nodes;	/* 0 not to simulate NUMA */
+	enum numa_policy numa_policy;
+	unsigned int numa_threshold;	/* 0 not to move pages between nodes */
+
+	const char *snapshot_path;	/* For the save and load commands */
+	const char *restore_path;	/* Snapshot to start from, or NULL */
+
+	const char *evtrace_path;	/* Events of the CPUs, or NULL */
+
+	enum output_level output;
+	bool profiling;
+	bool verbose;
+};
+
+/**
+ * Simulation context
+ *
+ * Everything a simulation works on lives here, so that independent
+ * simulations can run in one process at the same time, each on its own
+ * threads. The framework and the OS functions are given the simulation to
+ * work on as @sim. The per-CPU states such as @current and @ptbr are in the
+ * CPUs of the simulation (see cpu.h).
+ */
+struct vm_sim {
+	/* Geometry of the system */
+	unsigned int nr_pageframes;
+	unsigned int ptes_per_page_shift;
+	unsigned int nr_pt_levels;
+
+	bool verbose;
+
+	/* Initial process */
+	struct process init;
+
+	/**
+	 * Ready queue. Put @current process to the tail of this list on
+	 * switch_process(). Don't forget to remove the switched process from
+	 * the list. Processes running on CPUs should not be listed in the
+	 * @processes.
+	 */
+	struct list_head processes;
+
+	/**
+	 * The number of PTEs mapping each page frame. Can be used to determine
+	 * how many processes are using the page frames. Note that a PTE in a
+	 * directory shared by several processes is counted once.
+	 */
+	unsigned int *mapcounts;
+
+	/**
+	 * Index of free page frames. The bit for a page frame is set while its
+	 * mapcount is zero, so the smallest free pfn is found without scanning
+	 * @mapcounts.
+	 */
+	struct hbitmap free_frames;
+
+	/**
+	 * Transparent huge pages. Alloc and faults on VPNs without pte_directory
+	 * map a huge page when @thp is set. @huge_mapcounts counts the huge PTEs
+	 * mapping each aligned block of NR_PTES_PER_PAGE frames, like @mapcounts
+	 * does for PTEs. Frames in a huge mapped block are in use regardless of
+	 * their @mapcounts, and are never reclaimed.
+	 */
+	bool thp;
+	unsigned int *huge_mapcounts;
+
+	/**
+	 * Reverse mapping. The PTEs mapping each page frame are chained in
+	 * @rmaps[pfn]. See rmap.h.
+	 */
+	struct list_head *rmaps;
+
+	/* Hash table indexing all processes including @current by pid */
+	struct hlist_head *pid_hash;
+	unsigned int pid_hash_bits;
+	unsigned int nr_processes;
+
+	/* Object caches for page tables and processes */
+	struct list_head slab_caches;
+	struct kmem_cache pte_directory_cache;
+	struct kmem_cache table_cache;
+	struct kmem_cache process_cache;
+	struct kmem_cache huge_pte_cache;	/* Only with @thp */
+	struct kmem_cache rmap_cache;
+	struct kmem_cache sharer_cache;
+
+	struct swap_area swap;
+	struct reclaim reclaim;
+	struct ksm ksm;
+	struct readahead readahead;
+	struct wss wss;
+	struct numa numa;
+	struct memcg memcg;
+
+	/* Snapshot that the save and load commands work on. See snapshot.h */
+	const char *snapshot_path;
+
+	struct output output;
+	struct vm_stats stats;
+	struct evtrace evtrace;
+
+	/* Simulated CPUs and their coordination. Managed by cpu.c */
+	unsigned int nr_cpus;
+	struct cpu *cpus;
+	pthread_mutex_t mm_lock;
+	bool (*run_record)(struct vm_sim *sim, const struct trace_record *rec);
+	bool stopped;		/* A record asked to stop the simulation */
+	bool stopping;		/* No more records will be queued */
+};
+
+/**
+ * Index of @vpn in the table at @level. The outer-most table is at level 0.
+ */
+static inline unsigned int pt_index(struct vm_sim *sim, unsigned int vpn,
+		unsigned int level)
+{
+	return (vpn >> (PTES_PER_PAGE_SHIFT * (NR_PT_LEVELS - 1 - level))) &
+			(NR_PTES_PER_PAGE - 1);
+}
+
+/**
+ * Walk @pt down to the entry for @vpn in the table right above the
+ * pte_directories, which is a pte_directory or a huge PTE.
+ * Return NULL if any table on the way is not populated.
+ */
+static inline void *pt_lookup(struct vm_sim *sim, struct pagetable *pt,
+		unsigned int vpn)
+{
+	void **table = pt->outer_ptes;
+
+	for (unsigned int level = 0; level < NR_PT_LEVELS - 1; level++) {
+		if (!table) return NULL;
+		table = table[pt_index(sim, vpn, level)];
+	}
+	return table;
+}
+
+/* The pte_directory covering @vpn, or NULL if absent or mapped huge */
+static inline struct pte_directory *pt_lookup_directory(struct vm_sim *sim,
+		struct pagetable *pt, unsigned int vpn)
+{
+	void *entry = pt_lookup(sim, pt, vpn);
+
+	return pt_huge(entry) ? NULL : entry;
+}
+
+/* The huge PTE covering @vpn, or NULL if @vpn is not mapped huge */
+static inline struct huge_pte *pt_lookup_huge(struct vm_sim *sim,
+		struct pagetable *pt, unsigned int vpn)
+{
+	void *entry = pt_lookup(sim, pt, vpn);
+
+	return pt_huge(entry) ? pt_to_huge(entry) : NULL;
+}
+
+/***********************************************************************
+ * vm_config_init()
+ *
+ * DESCRIPTION
+ *   Fill @config with the default configuration.
+ */
+void vm_config_init(struct vm_config *config);
+
+/***********************************************************************
+ * vm_config_check()
+ *
+ * DESCRIPTION
+ *   Validate @config, and tell what is wrong with it to stderr.
+ *
+ * RETURN VALUE
+ *   0 if @config is valid, -1 otherwise
+ */
+int vm_config_check(const struct vm_config *config);
+
+/***********************************************************************
+ * vm_sim_init()
+ *
+ * DESCRIPTION
+ *   Set up the simulation @sim configured with @config. Events and reports
+ *   of the simulation are written to @fp. The calling thread runs CPU 0 of
+ *   @sim until vm_sim_fini(). The state is restored from the snapshot at
+ *   @config->restore_path if given.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 on invalid configuration or memory shortage
+ */
+int vm_sim_init(struct vm_sim *sim, const struct vm_config *config, FILE *fp);
+
+/***********************************************************************
+ * vm_sim_fini()
+ *
+ * DESCRIPTION
+ *   Print the summary of @sim according to its output level, and release
+ *   everything in @sim.
+ */
+void vm_sim_fini(struct vm_sim *sim);
+
+/***********************************************************************
+ * vm_sim_run() / vm_sim_replay()
+ *
+ * DESCRIPTION
+ *   Run the simulation with the text trace @input / the binary trace @r
+ *   until the end of the trace or the exit command.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 if the simulated CPUs cannot be started
+ */
+int vm_sim_run(struct vm_sim *sim, FILE *input);
+int vm_sim_replay(struct vm_sim *sim, struct btrace_reader *r);
+
+/***********************************************************************
+ * vm_read_record()
+ *
+ * DESCRIPTION
+ *   Read lines from the text trace @input until a command is parsed into
+ *   @rec. Unknown commands are reported to stdout, followed by the prompt if
+ *   @verbose.
+ *
+ * RETURN VALUE
+ *   @true if @rec is read
+ *   @false on the end of @input
+ */
+bool vm_read_record(FILE *input, struct trace_record *rec, bool verbose);
+
+/***********************************************************************
+ * vm_batch_run()
+ *
+ * DESCRIPTION
+ *   Run the traces at @paths as independent simulations configured with
+ *   @config on @nr_threads threads. The output of each trace is written to
+ *   the file named after the trace with ".out" appended.
+ *
+ * RETURN VALUE
+ *   The number of traces that failed to run
+ *   -1 if the threads cannot be started
+ */
+int vm_batch_run(const struct vm_config *config, char * const paths[],
+		unsigned int nr_paths, unsigned int nr_threads);
+
 #endif
@@ -0,0 +1,68 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "types.h"
+#include "wss.h"
+
+int wss_init(struct wss *wss, unsigned int interval, const char *path)
+{
+	memset(wss, 0x00, sizeof(*wss));
+
+	if (!interval) return 0;
+
+	wss->interval = interval;
+	wss->next_scan = interval;
+
+	if (!path) return 0;
+
+	wss->fp = fopen(path, "w");
+	if (!wss->fp) return -1;
+
+	fprintf(wss->fp, "scan,accesses,pid,resident,accessed,dirty,idle\n");
+	return 0;
+}
+
+void wss_fini(struct wss *wss)
+{
+	if (wss->fp) fclose(wss->fp);
+	wss->fp = NULL;
+}
+
+void wss_record(struct wss *wss, unsigned int pid, const struct wss_sample *s)
+{
+	if (!wss->fp) return;
+
+	fprintf(wss->fp, "%lu,%lu,%u,%u,%u,%u,%u\n", wss->nr_scans,
+			wss->nr_accesses, pid, s->resident, s->accessed,
+			s->dirty, wss_idle(s));
+}
+
+void wss_show(struct wss *wss, FILE *fp)
+{
+	fprintf(fp, "Working sets\n");
+	fprintf(fp, "  scans : %lu, every %u accesses\n",
+			wss->nr_scans, wss->interval);
+	fprintf(fp, "  %5s %10s %10s %10s %10s\n",
+			"pid", "resident", "accessed", "dirty", "idle");
+}
+
+void wss_show_sample(unsigned int pid, const struct wss_sample *s, FILE *fp)
+{
+	fprintf(fp, "  %5u %10u %10u %10u %10u\n", pid,
+			s->resident, s->accessed, s->dirty, wss_idle(s));
+}
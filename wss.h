@@ -0,0 +1,99 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __WSS_H__
+#define __WSS_H__
+
+#include <stdio.h>
+
+#include "types.h"
+
+/**
+ * Working set estimation
+ *
+ * The MMU sets PTE_ACCESSED in the PTE it walks to, and PTE_DIRTY as well
+ * for writes. Like the hardware caching the dirty bit in the TLB, a TLB
+ * entry is filled writable only once the PTE is dirty, so the first write to
+ * a clean page walks the page table to set the bit.
+ *
+ * Every @interval accesses, the scanner samples the bits of the pages mapped
+ * by each process, and clears them. The translations of the cleared PTEs are
+ * shot down so that the next access sets the bits again. So a sample tells
+ * the pages that each process accessed and wrote in the last interval, and
+ * the pages it left idle. The samples go to the time series at @fp, one line
+ * per process in each scan.
+ */
+struct wss {
+	unsigned int interval;		/* Accesses between scans, 0 if disabled */
+	unsigned long nr_accesses;
+	unsigned long next_scan;	/* When @nr_accesses reaches this */
+	unsigned long nr_scans;
+
+	FILE *fp;			/* Time series, or NULL */
+};
+
+/* Pages of a process in a scan */
+struct wss_sample {
+	unsigned int resident;		/* Mapped to page frames */
+	unsigned int accessed;		/* Accessed in the interval */
+	unsigned int dirty;		/* Written in the interval */
+};
+
+/***********************************************************************
+ * wss_init()
+ *
+ * DESCRIPTION
+ *   Scan the working sets every @interval accesses, writing the time series
+ *   to @path unless it is NULL. Nothing is scanned if @interval is 0.
+ *
+ * RETURN VALUE
+ *   0 on success, -1 if @path cannot be written
+ */
+int wss_init(struct wss *wss, unsigned int interval, const char *path);
+void wss_fini(struct wss *wss);
+
+static inline bool wss_enabled(struct wss *wss)
+{
+	return wss->interval > 0;
+}
+
+/* Count @nr accesses, and tell whether the scanner should run now */
+static inline bool wss_tick(struct wss *wss, unsigned int nr)
+{
+	if (!wss_enabled(wss) || !nr) return false;
+
+	wss->nr_accesses += nr;
+	if (wss->nr_accesses < wss->next_scan) return false;
+
+	wss->next_scan = wss->nr_accesses + wss->interval;
+	return true;
+}
+
+static inline unsigned int wss_idle(const struct wss_sample *s)
+{
+	return s->resident - s->accessed;
+}
+
+/* Add @s of the process @pid to the time series of the current scan */
+void wss_record(struct wss *wss, unsigned int pid, const struct wss_sample *s);
+
+/**
+ * Print the header of the working sets, to be followed by wss_show_sample()
+ * for each process.
+ */
+void wss_show(struct wss *wss, FILE *fp);
+void wss_show_sample(unsigned int pid, const struct wss_sample *s, FILE *fp);
+
+#endif